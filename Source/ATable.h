@@ -6,6 +6,14 @@
 #include "cereal/types/vector.hpp"
 #include <utility>
 #include <algorithm>
+#include <deque>
+#include <limits>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "Envelope.h"
+#include "Util/LowRank.h"
 
 class ATable
 {
@@ -13,7 +21,13 @@ public:
 	struct Bin
 	{
 		float			   frequency;
-		std::vector<float> envelope;
+		Envelope		   envelope;
+		Envelope		   track;		// frequency of every frame relative to 'frequency' (float32), empty if constant.
+										// Set for partials merged from several bins, see CQTTable::mergePartials()
+		float			   bandwidth{ 0 };	// octaves, the bin is a band of noise around 'frequency' instead of a sine
+											// if not 0. See CQTTable::makeNoiseBands()
+		Envelope		   head;		// resident frames of streamed tables (Sparse, silent outside the heads),
+										// empty otherwise. See makeStreamHeads()
 
 		template<class Archive>
 		void serialize(Archive & archive)
@@ -40,6 +54,81 @@ public:
 		}
 	};
 	
+	// frame regions for sustained notes, set in the text file or found by detectRegions()
+	struct Regions
+	{
+		int	 loopStart{ -1 };		// first frame of the loop
+		int	 loopEnd{ -1 };			// playback jumps back to loopStart when reaching this frame
+		int	 releaseStart{ -1 };	// playback jumps here on note off, the release lasts until the last frame
+		bool trimmed{ false };		// frames between loop end and release start were removed
+
+		inline bool hasLoop()	 const { return (loopStart >= 0) && (loopEnd > loopStart); }
+		inline bool hasRelease() const { return releaseStart >= 0; }
+
+		// true if 'frame' is within the first 'numFrames' frames of the table, the loop or the release.
+		// Playback starts at those frames, see makeStreamHeads()
+		inline bool isHead(unsigned int frame, unsigned int numFrames) const;
+	};
+
+	// bin of a note mixed from two tables while playing, see TableBlend
+	struct BlendBin
+	{
+		float			frequency{ 0 };
+		const Envelope *envelopes[2]{ nullptr, nullptr };	// the second is nullptr if only one table contributes,
+		float			weights[2]{ 1, 0 };					// mixed frames end with the shorter envelope
+		const Envelope *track{ nullptr };					// see Bin::track, nullptr if constant
+		float			bandwidth{ 0 };						// see Bin::bandwidth
+	};
+
+	// loudness of a bin, see updateBinStats()
+	struct BinStats
+	{
+		float peak{ 0 };
+		float rms{ 0 };
+		float energy{ 0 };	// sum of the squared frames
+	};
+
+	// result of fitModes(), errors are relative to the bin (linear)
+	struct ModalReport
+	{
+		unsigned int numBins{ 0 };		// not silent
+		unsigned int numFitted{ 0 };
+		unsigned int numModes{ 0 };		// of all fitted bins
+		float		 errorSum{ 0 };		// of the fitted bins
+		float		 maxError{ 0 };
+	};
+
+	// result of pruneMasked()
+	struct MaskingReport
+	{
+		unsigned int numBins{ 0 };		// not silent before
+		unsigned int numPruned{ 0 };
+		double		 energy{ 0 };		// of the bins not silent before
+		double		 prunedEnergy{ 0 };
+	};
+
+	// amplitudes of the active bins, frame-major: the amplitudes of all bins for frame n, then frame n + 1 and so on.
+	// Rows are padded to MatrixPadding floats and start at a 64 byte boundary
+	struct FrameMatrix
+	{
+		std::vector<uint32_t> bins;				// bin index of every column, in the order of the ranking (loudest first)
+		unsigned int		  stride{ 0 };		// floats per row
+		unsigned int		  numFrames{ 0 };
+		std::vector<float>	  storage;
+		size_t				  offset{ 0 };		// first row within storage, aligned
+
+		inline const float * row(unsigned int frame) const { return storage.data() + offset + size_t(frame) * stride; }
+	};
+
+	// spreading of the masking threshold in dB per Bark, towards lower and higher frequencies than the masker
+	static constexpr double MaskingSlopeLower = 27;
+	static constexpr double MaskingSlopeUpper = 12;
+
+	static const unsigned int MatrixPadding	  = 16;	// floats, one cache line / AVX-512 register
+
+	static const unsigned int CrossfadeFrames = 4;	// frames the player crossfades over when jumping
+	static const unsigned int MinLoopFrames	  = 32;	// shortest loop found by detectRegions()
+
 	template<class Archive>
 	void serialize(Archive & archive)
 	{
@@ -48,6 +137,10 @@ public:
 	}
 	// #################### CONSTRUCTOR ####################
 public:
+	ATable() = default;
+	inline ATable(const ATable & rhs);
+	inline ATable & operator=(const ATable & rhs);
+	virtual ~ATable() = default;
 
 	// #################### MANIPULATION ####################
 public:
@@ -56,19 +149,111 @@ public:
 	inline void normalizeBinSizes();
 	
 	virtual ATable * interpolateTable(const ATable &t2, int targetMidi) const = 0;
-	virtual ATable * createShiftedTable(int targetMidi) = 0;
+	virtual ATable * createShiftedTable(int targetMidi) const = 0;
+
+	// the bins interpolateTable() would create, referencing the envelopes of both tables instead of mixing them.
+	// Only bins active in one of the tables are added, 'length' is the envelope length of the interpolated table
+	virtual bool blendBins(const ATable &t2, int targetMidi, std::vector<BlendBin> &bins, unsigned int &length) const = 0;
+
+	// re-encodes all envelopes (see EnvelopeCodec), active bins have to be refreshed afterwards.
+	// 'tolerance' (dB) only applies to Breakpoint envelopes. Envelopes shared with tables encoded with the same 'memo'
+	// stay shared
+	inline void setEncoding(Envelope::Encoding encoding, float tolerance = EnvelopeCodec::DefaultBreakpointTolerance, EnvelopeMemo *memo = nullptr);
+
+	// stores bins that are mostly silent as Sparse envelopes (see EnvelopeCodec), if that takes fewer bytes than their
+	// current encoding. Frames at or below 'floor' (relative to the loudest frame of the table) become silence in those
+	// bins, a floor of 0 only drops silent frames. Breakpoint envelopes are kept, silence costs them two breakpoints.
+	// Modal envelopes are kept as well
+	inline void makeSparse(float floor, EnvelopeMemo *memo = nullptr);
+
+	// silences the bins that are masked by the other bins of the table in every frame (simultaneous masking). The
+	// masking threshold of a frame spreads the power of every bin over the Bark scale (see MaskingSlopeLower / Upper),
+	// 'offset' (dB) below the level of the masker. Bins that never rise above the threshold share one silent Sparse
+	// envelope afterwards, the player skips them. There is no threshold in quiet, the levels of a table are relative
+	inline MaskingReport pruneMasked(float offset);
+
+	// replaces the envelopes of bins that decay exponentially after their peak (percussive bins) by the attack and a
+	// few decaying modes (see ModalFit.h), if the relative error of a bin stays within 'tolerance' (linear). The player
+	// renders those bins without reading envelopes after the attack. Envelopes shared with tables fitted with the same
+	// 'memo' stay shared
+	inline ModalReport fitModes(float tolerance, EnvelopeMemo *memo = nullptr);
 
+	// replaces the envelopes of the bins that aren't silent by a low-rank approximation (see LowRank.h), if the factors
+	// take fewer bytes than the envelopes. 'tolerance' is the relative error allowed (linear), the rank is the
+	// smallest one meeting it. Tables whose bins all share their envelopes with a table factorized with the same
+	// 'memo' (e.g. shifted tables) share its factors. Returns the rank, 0 if the table wasn't factorized
+	inline unsigned int factorize(float tolerance, EnvelopeMemo *memo = nullptr);
+
+	// searches the longest steady state after the attack and loops it, a decay after the steady
+	// state becomes the release. Returns false if the table has no steady state
+	inline bool detectRegions();
+
+	// removes the frames between loop end and release start, the table shrinks to attack + loop + release
+	inline void trimToRegions(EnvelopeMemo *memo = nullptr);
+
+	// copies the envelopes that are heap buffers of their own to 'arena', one after another. Envelopes shared with
+	// tables placed with the same 'memo' stay shared
+	inline void placeInArena(Arena & arena, EnvelopeMemo *memo = nullptr);
+
+	// the active bins are the loudest bins of the ranking (see updateBinStats()), changing them only moves the
+	// end of the active part of the ranking. The active count is atomic, it can be changed while the table is played.
+	// refreshActiveBins() updates the statistics if the envelopes changed since they were computed (when the table is
+	// prepared or loaded), the limits do so as well and otherwise only store the count
 	inline void refreshActiveBins();
 	inline void applyThreshold(float val);
 	inline void limitNumActiveBins(unsigned int num);
 
+	// frees the envelopes of the inactive bins, they share one silent Sparse envelope afterwards and stay at the end
+	// of the ranking. The bins themselves are kept, interpolation pairs the bins of two tables by index. Activating
+	// more bins afterwards only adds silent bins. Not while the table is played. Returns the bins compacted
+	inline unsigned int compactInactiveBins();
+
+	// replaces envelopes and tracks by their copy in 'pool' (see EnvelopePool), tables with identical bins then share
+	// the memory. The samples don't change, the statistics stay valid. Not while the table is played
+	inline void shareEnvelopes(EnvelopePool & pool);
+
+	// keeps the heads of the envelopes (see Regions::isHead()) as Bin::head, the player reads them while the frames
+	// after them are streamed (see EnvelopeStream). Frequency tracks are read by the player at every frame, tracks
+	// placed in a mapped file are copied to memory. Call after the envelopes and regions are final, 0 drops the heads
+	inline void makeStreamHeads(unsigned int numFrames);
+
+	// computes peak, rms and energy of every bin and ranks the bins by peak, loudest first
+	inline void updateBinStats();
+
+	// keeps the active bins as FrameMatrix as well, rebuilt by refreshActiveBins() and compactInactiveBins(). Costs
+	// the memory of the active bins as float32, the player reads the matrix instead of decoding the envelopes. A table
+	// limited to fewer bins plays the first columns, more bins than the matrix was built for are played after a refresh
+	inline void setFrameMatrix(bool enabled);
+
+	// statistics computed before (e.g. stored in a cache). Returns false if they don't match the bins
+	inline bool setBinStats(std::vector<BinStats> && stats, std::vector<uint32_t> && ranking);
+
 	// #################### GETTER // SETTER ####################
 public:
 
 	virtual bool isValid() const = 0;
 
+	// indices of the active bins into getBins(), loudest first. A view into the ranking, valid until the statistics
+	// are updated. Without a ranking all bins are active, in their order
+	struct ActiveBins
+	{
+		const uint32_t * ranking{ nullptr };	// nullptr: bin i is the i-th active bin
+		unsigned int	 count{ 0 };
+
+		inline unsigned int size() const { return count; }
+		inline uint32_t operator[](unsigned int i) const { return (ranking != nullptr) ? ranking[i] : i; }
+	};
+
 	inline const std::vector<Bin> & getBins()  const;
-	inline const std::vector<const Bin*> & getActiveBins()  const;
+	inline ActiveBins				getActiveBins()  const;
+	inline bool						isActive(unsigned int bin) const;
+	inline unsigned int				getNumActiveBins() const;
+
+	// statistics and ranking are outdated if hasBinStats() is false (the envelopes changed since updateBinStats())
+	inline bool							 hasBinStats()	 const { return statsValid; }
+	inline const std::vector<BinStats> & getBinStats()	 const;
+	inline std::shared_ptr<const FrameMatrix> getFrameMatrix() const;	// nullptr if not enabled
+	inline const std::vector<uint32_t> & getBinRanking() const;	// bin indices, loudest first
 
 	inline void		setBins(std::vector<Bin> &&		 bins);
 	inline void		setBins(const std::vector<Bin> & bins);
@@ -81,16 +266,78 @@ public:
 
 	inline unsigned int	getEnvelopeLength() const;
 
+	// true if a bin has a frequency track (see Bin::track)
+	inline bool			hasFrequencyTracks() const;
+
+	// true if a bin is a noise band (see Bin::bandwidth)
+	inline bool			hasNoiseBands() const;
+
+	inline const Regions & getRegions() const;
+	inline void			   setRegions(const Regions & regions);
+
+	// frames per head of streamed tables, 0 if the table isn't streamed (see makeStreamHeads())
+	inline unsigned int	getHeadFrames() const { return headFrames; }
+
+	// the bin whose envelope is 'envelope', nullptr if it isn't an envelope of this table
+	inline const Bin *	findBin(const Envelope * envelope) const;
+
 protected:
 	// #################### MEMBER ####################
 
 	Config cfg;
+	Regions regions;
 
-	std::vector<const Bin*> activeBins;
 	std::vector<Bin> bins; // list of frequencies
 	int	  midiNote{ -1 };  // -1: invalid
+
+	std::vector<BinStats>	  stats;
+	std::vector<uint32_t>	  ranking;
+	std::vector<uint32_t>	  rankOf;				// position of every bin in the ranking
+	bool					  statsValid{ false };	// false after the envelopes changed
+	unsigned int			  headFrames{ 0 };		// see makeStreamHeads()
+	std::atomic<unsigned int> numActive{ std::numeric_limits<unsigned int>::max() };	// active bins at the start of the ranking
+
+	// swapped atomically (std::atomic_load / atomic_store), the active bins may change while the table is played
+	std::shared_ptr<const FrameMatrix> frameMatrix;
+	bool							   frameMatrixEnabled{ false };
+
+	inline void updateFrameMatrix();
 };
 
+inline ATable::ATable(const ATable & rhs)
+	:
+	cfg(rhs.cfg),
+	regions(rhs.regions),
+	bins(rhs.bins),
+	midiNote(rhs.midiNote),
+	stats(rhs.stats),
+	ranking(rhs.ranking),
+	rankOf(rhs.rankOf),
+	statsValid(rhs.statsValid),
+	headFrames(rhs.headFrames),
+	numActive(rhs.numActive.load()),
+	frameMatrix(rhs.getFrameMatrix()),
+	frameMatrixEnabled(rhs.frameMatrixEnabled)
+{
+}
+
+inline ATable & ATable::operator=(const ATable & rhs)
+{
+	cfg		   = rhs.cfg;
+	regions	   = rhs.regions;
+	bins	   = rhs.bins;
+	midiNote   = rhs.midiNote;
+	stats	   = rhs.stats;
+	ranking	   = rhs.ranking;
+	rankOf	   = rhs.rankOf;
+	statsValid = rhs.statsValid;
+	headFrames = rhs.headFrames;
+	numActive  = rhs.numActive.load();
+	std::atomic_store(&frameMatrix, rhs.getFrameMatrix());
+	frameMatrixEnabled = rhs.frameMatrixEnabled;
+	return *this;
+}
+
 
 inline unsigned int ATable::getMidiNote() const
 {
@@ -106,29 +353,69 @@ inline const std::vector<ATable::Bin> & ATable::getBins() const
 {
 	return bins;
 }
-inline const std::vector<const ATable::Bin*> & ATable::getActiveBins() const
+
+inline const ATable::Bin * ATable::findBin(const Envelope * envelope) const
 {
-	return activeBins;
+	// the envelopes of the bins lie 'sizeof(Bin)' bytes apart
+	if (bins.empty() || envelope < &bins.front().envelope || envelope > &bins.back().envelope) return nullptr;
+
+	auto offset = reinterpret_cast<const char*>(envelope) - reinterpret_cast<const char*>(&bins.front().envelope);
+	if (offset % sizeof(Bin) != 0) return nullptr;
+	return &bins[offset / sizeof(Bin)];
+}
+inline ATable::ActiveBins ATable::getActiveBins() const
+{
+	ActiveBins active;
+	if (ranking.size() != bins.size())
+	{
+		active.count = bins.size();
+		return active;
+	}
+	active.ranking = ranking.data();
+	active.count   = getNumActiveBins();
+	return active;
+}
+
+inline bool ATable::isActive(unsigned int bin) const
+{
+	// without a ranking all bins are active
+	if (rankOf.size() != bins.size()) return true;
+	return rankOf[bin] < getNumActiveBins();
+}
+
+inline unsigned int ATable::getNumActiveBins() const
+{
+	if (ranking.size() != bins.size()) return bins.size();
+	return std::min<unsigned int>(numActive.load(), bins.size());
+}
+
+inline const std::vector<ATable::BinStats> & ATable::getBinStats() const
+{
+	return stats;
+}
+
+inline std::shared_ptr<const ATable::FrameMatrix> ATable::getFrameMatrix() const
+{
+	return std::atomic_load(&frameMatrix);
+}
+
+inline const std::vector<uint32_t> & ATable::getBinRanking() const
+{
+	return ranking;
 }
 
 inline void ATable::setBins(std::vector<Bin>&& bins)
 {
 	this->bins = std::move(bins);
-	activeBins.clear();
-	for(auto & bin: this->bins)
-	{
-		activeBins.push_back(&bin);
-	}
+	statsValid = false;
+	numActive  = std::numeric_limits<unsigned int>::max();
 }
 
 inline void ATable::setBins(const std::vector<Bin>& bins)
 {
 	this->bins = bins;
-	activeBins.clear();
-	for (auto & bin : this->bins)
-	{
-		activeBins.push_back(&bin);
-	}
+	statsValid = false;
+	numActive  = std::numeric_limits<unsigned int>::max();
 }
 
 inline unsigned int ATable::getEnvelopeLength() const
@@ -136,6 +423,26 @@ inline unsigned int ATable::getEnvelopeLength() const
 	return bins[0].envelope.size();
 }
 
+inline bool ATable::hasFrequencyTracks() const
+{
+	return std::any_of(bins.begin(), bins.end(), [](const Bin & bin) { return !bin.track.empty(); });
+}
+
+inline bool ATable::hasNoiseBands() const
+{
+	return std::any_of(bins.begin(), bins.end(), [](const Bin & bin) { return bin.bandwidth > 0; });
+}
+
+inline const ATable::Regions & ATable::getRegions() const
+{
+	return regions;
+}
+
+inline void ATable::setRegions(const Regions & regions)
+{
+	this->regions = regions;
+}
+
 inline ATable::Config ATable::getConfig() const
 {
 	return cfg;
@@ -148,7 +455,7 @@ inline void ATable::setConfig(Config cfg)
 
 void ATable::normalizeBinSizes()
 {
-	int maxLength = 0;
+	unsigned int maxLength = 0;
 	for (auto & bin : bins)
 	{
 		if (bin.envelope.size() > maxLength) maxLength = bin.envelope.size();
@@ -156,62 +463,626 @@ void ATable::normalizeBinSizes()
 
 	for (auto & bin : bins)
 	{
-		// the current implementation is very time consluming because all bins have to be reallocated
-		auto lengthDiff = maxLength - bin.envelope.size();
-		auto zeroFill = std::vector<float>(lengthDiff, 0);
-		bin.envelope.insert(bin.envelope.end(), zeroFill.begin(), zeroFill.end());
+		// only bins that are too short are reallocated
+		bin.envelope.resize(maxLength, 0);
 	}
+	statsValid = false;
 }
 
-inline void ATable::refreshActiveBins()
+inline void ATable::setEncoding(Envelope::Encoding encoding, float tolerance, EnvelopeMemo *memo)
 {
-	activeBins.clear();
-	for (const auto & bin : this->bins) activeBins.push_back(&bin);
+	auto encode = [encoding, tolerance](const Envelope & envelope) { return envelope.encode(encoding, tolerance); };
+
+	for (auto & bin : bins)
+	{
+		if (memo != nullptr) bin.envelope = memo->get(bin.envelope, static_cast<uint64_t>(encoding), encode);
+		else				 bin.envelope = encode(bin.envelope);
+	}
+	statsValid = false;
 }
 
-inline void ATable::applyThreshold(float val)
+inline void ATable::makeSparse(float floor, EnvelopeMemo * memo)
+{
+	float peak = 0;
+	if (floor > 0) for (auto const & bin : bins) peak = std::max(peak, bin.envelope.peak());
+	floor *= peak;
+
+	// tags of the other transformations are encodings, frame counts and the arena, the floor tells the results apart
+	uint32_t floorBits;
+	std::memcpy(&floorBits, &floor, sizeof(float));
+	uint64_t tag = (uint64_t(1) << 63) | floorBits;
+
+	auto sparse = [floor](const Envelope & envelope)
+	{
+		auto encoding = envelope.getEncoding();
+		if (encoding == Envelope::Encoding::Breakpoint || encoding == Envelope::Encoding::Sparse || encoding == Envelope::Encoding::Modal) return envelope;
+
+		auto result = envelope.sparse(floor);
+		return (result.rawSize() < envelope.rawSize()) ? result : envelope;
+	};
+
+	for (auto & bin : bins)
+	{
+		auto envelope = (memo != nullptr) ? memo->get(bin.envelope, tag, sparse) : sparse(bin.envelope);
+		if (envelope.rawData() == bin.envelope.rawData()) continue;
+
+		bin.envelope = envelope;
+		statsValid	 = false;
+	}
+}
+
+inline bool ATable::Regions::isHead(unsigned int frame, unsigned int numFrames) const
+{
+	auto within = [frame, numFrames](int start) { return start >= 0 && frame >= unsigned(start) && frame - unsigned(start) < numFrames; };
+	return within(0) || (hasLoop() && within(loopStart)) || (hasRelease() && within(releaseStart));
+}
+
+inline ATable::MaskingReport ATable::pruneMasked(float offset)
+{
+	MaskingReport report;
+	if (bins.size() < 2) return report;
+
+	auto numFrames = getEnvelopeLength();
+	std::vector<std::vector<float>> envelopes(bins.size());
+	std::vector<unsigned int> order;
+	for (unsigned int b = 0; b < bins.size(); b++)
+	{
+		envelopes[b] = bins[b].envelope.toVector();
+
+		double energy = 0;
+		for (auto value : envelopes[b]) energy += double(value) * value;
+		if (energy <= 0 || bins[b].frequency <= 0) continue;
+
+		order.push_back(b);
+		report.numBins++;
+		report.energy += energy;
+	}
+	if (order.size() < 2) return report;
+
+	// the threshold spreads from bin to bin along the frequency, the attenuation of a step only depends on its width
+	std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return bins[a].frequency < bins[b].frequency; });
+
+	auto bark = [](double frequency) { return 26.81 * frequency / (1960. + frequency) - 0.53; };
+	size_t numBins = order.size();
+	std::vector<double> stepUp(numBins, 0), stepDown(numBins, 0);
+	for (size_t k = 1; k < numBins; k++)
+	{
+		double width = bark(bins[order[k]].frequency) - bark(bins[order[k - 1]].frequency);
+		stepUp[k]	 = std::pow(10., -MaskingSlopeUpper * width / 10.);	// from bin k - 1 up to k
+		stepDown[k]	 = std::pow(10., -MaskingSlopeLower * width / 10.);	// from bin k down to k - 1
+	}
+	double index = std::pow(10., -offset / 10.);
+
+	std::vector<double> power(numBins), upward(numBins), downward(numBins);
+	std::vector<bool>	audible(numBins, false);
+	for (unsigned int n = 0; n < numFrames; n++)
+	{
+		for (size_t k = 0; k < numBins; k++)
+		{
+			auto &envelope = envelopes[order[k]];
+			double value = (n < envelope.size()) ? envelope[n] : 0;
+			power[k] = value * value;
+		}
+
+		// the threshold of a bin comes from the bins below and above it, not from itself
+		upward[0] = 0;
+		for (size_t k = 1; k < numBins; k++) upward[k] = (upward[k - 1] + power[k - 1]) * stepUp[k];
+		downward[numBins - 1] = 0;
+		for (size_t k = numBins - 1; k > 0; k--) downward[k - 1] = (downward[k] + power[k]) * stepDown[k];
+
+		for (size_t k = 0; k < numBins; k++)
+		{
+			if (power[k] > (upward[k] + downward[k]) * index) audible[k] = true;
+		}
+	}
+
+	Envelope silence = Envelope(numFrames, 0).encode(Envelope::Encoding::Sparse);
+	for (size_t k = 0; k < numBins; k++)
+	{
+		if (audible[k]) continue;
+
+		double energy = 0;
+		for (auto value : envelopes[order[k]]) energy += double(value) * value;
+		report.prunedEnergy += energy;
+		report.numPruned++;
+
+		bins[order[k]].envelope = silence;
+	}
+
+	if (report.numPruned > 0) statsValid = false;
+	return report;
+}
+
+inline ATable::ModalReport ATable::fitModes(float tolerance, EnvelopeMemo * memo)
+{
+	uint32_t toleranceBits;
+	std::memcpy(&toleranceBits, &tolerance, sizeof(float));
+	uint64_t tag = (uint64_t(1) << 61) | toleranceBits;
+
+	auto fit = [tolerance](const Envelope & envelope)
+	{
+		auto encoding = envelope.getEncoding();
+		if (encoding == Envelope::Encoding::LowRank || encoding == Envelope::Encoding::Modal) return envelope;
+
+		return envelope.modal(tolerance);
+	};
+
+	ModalReport report;
+	std::vector<float> source, fitted;
+	for (unsigned int b = 0; b < bins.size(); b++)
+	{
+		auto &envelope = bins[b].envelope;
+		float peak = statsValid ? stats[b].peak : envelope.peak();
+		if (peak <= 0) continue;
+
+		report.numBins++;
+		auto result = (memo != nullptr) ? memo->get(envelope, tag, fit) : fit(envelope);
+		if (result.rawData() == envelope.rawData()) continue;
+
+		// the error is measured again, the fit might come from the memo
+		source = envelope.toVector();
+		fitted = result.toVector();
+		double difference = 0, energy = 0;
+		for (size_t k = 0; k < source.size(); k++)
+		{
+			difference += double(source[k] - fitted[k]) * (source[k] - fitted[k]);
+			energy	   += double(source[k]) * source[k];
+		}
+		float error = static_cast<float>(std::sqrt(difference / energy));
+
+		EnvelopeCodec::ModalHeader header;
+		result.getModalModes(header);
+
+		report.numFitted++;
+		report.numModes += header.numModes;
+		report.errorSum += error;
+		report.maxError	 = std::max(report.maxError, error);
+
+		envelope   = result;
+		statsValid = false;
+	}
+	return report;
+}
+
+inline unsigned int ATable::factorize(float tolerance, EnvelopeMemo * memo)
+{
+	uint32_t toleranceBits;
+	std::memcpy(&toleranceBits, &tolerance, sizeof(float));
+	uint64_t tag = (uint64_t(1) << 62) | toleranceBits;
+
+	// silent bins are left out, tables factorized before stay as they are
+	std::vector<unsigned int> columns;
+	size_t bytes = 0;
+	for (unsigned int b = 0; b < bins.size(); b++)
+	{
+		auto &envelope = bins[b].envelope;
+		if (envelope.getEncoding() == Envelope::Encoding::LowRank) return 0;
+
+		float peak = statsValid ? stats[b].peak : envelope.peak();
+		if (peak <= 0) continue;
+
+		columns.push_back(b);
+		bytes += envelope.rawSize();
+	}
+	if (columns.empty()) return 0;
+
+	if (memo != nullptr)
+	{
+		std::vector<Envelope> shared;
+		for (auto b : columns)
+		{
+			auto result = memo->find(bins[b].envelope, tag);
+			if (result == nullptr) break;
+			shared.push_back(*result);
+		}
+
+		if (shared.size() == columns.size())
+		{
+			for (unsigned int c = 0; c < columns.size(); c++) bins[columns[c]].envelope = shared[c];
+			statsValid = false;
+			return shared[0].getLowRankColumn()->rank;
+		}
+	}
+
+	// frame-major like the FrameMatrix, bins shorter than the table are silent at the end
+	unsigned int numFrames	= 0;
+	for (auto b : columns) numFrames = std::max(numFrames, bins[b].envelope.size());
+
+	unsigned int numColumns = columns.size();
+	std::vector<float> matrix(size_t(numFrames) * numColumns, 0.f);
+	std::vector<float> envelope;
+	for (unsigned int c = 0; c < numColumns; c++)
+	{
+		auto &source = bins[columns[c]].envelope;
+		envelope.resize(source.size());
+		source.decode(0, source.size(), envelope.data());
+		for (unsigned int k = 0; k < source.size(); k++) matrix[size_t(k) * numColumns + c] = envelope[k];
+	}
+
+	// the factors have to take fewer bytes than the envelopes
+	size_t bytesPerRank = (size_t(numFrames) + numColumns) * sizeof(float);
+	auto   maxRank		= static_cast<unsigned int>(std::min<size_t>(EnvelopeCodec::MaxLowRank, bytes / bytesPerRank));
+
+	LowRank::Factors factors;
+	if (maxRank == 0 || !LowRank::factorize(matrix.data(), numFrames, numColumns, numColumns, tolerance, maxRank, factors)) return 0;
+
+	auto owner = std::make_shared<const LowRank::Factors>(std::move(factors));
+	for (unsigned int c = 0; c < numColumns; c++)
+	{
+		auto &bin = bins[columns[c]];
+
+		EnvelopeCodec::LowRankColumn column = { owner->activations.data(), owner->templates.data(), owner->rank, numColumns, c, numFrames };
+		auto result = Envelope::lowRank(owner, column, bin.envelope.size());
+
+		if (memo != nullptr) memo->get(bin.envelope, tag, [&result](const Envelope &) { return result; });
+		bin.envelope = result;
+	}
+	statsValid = false;
+	return owner->rank;
+}
+
+inline bool ATable::detectRegions()
 {
-	activeBins.clear();
+	const float SteadyStateRange = 6.f;	// dB the smoothed level may vary within the steady state
+	const float ReleaseDrop		 = 6.f;	// dB the level has to fall below the steady state to count as release
+	const int	SmoothingFrames	 = 16;	// the level is averaged over +- SmoothingFrames, vibrato isn't a change of state
+
+	if (bins.empty()) return false;
+
+	auto numFrames = getEnvelopeLength();
+	if (numFrames < MinLoopFrames + 2 * CrossfadeFrames) return false;
+
+	std::vector<std::vector<float>> envelopes;
+	envelopes.reserve(bins.size());
 
+	// summed level of all bins per frame
+	std::vector<float> level(numFrames, 0);
 	for (const auto & bin : bins)
 	{
-		float max = 0;
-		for (auto sample : bin.envelope)
-			if (sample > max) max = sample;
-			
-		if (max > val)
-			activeBins.push_back(&bin);
+		envelopes.push_back(bin.envelope.toVector());
+		auto &envelope = envelopes.back();
+		for (unsigned int k = 0; k < numFrames && k < envelope.size(); k++) level[k] += envelope[k];
+	}
+
+	unsigned int peakFrame = std::max_element(level.begin(), level.end()) - level.begin();
+
+	std::vector<double> levelSum(numFrames + 1, 0);
+	for (unsigned int k = 0; k < numFrames; k++) levelSum[k + 1] = levelSum[k] + level[k];
+
+	for (int k = 0; k < static_cast<int>(numFrames); k++)
+	{
+		int first = std::max(0, k - SmoothingFrames);
+		int last  = std::min(static_cast<int>(numFrames), k + SmoothingFrames + 1);
+		float mean = (levelSum[last] - levelSum[first]) / (last - first);
+		level[k] = 20.f * std::log10(std::max(mean, 1e-9f));
 	}
+
+	// longest window after the peak in which the level stays within SteadyStateRange,
+	// the deques hold the candidates for maximum and minimum of the window
+	std::deque<unsigned int> maxima;
+	std::deque<unsigned int> minima;
+	unsigned int start		= peakFrame;
+	unsigned int bestStart	= peakFrame;
+	unsigned int bestLength = 0;
+
+	for (unsigned int end = peakFrame; end < numFrames; end++)
+	{
+		while (!maxima.empty() && level[maxima.back()] <= level[end]) maxima.pop_back();
+		while (!minima.empty() && level[minima.back()] >= level[end]) minima.pop_back();
+		maxima.push_back(end);
+		minima.push_back(end);
+
+		while (level[maxima.front()] - level[minima.front()] > SteadyStateRange)
+		{
+			start++;
+			if (maxima.front() < start) maxima.pop_front();
+			if (minima.front() < start) minima.pop_front();
+		}
+
+		if (end - start + 1 > bestLength)
+		{
+			bestLength = end - start + 1;
+			bestStart  = start;
+		}
+	}
+
+	if (bestLength < MinLoopFrames) return false;
+
+	// the loop starts a little later, the transition from the attack isn't part of it
+	Regions detected;
+	detected.loopStart = bestStart + CrossfadeFrames;
+	unsigned int steadyEnd = bestStart + bestLength - 1;
+
+	// bins shorter than the first one are silent after their last frame
+	auto frameOf = [](const std::vector<float> & envelope, unsigned int frame) { return (frame < envelope.size()) ? envelope[frame] : 0.f; };
+
+	// the loop ends at the frame of the second half of the steady state that resembles the loop start the most
+	float bestDistance = std::numeric_limits<float>::max();
+	unsigned int searchStart = std::max(detected.loopStart + 2 * CrossfadeFrames, steadyEnd - bestLength / 2);
+	for (unsigned int frame = searchStart; frame <= steadyEnd; frame++)
+	{
+		float distance = 0;
+		for (const auto & envelope : envelopes) distance += std::abs(frameOf(envelope, frame) - frameOf(envelope, detected.loopStart));
+
+		if (distance < bestDistance)
+		{
+			bestDistance	 = distance;
+			detected.loopEnd = frame;
+		}
+	}
+	if (!detected.hasLoop()) return false;
+
+	float steadyLevel = *std::min_element(level.begin() + bestStart, level.begin() + steadyEnd + 1);
+	if (steadyEnd + 1 < numFrames && *std::min_element(level.begin() + steadyEnd + 1, level.end()) < steadyLevel - ReleaseDrop)
+	{
+		detected.releaseStart = steadyEnd + 1;
+	}
+
+	regions = detected;
+	return true;
+}
+
+inline void ATable::trimToRegions(EnvelopeMemo *memo)
+{
+	if (bins.empty() || !regions.hasLoop() || regions.trimmed) return;
+
+	auto numFrames = getEnvelopeLength();
+	if (regions.loopEnd >= static_cast<int>(numFrames)) return;
+
+	// nothing between loop and release
+	if (regions.hasRelease() && regions.releaseStart <= regions.loopEnd + 1) return;
+
+	// the frame after the loop end is kept, playback interpolates towards it
+	bool keepRelease = regions.hasRelease() && (regions.releaseStart > regions.loopEnd) && (regions.releaseStart < static_cast<int>(numFrames));
+	unsigned int loopFrames = std::min<unsigned int>(regions.loopEnd + 2, numFrames);
+	if (keepRelease) loopFrames = regions.loopEnd + 1;
+
+	int releaseStart = keepRelease ? regions.releaseStart : -1;
+	auto trim = [loopFrames, releaseStart](const Envelope & source)
+	{
+		auto envelope = source.toVector();
+
+		// bins shorter than the table keep what they have of the loop and the release
+		auto loopEnd = envelope.begin() + std::min<size_t>(loopFrames, envelope.size());
+		std::vector<float> trimmed(envelope.begin(), loopEnd);
+		if (releaseStart >= 0 && size_t(releaseStart) < envelope.size()) trimmed.insert(trimmed.end(), envelope.begin() + releaseStart, envelope.end());
+
+		return Envelope(std::move(trimmed)).encode(source.getEncoding());
+	};
+
+	// the result only depends on the kept frames
+	uint64_t tag = (uint64_t(loopFrames) << 32) | uint32_t(releaseStart);
+
+	for (auto & bin : bins)
+	{
+		if (memo != nullptr) bin.envelope = memo->get(bin.envelope, tag, trim);
+		else				 bin.envelope = trim(bin.envelope);
+
+		// tracks line up with the envelopes
+		if (bin.track.size() == numFrames) bin.track = (memo != nullptr) ? memo->get(bin.track, tag, trim) : trim(bin.track);
+	}
+
+	if (keepRelease)			  regions.releaseStart = loopFrames;
+	else if (regions.hasRelease()) regions.releaseStart = -1;
+	regions.trimmed = true;
+	statsValid = false;
+	refreshActiveBins();
+}
+
+inline void ATable::placeInArena(Arena & arena, EnvelopeMemo * memo)
+{
+	// tags of the other transformations are encodings and frame counts
+	const uint64_t ArenaTag = std::numeric_limits<uint64_t>::max();
+
+	auto place = [&arena](const Envelope & envelope) { return envelope.placeIn(arena); };
+
+	for (auto & bin : bins)
+	{
+		if (bin.envelope.isPlaced()) continue;
+
+		if (memo != nullptr) bin.envelope = memo->get(bin.envelope, ArenaTag, place);
+		else				 bin.envelope = place(bin.envelope);
+	}
+}
+
+inline void ATable::refreshActiveBins()
+{
+	if (!statsValid) updateBinStats();
+	numActive = bins.size();
+	updateFrameMatrix();
+}
+
+inline void ATable::applyThreshold(float val)
+{
+	// stale statistics would rank by old peaks, the matrix is rebuilt with the new ranking
+	if (!statsValid) refreshActiveBins();
+
+	// the peaks decrease along the ranking
+	auto end = std::partition_point(ranking.begin(), ranking.end(), [this, val](uint32_t bin) { return stats[bin].peak > val; });
+	numActive = end - ranking.begin();
 }
 
 inline void ATable::limitNumActiveBins(unsigned int num)
 {
 	if (num > bins.size()) return;
-	std::vector<std::pair<Bin*, float>> map;
-	map.reserve(bins.size());
+	if (!statsValid) refreshActiveBins();
+	numActive = num;
+}
 
-	for (auto & bin : bins)
+inline unsigned int ATable::compactInactiveBins()
+{
+	if (!statsValid) updateBinStats();
+
+	Envelope silence;
+	unsigned int numCompacted = 0;
+	for (unsigned int b = 0; b < bins.size(); b++)
 	{
-		float max = 0;
-		for (auto sample : bin.envelope)
-			if (sample > max) max = sample;
+		auto &bin = bins[b];
+		bool silent = (bin.envelope.getEncoding() == Envelope::Encoding::Sparse) && (stats[b].peak == 0) && bin.track.empty();
+		if (isActive(b) || silent) continue;
 
-		map.push_back({ &bin, max });
+		if (silence.size() != bin.envelope.size()) silence = Envelope(bin.envelope.size(), 0).encode(Envelope::Encoding::Sparse);
+		bin.envelope  = silence;
+		bin.track	  = Envelope();
+		bin.bandwidth = 0;
+		stats[b]	  = BinStats();
+		numCompacted++;
 	}
+	// the matrix keeps the active bins only
+	if (numCompacted > 0) updateFrameMatrix();
+	return numCompacted;
+}
 
-	auto sortByMax = [](const std::pair<Bin*, float>& lhs, std::pair<Bin*, float> rhs) -> bool
+inline void ATable::shareEnvelopes(EnvelopePool & pool)
+{
+	for (auto &bin : bins)
 	{
-		return rhs.second < lhs.second;
-	};
+		auto &envelope = pool.share(bin.envelope);
+		if (envelope.rawData() != bin.envelope.rawData()) bin.envelope = envelope;
+
+		auto &track = pool.share(bin.track);
+		if (track.rawData() != bin.track.rawData()) bin.track = track;
+	}
+}
+
+inline void ATable::makeStreamHeads(unsigned int numFrames)
+{
+	headFrames = numFrames;
+
+	std::vector<int> starts = { 0 };
+	if (regions.hasLoop())	  starts.push_back(regions.loopStart);
+	if (regions.hasRelease()) starts.push_back(regions.releaseStart);
+
+	for (auto &bin : bins)
+	{
+		if (numFrames == 0)
+		{
+			bin.head = Envelope();
+			continue;
+		}
+
+		// only the frames of the heads are decoded, pages of a mapped file outside of them aren't touched
+		auto length = bin.envelope.size();
+		std::vector<float> frames(length, 0.f);
+		for (auto start : starts)
+		{
+			if (unsigned(start) >= length) continue;
+			bin.envelope.decode(start, std::min(numFrames, length - start), frames.data() + start);
+		}
+		bin.head = Envelope(std::move(frames)).encode(Envelope::Encoding::Sparse);
+
+		if (!bin.track.empty() && bin.track.isPlaced()) bin.track = Envelope(bin.track.toVector());
+	}
+}
+
+inline void ATable::setFrameMatrix(bool enabled)
+{
+	if (enabled == frameMatrixEnabled) return;
+
+	frameMatrixEnabled = enabled;
+	updateFrameMatrix();
+}
+
+inline void ATable::updateFrameMatrix()
+{
+	if (!frameMatrixEnabled || bins.empty())
+	{
+		std::atomic_store(&frameMatrix, std::shared_ptr<const FrameMatrix>());
+		return;
+	}
+
+	// the columns follow the ranking, a lower limit plays the first ones
+	auto matrix = std::make_shared<FrameMatrix>();
+	auto active = getActiveBins();
+	matrix->bins.reserve(active.size());
+	for (unsigned int i = 0; i < active.size(); i++) matrix->bins.push_back(active[i]);
+
+	const size_t RowAlignment = 64;
+	const size_t Floats		  = RowAlignment / sizeof(float);
 
-	std::sort(map.begin(), map.end(), sortByMax);
+	matrix->numFrames = getEnvelopeLength();
+	matrix->stride	  = (matrix->bins.size() + MatrixPadding - 1) / MatrixPadding * MatrixPadding;
+	matrix->storage.assign(size_t(matrix->numFrames) * matrix->stride + Floats, 0.f);
 
-	activeBins.clear();
-	activeBins.reserve(num);
-	for (int i = 0; i < num; i++)
+	auto misalignment = reinterpret_cast<uintptr_t>(matrix->storage.data()) % RowAlignment;
+	matrix->offset	  = misalignment ? (RowAlignment - misalignment) / sizeof(float) : 0;
+	float * rows	  = matrix->storage.data() + matrix->offset;
+
+	// one column per bin, bins shorter than the table stay silent at the end
+	std::vector<float> envelope;
+	for (unsigned int column = 0; column < matrix->bins.size(); column++)
 	{
-		activeBins.push_back(map[i].first);
+		auto & source = bins[matrix->bins[column]].envelope;
+		envelope.resize(source.size());
+		source.decode(0, source.size(), envelope.data());
+
+		auto frames = std::min<unsigned int>(source.size(), matrix->numFrames);
+		for (unsigned int k = 0; k < frames; k++) rows[size_t(k) * matrix->stride + column] = envelope[k];
 	}
+
+	std::atomic_store(&frameMatrix, std::shared_ptr<const FrameMatrix>(std::move(matrix)));
+}
+
+inline void ATable::updateBinStats()
+{
+	// decodes in chunks like Envelope::peak(), no allocation per bin
+	const unsigned int ChunkSize = 256;
+	float chunk[ChunkSize];
+
+	stats.assign(bins.size(), BinStats());
+	for (unsigned int b = 0; b < bins.size(); b++)
+	{
+		auto &envelope = bins[b].envelope;
+		auto length	   = envelope.size();
+		float  peak	   = 0;
+		double energy  = 0;
+
+		for (unsigned int start = 0; start < length; start += ChunkSize)
+		{
+			auto count = std::min(ChunkSize, length - start);
+			envelope.decode(start, count, chunk);
+			for (unsigned int i = 0; i < count; i++)
+			{
+				peak	= std::max(peak, chunk[i]);
+				energy += double(chunk[i]) * chunk[i];
+			}
+		}
+
+		stats[b].peak	= peak;
+		stats[b].energy = energy;
+		stats[b].rms	= (length > 0) ? std::sqrt(energy / length) : 0;
+	}
+
+	// equally loud bins keep their order
+	ranking.resize(bins.size());
+	for (unsigned int b = 0; b < bins.size(); b++) ranking[b] = b;
+	std::stable_sort(ranking.begin(), ranking.end(), [this](uint32_t lhs, uint32_t rhs) { return stats[rhs].peak < stats[lhs].peak; });
+
+	rankOf.resize(bins.size());
+	for (unsigned int r = 0; r < ranking.size(); r++) rankOf[ranking[r]] = r;
+
+	statsValid = true;
+}
+
+inline bool ATable::setBinStats(std::vector<BinStats> && stats, std::vector<uint32_t> && ranking)
+{
+	if (stats.size() != bins.size() || ranking.size() != bins.size()) return false;
+
+	// the ranking has to contain every bin once, ordered by peak
+	std::vector<bool> ranked(bins.size(), false);
+	for (unsigned int i = 0; i < ranking.size(); i++)
+	{
+		if (ranking[i] >= bins.size() || ranked[ranking[i]]) return false;
+		if (i > 0 && stats[ranking[i]].peak > stats[ranking[i - 1]].peak) return false;
+		ranked[ranking[i]] = true;
+	}
+
+	this->stats	  = std::move(stats);
+	this->ranking = std::move(ranking);
+	rankOf.resize(bins.size());
+	for (unsigned int r = 0; r < this->ranking.size(); r++) rankOf[this->ranking[r]] = r;
+	statsValid	  = true;
+	return true;
 }
 
 // #################### Config ####################
@@ -53,6 +53,11 @@ void CQTTable::setBinsPerSemitone(unsigned int binsPerSemitone)
 	this->binsPerSemitone = binsPerSemitone;
 }
 
+unsigned int CQTTable::getBinsPerSemitone() const
+{
+	return binsPerSemitone;
+}
+
 void CQTTable::shiftFrequencyTo(int midiTarget)
 {
 	if (midiTarget == midiNote) return;
@@ -61,9 +66,8 @@ void CQTTable::shiftFrequencyTo(int midiTarget)
 	// move the whole data struct to a temp location to prevent overrides
 	auto tempBins = std::move(bins);
 
-	// empty buffer
-	std::vector<float> emptyEnvelope;
-	emptyEnvelope.resize(tempBins[0].envelope.size(), 0);
+	// empty buffer, shared by all out of range bins
+	Envelope emptyEnvelope(tempBins[0].envelope.size(), 0);
 
 	bins.clear();
 	
@@ -83,12 +87,178 @@ void CQTTable::shiftFrequencyTo(int midiTarget)
 		}
 		else
 		{
-			bin.envelope = std::move(tempBins[offsetedIndx].envelope);
+			bin.envelope  = std::move(tempBins[offsetedIndx].envelope);
+			bin.track	  = std::move(tempBins[offsetedIndx].track);
+			bin.bandwidth = tempBins[offsetedIndx].bandwidth;
 		}
 	}
 	setMidiNote(midiTarget);
 }
 
+unsigned int CQTTable::mergePartials()
+{
+	// merged before, the other bins of the partials are silent by now
+	if (bins.size() < 2 || hasFrequencyTracks()) return 0;
+
+	auto numFrames = getEnvelopeLength();
+	int  radius	   = std::max(1u, binsPerSemitone / 2);
+
+	std::vector<std::vector<float>> envelopes(bins.size());
+	std::vector<double>				energy(bins.size(), 0);
+	for (size_t k = 0; k < bins.size(); k++)
+	{
+		envelopes[k] = bins[k].envelope.toVector();
+		for (auto value : envelopes[k]) energy[k] += double(value) * value;
+	}
+
+	// partials grow from the loudest bins downhill to both sides, at most 'radius' bins
+	std::vector<int> order(bins.size());
+	for (size_t k = 0; k < bins.size(); k++) order[k] = k;
+	std::stable_sort(order.begin(), order.end(), [&energy](int a, int b) { return energy[a] > energy[b]; });
+
+	std::vector<bool> taken(bins.size(), false);
+	int numBins = bins.size();
+
+	// the bins merged into a partial share one silent envelope
+	Envelope silence = Envelope(numFrames, 0).encode(Envelope::Encoding::Sparse);
+	unsigned int numPartials = 0;
+
+	for (auto peak : order)
+	{
+		if (energy[peak] <= 0) break;
+		if (taken[peak]) continue;
+		taken[peak] = true;
+
+		int first = peak;
+		int last  = peak;
+		while (first > 0		   && peak - (first - 1) <= radius && !taken[first - 1] && energy[first - 1] <= energy[first]) taken[--first] = true;
+		while (last + 1 < numBins && (last + 1) - peak <= radius && !taken[last + 1]  && energy[last + 1]  <= energy[last])  taken[++last]  = true;
+
+		if (first == last || bins[peak].frequency <= 0) continue;
+
+		// the energy of the bins is kept, the frequency is the power weighted mean (in log frequency) of the bins
+		std::vector<float> amplitude(numFrames, 0);
+		std::vector<float> track(numFrames, 1);
+		float ratio = 1;
+
+		for (unsigned int n = 0; n < numFrames; n++)
+		{
+			double power  = 0;
+			double logSum = 0;
+			for (int k = first; k <= last; k++)
+			{
+				double value = (n < envelopes[k].size()) ? envelopes[k][n] : 0;
+				power  += value * value;
+				logSum += value * value * std::log(bins[k].frequency / bins[peak].frequency);
+			}
+
+			// silent frames keep the last frequency
+			if (power > 0) ratio = std::exp(logSum / power);
+			amplitude[n] = std::sqrt(power);
+			track[n]	 = ratio;
+		}
+
+		for (int k = first; k <= last; k++) if (k != peak) bins[k].envelope = silence;
+
+		bins[peak].envelope = Envelope(std::move(amplitude)).encode(bins[peak].envelope.getEncoding());
+		bins[peak].track	= Envelope(std::move(track));
+		numPartials++;
+	}
+
+	if (numPartials > 0) statsValid = false;
+	return numPartials;
+}
+
+CQTTable::NoiseBandReport CQTTable::makeNoiseBands(float minFrequency, unsigned int bandsPerOctave)
+{
+	NoiseBandReport report;
+	if (bins.empty() || binsPerSemitone == 0 || bandsPerOctave == 0 || hasNoiseBands()) return report;
+
+	auto numFrames	= getEnvelopeLength();
+	int  bandBins	= std::max(1, static_cast<int>(std::round(12. * binsPerSemitone / bandsPerOctave)));
+	int  numBins	= bins.size();
+
+	std::vector<std::vector<float>> envelopes(bins.size());
+	for (size_t k = 0; k < bins.size(); k++)
+	{
+		envelopes[k] = bins[k].envelope.toVector();
+
+		double energy = 0;
+		for (auto value : envelopes[k]) energy += double(value) * value;
+		report.energy += energy;
+		if (energy > 0) report.numSines++;
+	}
+
+	// bands start at the first bin at or above the frequency, the bins of a CQT table go up in frequency
+	int start = 0;
+	while (start < numBins && bins[start].frequency < minFrequency) start++;
+
+	Envelope silence = Envelope(numFrames, 0).encode(Envelope::Encoding::Sparse);
+
+	for (int first = start; first < numBins; first += bandBins)
+	{
+		int last = std::min(numBins, first + bandBins) - 1;
+
+		// partials stay sines, the band is played by the bin closest to its middle
+		std::vector<int> members;
+		for (int k = first; k <= last; k++) if (bins[k].track.empty()) members.push_back(k);
+		if (members.empty()) continue;
+
+		int middle = (first + last) / 2;
+		int center = *std::min_element(members.begin(), members.end(), [middle](int a, int b) { return std::abs(a - middle) < std::abs(b - middle); });
+
+		std::vector<float> amplitude(numFrames, 0);
+		double bandEnergy = 0;
+		unsigned int numAudible = 0;
+
+		for (int k : members)
+		{
+			bool audible = false;
+			for (auto value : envelopes[k]) audible |= (value != 0);
+			if (audible) numAudible++;
+		}
+		if (numAudible == 0) continue;
+
+		for (unsigned int n = 0; n < numFrames; n++)
+		{
+			// flatness: geometric over arithmetic mean of the powers of the bins, silent bins count as 120 dB down
+			double power	= 0;
+			double logSum	= 0;
+			double maxPower = 0;
+			for (int k : members)
+			{
+				double value = (n < envelopes[k].size()) ? envelopes[k][n] : 0;
+				power	+= value * value;
+				maxPower = std::max(maxPower, value * value);
+			}
+			if (power <= 0) continue;
+
+			for (int k : members)
+			{
+				double value = (n < envelopes[k].size()) ? envelopes[k][n] : 0;
+				logSum += std::log(std::max(value * value, maxPower * 1e-12));
+			}
+
+			double flatness = std::exp(logSum / members.size()) / (power / members.size());
+			report.flatness += flatness * power;
+			bandEnergy		+= power;
+			amplitude[n]	 = std::sqrt(power);
+		}
+
+		for (int k : members) if (k != center) bins[k].envelope = silence;
+
+		bins[center].envelope  = Envelope(std::move(amplitude)).encode(bins[center].envelope.getEncoding());
+		bins[center].bandwidth = float(last - first + 1) / (12 * binsPerSemitone);
+
+		report.numReplaced += numAudible;
+		report.numBands++;
+		report.noiseEnergy += bandEnergy;
+	}
+
+	if (report.numBands > 0) statsValid = false;
+	return report;
+}
+
 ATable * CQTTable::interpolateTable(const ATable & secondTable, int targetMidi) const
 {
 	auto table2 = dynamic_cast<const CQTTable*>(&secondTable);
@@ -152,26 +322,40 @@ ATable * CQTTable::interpolateTable(const ATable & secondTable, int targetMidi)
 			auto &bin = bins[i];
 			auto maxBinIdx = std::min(t1Bin.envelope.size(), t2Bin.envelope.size());
 
+			// the source envelopes might be encoded
+			auto t1Envelope = t1Bin.envelope.toVector();
+			auto t2Envelope = t2Bin.envelope.toVector();
+
+			std::vector<float> envelope;
+			envelope.reserve(maxBinIdx);
+
 			int envIdx = 0;
 			while (envIdx < maxBinIdx)
 			{
-				bin.envelope.push_back(t1Bin.envelope[envIdx] * t1Frac + t2Bin.envelope[envIdx] * t2Frac);
+				envelope.push_back(t1Envelope[envIdx] * t1Frac + t2Envelope[envIdx] * t2Frac);
 				envIdx++;
 			}
+			bin.envelope = Envelope(std::move(envelope));
 
+			// tracks of merged partials aren't mixed, the partial keeps the track of one table. Same for noise bands
+			bin.track	  = !t1Bin.track.empty() ? t1Bin.track : t2Bin.track;
+			bin.bandwidth = (t1Bin.bandwidth > 0) ? t1Bin.bandwidth : t2Bin.bandwidth;
 		}
 		else if (t1InRange)
 		{
 			auto &t1Bin = t1.bins[t1BinIdx];
 			auto &bin = bins[i];
-			bin.envelope = t1Bin.envelope;
-
+			bin.envelope  = t1Bin.envelope;
+			bin.track	  = t1Bin.track;
+			bin.bandwidth = t1Bin.bandwidth;
 		}
 		else if (t2InRange)
 		{
 			auto &t2Bin = t2.bins[t2BinIdx];
 			auto &bin = bins[i];
-			bin.envelope = t2Bin.envelope;
+			bin.envelope  = t2Bin.envelope;
+			bin.track	  = t2Bin.track;
+			bin.bandwidth = t2Bin.bandwidth;
 		}
 		else
 		{
@@ -182,10 +366,76 @@ ATable * CQTTable::interpolateTable(const ATable & secondTable, int targetMidi)
 	return newTable;
 }
 
-ATable * CQTTable::createShiftedTable(int targetMidi)
+ATable * CQTTable::createShiftedTable(int targetMidi) const
 {
 	auto table = new CQTTable(*this);
 	table->shiftFrequencyTo(targetMidi);
 	return table;
 }
 
+
+bool CQTTable::blendBins(const ATable & secondTable, int targetMidi, std::vector<BlendBin> & bins, unsigned int & length) const
+{
+	auto table2 = dynamic_cast<const CQTTable*>(&secondTable);
+
+	// same requirements as interpolateTable()
+	if (table2 == nullptr || this->cfg != table2->cfg || this->binsPerSemitone != table2->binsPerSemitone) return false;
+
+	auto & t1 = (this->midiNote < table2->midiNote) ? *this   : *table2;
+	auto & t2 = (this->midiNote < table2->midiNote) ? *table2 : *this;
+
+	if (t1.midiNote > targetMidi || t2.midiNote < targetMidi || t1.midiNote == t2.midiNote) return false;
+
+	int t1Offset = (targetMidi - t1.midiNote) * t1.binsPerSemitone;
+	int t2Offset = (targetMidi - t2.midiNote) * t2.binsPerSemitone;
+
+	float midiRange = t2.midiNote - t1.midiNote;
+	float t2Frac = static_cast<float>(targetMidi - t1.midiNote) / midiRange;
+	float t1Frac = 1. - t2Frac;
+
+	bins.clear();
+	length = 0;
+	for (int i = 0; i < t1.bins.size(); i++)
+	{
+		int  t1BinIdx = i - t1Offset;
+		int  t2BinIdx = i - t2Offset;
+
+		bool t1InRange = (0 <= t1BinIdx) && (t1BinIdx < t1.bins.size());
+		bool t2InRange = (0 <= t2BinIdx) && (t2BinIdx < t2.bins.size());
+
+		if (!t1InRange && !t2InRange) return false;
+
+		// interpolateTable() pads all bins to the longest one
+		unsigned int t1Length = t1InRange ? t1.bins[t1BinIdx].envelope.size() : t2.bins[t2BinIdx].envelope.size();
+		unsigned int t2Length = t2InRange ? t2.bins[t2BinIdx].envelope.size() : t1Length;
+		length = std::max(length, std::min(t1Length, t2Length));
+
+		if (!(t1InRange && t1.isActive(t1BinIdx)) && !(t2InRange && t2.isActive(t2BinIdx))) continue;
+
+		BlendBin bin;
+		bin.frequency = t1.bins[i].frequency;
+
+		// bins only one table covers are taken over unchanged
+		if (t1InRange && t2InRange)
+		{
+			bin.envelopes[0] = &t1.bins[t1BinIdx].envelope;
+			bin.envelopes[1] = &t2.bins[t2BinIdx].envelope;
+			bin.weights[0]	 = t1Frac;
+			bin.weights[1]	 = t2Frac;
+
+			// like interpolateTable(), one of the tracks
+			auto &track = !t1.bins[t1BinIdx].track.empty() ? t1.bins[t1BinIdx].track : t2.bins[t2BinIdx].track;
+			if (!track.empty()) bin.track = &track;
+			bin.bandwidth = (t1.bins[t1BinIdx].bandwidth > 0) ? t1.bins[t1BinIdx].bandwidth : t2.bins[t2BinIdx].bandwidth;
+		}
+		else
+		{
+			auto &source = t1InRange ? t1.bins[t1BinIdx] : t2.bins[t2BinIdx];
+			bin.envelopes[0] = &source.envelope;
+			bin.bandwidth	 = source.bandwidth;
+			if (!source.track.empty()) bin.track = &source.track;
+		}
+		bins.push_back(bin);
+	}
+	return true;
+}
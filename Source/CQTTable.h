@@ -13,6 +13,18 @@ class CQTTable : public ATable
 
 	// #################### CONSTRUCTOR ####################
 public:
+
+	// result of makeNoiseBands()
+	struct NoiseBandReport
+	{
+		unsigned int numSines{ 0 };		// bins that weren't silent before
+		unsigned int numReplaced{ 0 };	// of those, now part of a noise band
+		unsigned int numBands{ 0 };
+		double		 energy{ 0 };		// of all bins
+		double		 noiseEnergy{ 0 };	// of the bands
+		double		 flatness{ 0 };		// spectral flatness of the replaced bins within their bands, weighted by the
+										// energy (sum, divide by noiseEnergy). 1 if they were noise, towards 0 if tonal
+	};
 	
 	CQTTable();
 		
@@ -22,11 +34,24 @@ public:
 	
 	virtual bool isValid() const override;
 	void setBinsPerSemitone(unsigned int binsPerSemitone);
+	unsigned int getBinsPerSemitone() const;
 
 	// #################### MANIPULATION ####################
 
 	virtual void shiftFrequencyTo(int midiTarget) override;
 
+	// a partial spreads over several neighbouring bins, each of them playing a sine of its own. Clusters of neighbouring
+	// bins around a loudness peak (at most binsPerSemitone / 2 bins to each side) are merged into their loudest bin,
+	// which gets the energy of the cluster and a frequency track following the power weighted frequency of the cluster.
+	// The other bins become silent, the number of bins doesn't change. Returns the number of merged partials
+	unsigned int mergePartials();
+
+	// the bins at and above 'minFrequency' (Hz) of dense tables are mostly noise. They are grouped into bands
+	// 1 / 'bandsPerOctave' octaves wide, the middle bin of a band plays noise with the energy of all its bins (see
+	// Bin::bandwidth) and the others become silent. Bins with a frequency track (partials) stay sines. Tables that
+	// have noise bands already are left as they are
+	NoiseBandReport makeNoiseBands(float minFrequency, unsigned int bandsPerOctave);
+
 	// #################### SERIALIZATION ####################
 	
 	template <class Archive>
@@ -47,7 +72,11 @@ private:
 
 
 	// Inherited via ATable
-	virtual ATable * createShiftedTable(int targetMidi) override;
+	virtual ATable * createShiftedTable(int targetMidi) const override;
+
+
+	// Inherited via ATable
+	virtual bool blendBins(const ATable & secondTable, int targetMidi, std::vector<BlendBin> & bins, unsigned int & length) const override;
 
 };
 
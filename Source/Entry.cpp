@@ -6,12 +6,18 @@
 #include "TablePlayer.h"
 #include "TableManager.h"
 #include "Processor.h"
+#include "VelocityLayers.h"
+#include "EnvelopeStream.h"
 #include "Util/FilePath.h"
+#include "Util/FileStream.h"
 #include <iostream>
 #include <fstream>
 #include <regex>
 #include <future>
+#include <thread>
 #include <cmath>
+#include <map>
+#include <limits>
 // function blocks process by waiting for enter key
 void waitForStdIn()
 {
@@ -22,6 +28,42 @@ void waitForStdIn()
 #define  returnFail    { waitForStdIn(); return -1;}
 #define  returnSuccess { waitForStdIn(); return -0;}
 
+// both throw if the text isn't a number
+inline void toNumber(const std::string & text, int & value)	  { value = std::stoi(text); }
+inline void toNumber(const std::string & text, float & value) { value = std::stof(text); }
+
+// parses the value of the option at argv[argIdx] and moves argIdx to it. Prints "Unexpected Argument (<name>)" and
+// returns false if the value is missing, isn't a number or lies outside [minimum, maximum]
+template<typename T>
+bool parseNumber(int argc, char **argv, int &argIdx, const char *name, T &value,
+	double minimum = std::numeric_limits<double>::lowest(), double maximum = std::numeric_limits<double>::max())
+{
+	argIdx++;
+
+	T parsed{};
+	bool valid = false;
+	try
+	{
+		if (argIdx < argc)
+		{
+			toNumber(argv[argIdx], parsed);
+			valid = (parsed >= minimum) && (parsed <= maximum);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		valid = false;
+	}
+
+	if (!valid)
+	{
+		std::cout << "Unexpected Argument (" << name << ")" << std::endl;
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
 
 int main(int argc, char **argv)
 {
@@ -30,6 +72,30 @@ int main(int argc, char **argv)
 	bool multiThreading = false;
 	bool configMode		= false;
 	bool debugMode		= false;
+	bool encodingReport = false;
+	bool loopDetection	= false;
+	bool blendPlayback	= false;
+	bool useArena		= false;
+	bool frameMatrix	= false;
+	bool memoryReport	= false;
+	bool mergePartials	= false;
+	float memoryBudget	= 0;	// MB, 0: no budget
+	float sparseFloor	= 0;	// dB, 0: only silent frames are dropped from sparse bins
+	float lowRankError	= 0;	// dB, 0: tables aren't factorized
+	float modalError	= 0;	// dB, 0: bins aren't fitted with modes
+	float noiseFrequency = 0;	// Hz, 0: no noise bands
+	bool maskPruning	= false;
+	unsigned int mainVelocity = VelocityLayers::DefaultVelocity;	// of the layer of 'fileName'
+	std::vector<std::pair<unsigned int, std::string>> layerFiles;	// velocity and bank of the other layers
+	bool compactBins	= false;	// frees the bins outside the limit, the cache holds the active bins only
+	float maskingOffset	= 12;	// dB below the masker
+	auto arenaPages		= Arena::Pages::Normal;
+	int  lazyTables		= -1;	// maximum number of lazily prepared tables, -1: all tables are prepared at startup
+	int  streamFrames	= 0;	// resident frames per head of streamed tables, 0: the tables aren't streamed
+	auto warmMode		= ResidentMemory::Mode::None;	// of the banks without a mode of their own
+	std::map<unsigned int, ResidentMemory::Mode> bankWarmModes;	// velocity of the bank -> mode
+	auto encoding		= Envelope::Encoding::Float32;
+	float tolerance		= EnvelopeCodec::DefaultBreakpointTolerance;
 	int limit = -1;
 	int numVoices = 1;
 	std::string fileName;
@@ -40,6 +106,27 @@ int main(int argc, char **argv)
 	std::regex mtRegex("[\\\\\\/-]?MT", std::regex::icase);
 	std::regex voicesRegex("[\\\\\\/-]?v(oices)", std::regex::icase);
 	std::regex autoRegex("[\\\\\\/-]?a(uto)", std::regex::icase);
+	std::regex encodingRegex("[\\\\\\/-]?e(ncoding)?", std::regex::icase);
+	std::regex reportRegex("[\\\\\\/-]?e(ncoding)?r(eport)?", std::regex::icase);
+	std::regex toleranceRegex("[\\\\\\/-]?tol(erance)?", std::regex::icase);
+	std::regex loopRegex("[\\\\\\/-]?loop", std::regex::icase);
+	std::regex lazyRegex("[\\\\\\/-]?lazy", std::regex::icase);
+	std::regex streamRegex("[\\\\\\/-]?stream", std::regex::icase);
+	std::regex warmRegex("[\\\\\\/-]?warm", std::regex::icase);
+	std::regex blendRegex("[\\\\\\/-]?blend", std::regex::icase);
+	std::regex arenaRegex("[\\\\\\/-]?arena", std::regex::icase);
+	std::regex matrixRegex("[\\\\\\/-]?matrix", std::regex::icase);
+	std::regex partialsRegex("[\\\\\\/-]?partials", std::regex::icase);
+	std::regex sparseRegex("[\\\\\\/-]?sparse", std::regex::icase);
+	std::regex lowRankRegex("[\\\\\\/-]?lowrank", std::regex::icase);
+	std::regex modalRegex("[\\\\\\/-]?modal", std::regex::icase);
+	std::regex layerRegex("[\\\\\\/-]?layer", std::regex::icase);
+	std::regex velocityRegex("[\\\\\\/-]?vel(ocity)?", std::regex::icase);
+	std::regex compactRegex("[\\\\\\/-]?compact", std::regex::icase);
+	std::regex maskRegex("[\\\\\\/-]?mask", std::regex::icase);
+	std::regex noiseRegex("[\\\\\\/-]?noise", std::regex::icase);
+	std::regex budgetRegex("[\\\\\\/-]?budget", std::regex::icase);
+	std::regex memoryRegex("[\\\\\\/-]?mem(ory)?", std::regex::icase);
 
 
 
@@ -54,49 +141,124 @@ int main(int argc, char **argv)
 		else if (std::regex_match(argument, debugRegex))	debugMode	   = true;
 		else if (std::regex_match(argument, debugRegex))	debugMode	   = true;
 		else if (std::regex_match(argument, mtRegex))		multiThreading = true;
-		else if (std::regex_match(argument, limitRegex))
+		else if (std::regex_match(argument, reportRegex))	encodingReport = true;
+		else if (std::regex_match(argument, loopRegex))		loopDetection  = true;
+		else if (std::regex_match(argument, blendRegex))	blendPlayback  = true;
+		else if (std::regex_match(argument, matrixRegex))	frameMatrix	   = true;
+		else if (std::regex_match(argument, memoryRegex))	memoryReport   = true;
+		else if (std::regex_match(argument, partialsRegex)) mergePartials  = true;
+		else if (std::regex_match(argument, compactRegex))	compactBins	   = true;
+		else if (std::regex_match(argument, encodingRegex))
 		{
 			argIdx++;
-			if (argIdx >= argc)
+			if (argIdx >= argc || !EnvelopeCodec::parseName(argv[argIdx], encoding))
 			{
-				std::cout << "Unexpected Argument (Threshold)" << std::endl;
+				std::cout << "Unexpected Argument (Encoding), expected f32, f16, db8, delta8, bp or sparse" << std::endl;
 				returnFail;
 			}
-			std::string limitString = std::string(argv[argIdx]);
-
-			try
+		}
+		else if (std::regex_match(argument, toleranceRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Tolerance", tolerance)) returnFail;
+		}
+		else if (std::regex_match(argument, limitRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Threshold", limit)) returnFail;
+		}
+		else if (std::regex_match(argument, lazyRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Lazy Tables", lazyTables)) returnFail;
+			if (lazyTables < 1) lazyTables = 1;
+		}
+		else if (std::regex_match(argument, streamRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Stream Frames", streamFrames, 1)) returnFail;
+		}
+		else if (std::regex_match(argument, warmRegex))
+		{
+			// -warm <mode> applies to every bank, -warm <velocity> <mode> to the bank of one velocity layer
+			argIdx++;
+			int velocity = 0;
+			if (argIdx + 1 < argc && std::regex_match(std::string(argv[argIdx]), std::regex("[0-9]+")))
 			{
-				limit = std::stof(limitString);
+				velocity = std::stoi(std::string(argv[argIdx]));
+				if (velocity < 1) velocity = 128;
+				argIdx++;
 			}
-			catch (const std::exception &e)
+
+			auto mode = ResidentMemory::Mode::None;
+			if (argIdx >= argc || velocity > 127 || !ResidentMemory::parseMode(argv[argIdx], mode))
 			{
-				std::cout << "Unexpected Argument (Threshold)" << std::endl;
+				std::cout << "Unexpected Argument (Warm-up), expected [<velocity>] none, touch or lock" << std::endl;
 				returnFail;
 			}
 
+			if (velocity > 0) bankWarmModes[velocity] = mode;
+			else			  warmMode = mode;
 		}
-		else if (std::regex_match(argument, voicesRegex))
+		else if (std::regex_match(argument, sparseRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Sparse Floor", sparseFloor)) returnFail;
+			sparseFloor = -std::abs(sparseFloor);
+		}
+		else if (std::regex_match(argument, lowRankRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Low Rank Error", lowRankError)) returnFail;
+			lowRankError = -std::abs(lowRankError);
+		}
+		else if (std::regex_match(argument, modalRegex))
 		{
+			if (!parseNumber(argc, argv, argIdx, "Modal Error", modalError)) returnFail;
+			modalError = -std::abs(modalError);
+		}
+		else if (std::regex_match(argument, layerRegex))
+		{
+			int velocity = 0;
+			if (!parseNumber(argc, argv, argIdx, "Velocity Layer", velocity, 1, 127)) returnFail;
+
 			argIdx++;
 			if (argIdx >= argc)
 			{
-				std::cout << "Unexpected Argument (Num Voices)" << std::endl;
+				std::cout << "Unexpected Argument (Velocity Layer)" << std::endl;
 				returnFail;
 			}
-
-			std::string voicesStr = std::string(argv[argIdx]);
-
-			try
-			{
-				numVoices = std::stoi(voicesStr);
-				if (numVoices < 1) numVoices = 1;
-			}
-			catch (const std::exception &e)
+			layerFiles.emplace_back(velocity, std::string(argv[argIdx]));
+		}
+		else if (std::regex_match(argument, velocityRegex))
+		{
+			int velocity = 0;
+			if (!parseNumber(argc, argv, argIdx, "Velocity", velocity, 1, 127)) returnFail;
+			mainVelocity = velocity;
+		}
+		else if (std::regex_match(argument, maskRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Masking Offset", maskingOffset)) returnFail;
+			maskPruning = true;
+		}
+		else if (std::regex_match(argument, noiseRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Noise Frequency", noiseFrequency)) returnFail;
+			noiseFrequency = std::abs(noiseFrequency);
+		}
+		else if (std::regex_match(argument, budgetRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Memory Budget", memoryBudget)) returnFail;
+			if (memoryBudget < 0) memoryBudget = 0;
+		}
+		else if (std::regex_match(argument, arenaRegex))
+		{
+			argIdx++;
+			if (argIdx >= argc || !Arena::parsePages(argv[argIdx], arenaPages))
 			{
-				std::cout << "Unexpected Argument (Num Voices)" << std::endl;
+				std::cout << "Unexpected Argument (Arena), expected normal, thp or huge" << std::endl;
 				returnFail;
 			}
-
+			useArena = true;
+		}
+		else if (std::regex_match(argument, voicesRegex))
+		{
+			if (!parseNumber(argc, argv, argIdx, "Num Voices", numVoices)) returnFail;
+			if (numVoices < 1) numVoices = 1;
 		}
 		else
 		{
@@ -110,85 +272,98 @@ int main(int argc, char **argv)
 		argIdx++;
 	}
 	
+	// blended notes are mixed from two tables, their envelopes would be read on the audio thread
+	if (streamFrames > 0 && blendPlayback)
+	{
+		std::cout << "Blend playback isn't streamed, -blend is ignored" << std::endl;
+		blendPlayback = false;
+	}
+
 	// #################### create Table manager ####################
 
 	std::cout << "Create Table Manager" << std::endl;
 
 	TableManager tableManager(debugMode);
 
-	// find out if we include a cache file or a txt file 
-
-	auto suffixStart = fileName.find_last_of('.');
-	auto suffix = fileName.substr(suffixStart, fileName.size());	
-	
-	if (suffix != ".table")
-	{
-		std::cout << "Loading Table File " << fileName << ":" << std::endl;;
-		bool success = tableManager.importTextFile(fileName, debugMode);
-		if (success)
-		{
-			std::cout << "success" << std::endl;
-		}
-		else
-		{
-			std::cout << "failed" << std::endl;
-			returnFail;
-		}
+	// managers of the velocity layers besides the one of 'fileName'
+	std::vector<std::unique_ptr<TableManager>> layerManagers;
 
-		std::cout << "Interpolating Tables" << std::endl;
-		tableManager.prepareTablesAutoRange();
+	// background writes of the cache files, waited for before exiting
+	std::vector<std::future<bool>> cacheWriters;
+	std::vector<std::pair<TableManager*, std::string>> cacheFiles;
 
-		try
-		{
-			auto fileNameWOSuffix = fileName.substr(0, suffixStart);
-			auto fileNameCache    = fileNameWOSuffix.append(".table");
-			tableManager.storeBinaryCache(fileNameCache);
-		}
-		catch (const std::exception & e)
-		{
-			std::cout << "Error caching file" << std::endl;
-			returnFail;
-		}
-	}
-	else
+	// every layer is prepared the same way
+	auto configure = [&](TableManager & manager)
 	{
-		std::cout << "Loading CQT table cache: ";
-		try
+		manager.setEncoding(encoding);
+		manager.setBreakpointTolerance(tolerance);
+		manager.setLoopDetection(loopDetection);
+		if (sparseFloor < 0) manager.setSparseFloor(sparseFloor);
+		manager.setPartialMerging(mergePartials);
+		if (modalError < 0) manager.setModalFit(modalError);
+		if (noiseFrequency > 0) manager.setNoiseBands(noiseFrequency);
+		manager.setMaskPruning(maskPruning, maskingOffset);
+		if (lowRankError < 0) manager.setLowRank(lowRankError);
+		if (lazyTables > 0) manager.setLazyPreparation(true, lazyTables);
+		manager.setBlendPlayback(blendPlayback);
+		manager.setArena(useArena, arenaPages);
+		manager.setFrameMatrix(frameMatrix);
+		if (memoryBudget > 0) manager.setMemoryBudget(static_cast<uint64_t>(memoryBudget * 1024 * 1024));
+
+		// the limit is part of the options of compacted caches, it has to be known when the cache is checked
+		if (compactBins && limit > 0)
 		{
-			tableManager.loadBinaryCache(fileName);
-			std::cout << "success" << std::endl;
+			manager.setBinCompaction(true);
+			manager.limitNumActiveBins(limit);
 		}
-		catch (const std::exception & e)
-		{
-			std::cout << "failed" << std::endl;
-			returnFail;
-		}
-	}
+	};
+	configure(tableManager);
 
+	// written after the limit is applied. Compacted tables go to a slim cache of their own (bank.active<limit>.table),
+	// the full cache of the bank stays
+	auto slimCacheName = [&](const std::string & name) -> std::string
+	{
+		if (!compactBins || limit <= 0) return name;
+		auto fullName = std::regex_replace(name, std::regex("(\\.active[0-9]+)?\\.table$"), ".table");
+		return std::regex_replace(fullName, std::regex("\\.table$"), ".active" + std::to_string(limit) + ".table");
+	};
 
-	if (limit > 0)
-		tableManager.limitNumActiveBins(limit);
-	else
-		tableManager.unlimitNumActiveBins();
-
-	std::cout << "Table Manager Initialized" << std::endl;
+	// compressed text files (.txt.gz / .txt.zst) share the cache name of the uncompressed file
+	auto getSuffix = [](const std::string & name) -> std::string
+	{
+		auto uncompressedName = FileStream::stripCompressionSuffix(name);
+		return uncompressedName.substr(uncompressedName.find_last_of('.'));
+	};
 
-	auto errCode = tableManager.sanity();
-	if (errCode != TableManager::ErrorCode::NoError)
+	// compares the envelope encodings for this bank and quits
+	if (encodingReport)
 	{
-		if (errCode & TableManager::ErrorCode::InvalidNumBins)
+		if (getSuffix(fileName) != ".table")
 		{
-			std::cout << "Table Manger contains tables with various number of bins" << std::endl;
+			tableManager.setEncoding(Envelope::Encoding::Float32);
+			if (!tableManager.importTextFile(fileName, multiThreading) || !tableManager.prepareTablesAutoRange()) returnFail;
 		}
-		if (errCode & TableManager::ErrorCode::InvalidTables)
+		else
 		{
-			std::cout << "Table Manger contains invalid tables" << std::endl;
+			// errors are relative to the envelopes of the cache, which might be encoded already
+			try
+			{
+				tableManager.loadBinaryCache(fileName);
+			}
+			catch (const std::exception & e)
+			{
+				std::cout << "Loading cache failed: " << e.what() << std::endl;
+				returnFail;
+			}
 		}
-		returnFail;
+		tableManager.printEncodingReport();
+		returnSuccess;
 	}
 
 	// #################### Audio IO ####################
 
+	// configured before the banks are loaded, the heads of streamed tables depend on the block size
+
 	// create audio context, start in debug mode if debugMode==true
 	AudioIO audio(debugMode);
 
@@ -245,12 +420,151 @@ int main(int argc, char **argv)
 	config.writeChanges();
 
 
+	// find out if we include a cache file or a txt file 
+	auto loadBank = [&](TableManager & manager, const std::string & bankFile) -> bool
+	{
+		if (getSuffix(bankFile) != ".table")
+		{
+			// tables of unchanged files are taken from an existing cache
+			auto uncompressedName = FileStream::stripCompressionSuffix(bankFile);
+			auto fileNameCache	  = slimCacheName(uncompressedName.substr(0, uncompressedName.find_last_of('.')) + ".table");
 
+			std::cout << "Loading Table File " << bankFile << ":" << std::endl;;
+			bool success = manager.importTextFileCached(bankFile, fileNameCache, multiThreading);
+			if (success)
+			{
+				std::cout << "success" << std::endl;
+			}
+			else
+			{
+				std::cout << "failed" << std::endl;
+				return false;
+			}
+
+			cacheFiles.emplace_back(&manager, fileNameCache);
+		}
+		else
+		{
+			std::cout << "Loading CQT table cache: ";
+			try
+			{
+				manager.loadBinaryCache(bankFile);
+				std::cout << "success" << std::endl;
+			}
+			catch (const std::exception & e)
+			{
+				std::cout << "failed" << std::endl;
+				return false;
+			}
+
+			// rebuild the tables of changed source files
+			if (manager.isCacheStale())
+			{
+				std::cout << "Cache is outdated, updating from " << manager.getRootFile() << std::endl;
+				bool success = manager.importTextFileCached(manager.getRootFile(), bankFile, multiThreading);
+				if (!success)
+				{
+					std::cout << "failed" << std::endl;
+					return false;
+				}
+
+				cacheFiles.emplace_back(&manager, slimCacheName(bankFile));
+			}
+		}
+
+		if (limit > 0)
+			manager.limitNumActiveBins(limit);
+		else
+			manager.unlimitNumActiveBins();
+
+		if (streamFrames > 0)
+		{
+			// the stream loads one head ahead of the player, shorter heads underrun with every block
+			auto minFrames = EnvelopeStream::getMinHeadFrames(manager.getPlaybackLimits().frameRate, cfg.frameSize, cfg.sampleRate);
+			if (streamFrames < static_cast<int>(minFrames))
+			{
+				std::cout << "-stream " << streamFrames << " is shorter than two audio blocks, streaming " << minFrames << " frames" << std::endl;
+				streamFrames = minFrames;
+			}
+			manager.setStreaming(streamFrames);
+		}
+		return true;
+	};
+
+	if (!loadBank(tableManager, fileName)) returnFail;
+
+	VelocityLayers velocityLayers;
+	velocityLayers.addLayer(mainVelocity, &tableManager);
+
+	for (auto & layer : layerFiles)
+	{
+		std::cout << "Velocity Layer " << layer.first << std::endl;
+
+		layerManagers.push_back(std::unique_ptr<TableManager>(new TableManager(debugMode)));
+		configure(*layerManagers.back());
+		if (!loadBank(*layerManagers.back(), layer.second)) returnFail;
+		velocityLayers.addLayer(layer.first, layerManagers.back().get());
+	}
+
+	// before the caches are written, they read the envelopes
+	if (!layerManagers.empty())
+	{
+		auto bytes = velocityLayers.shareStorage();
+		if (debugMode) std::printf("Velocity layers share %.2f MB of identical envelopes\n", bytes / (1024. * 1024.));
+	}
+
+	// the caches aren't needed for playing, they're written while the audio is already running
+	for (auto & cache : cacheFiles) cacheWriters.push_back(cache.first->storeBinaryCacheAsync(cache.second));
+
+	// the first notes would fault in the pages of their tables on the audio thread, mapped caches read them from disk
+	auto warmUp = [&](TableManager & manager, unsigned int velocity, const std::string & bankFile)
+	{
+		auto bankMode = bankWarmModes.find(velocity);
+		auto mode = (bankMode != bankWarmModes.end()) ? bankMode->second : warmMode;
+		if (mode == ResidentMemory::Mode::None) return;
+
+		auto start = std::chrono::steady_clock::now();
+		auto stats = manager.makeResident(mode);
+		auto ms	   = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		const double MB = 1024. * 1024.;
+		std::printf("Warm-up of %s: %.2f MB resident, %.2f MB locked (%.0f ms)\n", bankFile.c_str(), stats.bytes / MB, stats.lockedBytes / MB, ms);
+		if (stats.failedBytes > 0) std::printf("%.2f MB couldn't be locked and were prefaulted only, see the locked memory limit (ulimit -l)\n", stats.failedBytes / MB);
+	};
+	warmUp(tableManager, mainVelocity, fileName);
+	for (size_t i = 0; i < layerManagers.size(); i++) warmUp(*layerManagers[i], layerFiles[i].first, layerFiles[i].second);
+
+	std::cout << "Table Manager Initialized" << std::endl;
+
+	if (memoryReport)
+	{
+		tableManager.printMemoryUsage();
+		for (auto & manager : layerManagers) manager->printMemoryUsage();
+	}
+
+	auto errCode = tableManager.sanity();
+	for (auto & manager : layerManagers) errCode = static_cast<TableManager::ErrorCode>(errCode | manager->sanity());
+	if (errCode != TableManager::ErrorCode::NoError)
+	{
+		if (errCode & TableManager::ErrorCode::InvalidNumBins)
+		{
+			std::cout << "Table Manger contains tables with various number of bins" << std::endl;
+		}
+		if (errCode & TableManager::ErrorCode::InvalidTables)
+		{
+			std::cout << "Table Manger contains invalid tables" << std::endl;
+		}
+		returnFail;
+	}
 
 	// #################### create Processor ####################
 
 
-    Processor processor(numVoices, &tableManager, autoMode);
+	// loads the frames of streamed tables after their heads while playing
+	std::unique_ptr<EnvelopeStream> envelopeStream;
+	if (streamFrames > 0) envelopeStream.reset(new EnvelopeStream());
+
+    Processor processor(numVoices, &velocityLayers, autoMode, envelopeStream.get());
 	processor.prepare(cfg);
 	audio.setCallback(&processor);
 
@@ -291,6 +605,7 @@ int main(int argc, char **argv)
 			std::cout << "CPU Load: \t\t" <<  (int) std::round(state->cpuLoad * 100) << "%" << std::endl;
 			std::cout << "Frame Size (Int/Ext): \t" << state->internFrameSize << "/" << state->externFrameSize << std::endl;
 			std::cout << "Frames Processed:\t" << state->processedSamples << std::endl;
+			if (envelopeStream != nullptr) std::cout << "Stream Underruns:\t" << envelopeStream->getUnderruns() << std::endl;
 			std::cout << std::endl;
 		}
 	}
@@ -302,6 +617,12 @@ int main(int argc, char **argv)
 
 	std::cout << "Audio Callback Stopped" << std::endl;
 
+	for (auto & cacheWriter : cacheWriters)
+	{
+		if (cacheWriter.wait_for(std::chrono::seconds(0)) != std::future_status::ready) std::cout << "Waiting for cache file to be written" << std::endl;
+		cacheWriter.wait();
+	}
+
 	returnSuccess;
 
 }
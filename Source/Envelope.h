@@ -0,0 +1,354 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "cereal/types/vector.hpp"
+
+#include "Util/EnvelopeCodec.h"
+#include "Util/Arena.h"
+#include "Util/ModalFit.h"
+#include "Util/Hash.h"
+
+/*
+	Envelope holds the amplitude frames of a single bin. The samples are immutable and shared, copies of an
+	envelope only copy a reference. An envelope either owns its samples or references memory owned by
+	another object (e.g. a memory mapped cache file), which is kept alive as long as the envelope exists.
+
+	Samples are stored in one of the encodings of EnvelopeCodec, use decode() / toVector() to read them.
+*/
+class Envelope
+{
+public:
+	using Encoding = EnvelopeCodec::Encoding;
+
+	// #################### CONSTRUCTOR ####################
+
+	Envelope() = default;
+	inline Envelope(std::vector<float> && samples);
+	inline Envelope(const std::vector<float> & samples);
+	inline Envelope(unsigned int size, float value);
+
+	// references 'size' encoded frames ('byteSize' bytes) at 'data', 'owner' is the object owning that memory.
+	// 'placed' marks memory that was laid out on purpose (arena, mapped file), see isPlaced()
+	inline Envelope(std::shared_ptr<const void> owner, const void *data, unsigned int size, Encoding encoding, float scale, size_t byteSize, bool placed = false);
+
+	// 'size' frames of a column of factors (see EnvelopeCodec::LowRankColumn), 'factors' is the object owning them
+	static inline Envelope lowRank(std::shared_ptr<const void> factors, const EnvelopeCodec::LowRankColumn & column, unsigned int size, bool placed = false);
+
+	// #################### ACCESS ####################
+
+	inline unsigned int size()  const { return length; }
+	inline bool			empty() const { return length == 0; }
+
+	inline Encoding		getEncoding() const { return encoding; }
+	inline float		getScale()	  const { return scale; }
+
+	// encoded data, rawSize() bytes
+	inline const void * rawData() const { return samples.get(); }
+	inline size_t		rawSize() const { return byteSize; }
+
+	// false if the samples are a heap buffer of their own
+	inline bool			isPlaced() const { return placed; }
+
+	// breakpoints of Breakpoint envelopes
+	inline const EnvelopeCodec::Breakpoint * getBreakpoints()	 const { return static_cast<const EnvelopeCodec::Breakpoint*>(samples.get()); }
+	inline unsigned int						 getNumBreakpoints() const { return byteSize / sizeof(EnvelopeCodec::Breakpoint); }
+
+	// column of LowRank envelopes
+	inline const EnvelopeCodec::LowRankColumn * getLowRankColumn() const { return static_cast<const EnvelopeCodec::LowRankColumn*>(samples.get()); }
+
+	// modes of Modal envelopes
+	inline const EnvelopeCodec::ModalMode * getModalModes(EnvelopeCodec::ModalHeader &header) const { return EnvelopeCodec::getModalModes(samples.get(), header); }
+
+	// writes the frames [start, start + count) to 'out'
+	inline void decode(unsigned int start, unsigned int count, float *out) const;
+
+	// true if the frames [start, start + count) are known to be silent without decoding them (see EnvelopeCodec::isSilent())
+	inline bool isSilent(unsigned int start, unsigned int count) const { return EnvelopeCodec::isSilent(encoding, samples.get(), length, start, count); }
+
+	// largest sample
+	inline float peak() const;
+
+	inline bool operator==(const Envelope & rhs) const;
+	inline bool operator!=(const Envelope & rhs) const { return !(*this == rhs); }
+
+	// #################### MANIPULATION ####################
+
+	// changes the size, new samples are set to 'value'. This always creates a new sample buffer
+	inline void resize(unsigned int size, float value = 0);
+
+	// returns the envelope in another encoding, shares the samples if the encoding doesn't change.
+	// 'tolerance' is the maximum error in dB of Breakpoint envelopes, Sparse envelopes drop silent frames only.
+	// Envelopes are only factorized with their table (see ATable::factorize()) and fitted with modal(), LowRank and
+	// Modal return the envelope itself
+	inline Envelope encode(Encoding encoding, float tolerance = EnvelopeCodec::DefaultBreakpointTolerance) const;
+
+	// returns the envelope as Sparse envelope, frames at or below 'floor' become silence
+	inline Envelope sparse(float floor) const;
+
+	// returns the envelope as Modal envelope (see ModalFit.h) if the relative error of the fit is within 'tolerance'
+	// (linear), the envelope itself otherwise
+	inline Envelope modal(float tolerance) const;
+
+	inline std::vector<float> toVector() const;
+
+	// returns the envelope with its samples copied to 'arena', the envelope itself if the arena is out of memory.
+	// LowRank envelopes stay with their factors
+	inline Envelope placeIn(Arena & arena) const;
+
+	// #################### SERIALIZATION ####################
+
+	template<class Archive>
+	void save(Archive & archive) const
+	{
+		archive(toVector());
+	}
+
+	template<class Archive>
+	void load(Archive & archive)
+	{
+		std::vector<float> vec;
+		archive(vec);
+		*this = Envelope(std::move(vec));
+	}
+
+private:
+	std::shared_ptr<const void> samples;
+	unsigned int				length{ 0 };
+	Encoding					encoding{ Encoding::Float32 };
+	float						scale{ 1 };
+	uint32_t					byteSize{ 0 };
+	bool						placed{ false };
+};
+
+/*
+	EnvelopeMemo remembers the result of transforming an envelope (encoding, trimming). Tables sharing envelopes,
+	e.g. shifted tables and their source, then share the transformed envelope as well instead of each table
+	transforming its own copy.
+
+	Results are looked up by the samples of the source envelope and a tag telling transformations apart. The
+	source envelopes are kept alive by the memo, their addresses can't be reused while it exists.
+*/
+class EnvelopeMemo
+{
+public:
+	// returns the result for 'source' and 'tag', calls 'transform(source)' if there is none yet
+	template<class Transform>
+	inline Envelope get(const Envelope & source, uint64_t tag, Transform transform);
+
+	// the result for 'source' and 'tag', nullptr if there is none
+	inline const Envelope * find(const Envelope & source, uint64_t tag) const;
+
+	inline void clear() { results.clear(); }
+
+private:
+	using Key = std::pair<const void*, uint64_t>;
+
+	std::map<Key, std::pair<Envelope, Envelope>> results; // source, result
+};
+
+/*
+	EnvelopePool finds envelopes with the same content, e.g. identical bins of the velocity layers of a bank, so they
+	can share one copy. Envelopes are looked up by a hash of their encoded data and kept alive by the pool.
+*/
+class EnvelopePool
+{
+public:
+	// the envelope of the pool with the content of 'envelope', 'envelope' itself if it is the first one.
+	// LowRank envelopes are columns of their table's factors, they are returned unchanged
+	inline const Envelope & share(const Envelope & envelope);
+
+	// bytes of the envelopes share() found a copy of, every storage is counted once
+	inline uint64_t getSharedBytes() const { return sharedBytes; }
+
+private:
+	std::unordered_multimap<uint64_t, Envelope> envelopes;
+	std::unordered_set<const void*>				shared;
+	uint64_t									sharedBytes{ 0 };
+};
+
+
+inline Envelope::Envelope(std::vector<float>&& samples)
+{
+	// the vector is kept alive by the shared pointer, its data is referenced without copying
+	auto owner = std::make_shared<std::vector<float>>(std::move(samples));
+	this->length   = owner->size();
+	this->byteSize = owner->size() * sizeof(float);
+	this->samples  = std::shared_ptr<const void>(owner, owner->data());
+}
+
+inline Envelope::Envelope(const std::vector<float>& samples) : Envelope(std::vector<float>(samples))
+{
+}
+
+inline Envelope::Envelope(unsigned int size, float value) : Envelope(std::vector<float>(size, value))
+{
+}
+
+inline Envelope::Envelope(std::shared_ptr<const void> owner, const void * data, unsigned int size, Encoding encoding, float scale, size_t byteSize, bool placed)
+	:
+	samples(owner, data),
+	length(size),
+	encoding(encoding),
+	scale(scale),
+	byteSize(byteSize),
+	placed(placed)
+{
+}
+
+inline Envelope Envelope::lowRank(std::shared_ptr<const void> factors, const EnvelopeCodec::LowRankColumn & column, unsigned int size, bool placed)
+{
+	// the column is data of its own, it keeps the factors alive
+	struct Owner
+	{
+		std::shared_ptr<const void>	 factors;
+		EnvelopeCodec::LowRankColumn column;
+	};
+
+	auto owner = std::make_shared<Owner>();
+	owner->factors = std::move(factors);
+	owner->column  = column;
+	return Envelope(owner, &owner->column, size, Encoding::LowRank, 1, sizeof(EnvelopeCodec::LowRankColumn), placed);
+}
+
+inline void Envelope::decode(unsigned int start, unsigned int count, float * out) const
+{
+	EnvelopeCodec::decode(encoding, samples.get(), byteSize, length, scale, start, count, out);
+}
+
+inline float Envelope::peak() const
+{
+	// decodes in chunks, no allocation
+	const unsigned int ChunkSize = 256;
+	float chunk[ChunkSize];
+	float max = 0;
+
+	for (unsigned int start = 0; start < length; start += ChunkSize)
+	{
+		auto count = std::min(ChunkSize, length - start);
+		decode(start, count, chunk);
+		for (unsigned int i = 0; i < count; i++) max = std::max(max, chunk[i]);
+	}
+	return max;
+}
+
+inline bool Envelope::operator==(const Envelope & rhs) const
+{
+	if (length != rhs.length || encoding != rhs.encoding || scale != rhs.scale || byteSize != rhs.byteSize) return false;
+	if (samples == rhs.samples) return true;
+	return std::memcmp(rawData(), rhs.rawData(), rawSize()) == 0;
+}
+
+inline void Envelope::resize(unsigned int size, float value)
+{
+	if (size == length) return;
+
+	auto vec = toVector();
+	vec.resize(size, value);
+
+	// breakpoints are picked again with the default tolerance
+	*this = Envelope(std::move(vec)).encode(encoding);
+}
+
+inline Envelope Envelope::encode(Encoding encoding, float tolerance) const
+{
+	if (encoding == this->encoding || encoding == Encoding::LowRank || encoding == Encoding::Modal) return *this;
+
+	if (encoding == Encoding::Sparse) return sparse(0);
+
+	auto vec = toVector();
+
+	if (encoding == Encoding::Breakpoint)
+	{
+		auto owner = std::make_shared<std::vector<EnvelopeCodec::Breakpoint>>(EnvelopeCodec::simplify(vec.data(), length, tolerance));
+		return Envelope(owner, owner->data(), length, encoding, 1, owner->size() * sizeof(EnvelopeCodec::Breakpoint));
+	}
+
+	auto owner = std::make_shared<std::vector<uint8_t>>(EnvelopeCodec::getByteSize(encoding, length));
+	auto scale = EnvelopeCodec::encode(encoding, vec.data(), length, owner->data());
+
+	return Envelope(owner, owner->data(), length, encoding, scale, owner->size());
+}
+
+inline Envelope Envelope::sparse(float floor) const
+{
+	auto vec   = toVector();
+	auto owner = std::make_shared<std::vector<uint8_t>>(EnvelopeCodec::encodeSparse(vec.data(), length, floor));
+	return Envelope(owner, owner->data(), length, Encoding::Sparse, 1, owner->size());
+}
+
+inline Envelope Envelope::modal(float tolerance) const
+{
+	auto vec = toVector();
+
+	ModalFit::Fit fit;
+	if (!ModalFit::fit(vec.data(), length, EnvelopeCodec::MaxModalModes, tolerance, fit)) return *this;
+
+	std::vector<EnvelopeCodec::ModalMode> modes;
+	for (size_t m = 0; m < fit.decays.size(); m++) modes.push_back({ fit.amplitudes[m], fit.decays[m] });
+
+	EnvelopeCodec::ModalHeader header = { fit.attackFrames, static_cast<uint32_t>(modes.size()), fit.endFrame };
+	auto owner = std::make_shared<std::vector<uint8_t>>(EnvelopeCodec::encodeModal(header, modes.data(), vec.data()));
+	return Envelope(owner, owner->data(), length, Encoding::Modal, 1, owner->size());
+}
+
+inline std::vector<float> Envelope::toVector() const
+{
+	std::vector<float> vec(length);
+	decode(0, length, vec.data());
+	return vec;
+}
+
+inline Envelope Envelope::placeIn(Arena & arena) const
+{
+	if (rawData() == nullptr || encoding == Encoding::LowRank) return *this;
+
+	std::shared_ptr<const void> owner;
+	auto data = arena.allocate(byteSize, owner);
+	if (data == nullptr) return *this;
+
+	std::memcpy(data, rawData(), byteSize);
+	return Envelope(owner, data, length, encoding, scale, byteSize, true);
+}
+
+template<class Transform>
+inline Envelope EnvelopeMemo::get(const Envelope & source, uint64_t tag, Transform transform)
+{
+	// empty envelopes have no samples to tell them apart
+	if (source.rawData() == nullptr) return transform(source);
+
+	auto key = Key(source.rawData(), tag);
+	auto it = results.find(key);
+	if (it == results.end()) it = results.emplace(key, std::make_pair(source, transform(source))).first;
+	return it->second.second;
+}
+
+inline const Envelope * EnvelopeMemo::find(const Envelope & source, uint64_t tag) const
+{
+	if (source.rawData() == nullptr) return nullptr;
+
+	auto it = results.find(Key(source.rawData(), tag));
+	return (it != results.end()) ? &it->second.second : nullptr;
+}
+
+inline const Envelope & EnvelopePool::share(const Envelope & envelope)
+{
+	if (envelope.rawData() == nullptr || envelope.getEncoding() == Envelope::Encoding::LowRank) return envelope;
+
+	auto hash  = Hash::fnv1a(envelope.rawData(), envelope.rawSize());
+	auto range = envelopes.equal_range(hash);
+	for (auto it = range.first; it != range.second; it++)
+	{
+		if (!(it->second == envelope)) continue;
+
+		if (it->second.rawData() != envelope.rawData() && shared.insert(envelope.rawData()).second) sharedBytes += envelope.rawSize();
+		return it->second;
+	}
+	return envelopes.emplace(hash, envelope)->second;
+}
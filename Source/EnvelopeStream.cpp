@@ -0,0 +1,136 @@
+#include "EnvelopeStream.h"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+EnvelopeStream::EnvelopeStream()
+{
+	thread = std::thread(&EnvelopeStream::threadLoop, this);
+}
+
+EnvelopeStream::~EnvelopeStream()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_one();
+	thread.join();
+}
+
+unsigned int EnvelopeStream::getMinHeadFrames(float frameRate, unsigned int frameSize, float sampleRate)
+{
+	// frames of one block as the player reserves them (see TablePlayer::prepare())
+	auto blockFrames = static_cast<unsigned int>(std::ceil(frameSize * frameRate / sampleRate)) + 3;
+	return 2 * blockFrames;
+}
+
+std::shared_ptr<StreamBuffer> EnvelopeStream::open(const TableBlend & blend)
+{
+	if (blend.empty() || blend.tables[1] != nullptr || blend.matrix != nullptr) return nullptr;
+
+	auto &table = blend.tables[0];
+	if (table->getHeadFrames() == 0) return nullptr;
+
+	auto buffer = std::make_shared<StreamBuffer>();
+	for (auto &bin : blend.bins)
+	{
+		auto source = table->findBin(bin.envelopes[0]);
+		if (source == nullptr || source->head.empty()) return nullptr;
+
+		buffer->envelopes.push_back(bin.envelopes[0]);
+		buffer->heads.push_back(&source->head);
+	}
+
+	// the heads belong to the regions of the table
+	buffer->table	   = table;
+	buffer->regions	   = table->getRegions();
+	buffer->headFrames = table->getHeadFrames();
+	buffer->length	   = blend.length;
+	buffer->numBins	   = static_cast<unsigned int>(blend.bins.size());
+	buffer->capacity   = 2 * buffer->headFrames;
+	buffer->underruns  = &underruns;
+
+	auto numFloats = size_t(buffer->capacity) * buffer->numBins;
+	buffer->rows.reset(new std::atomic<float>[numFloats]);
+	for (size_t i = 0; i < numFloats; i++) buffer->rows[i].store(0.f, std::memory_order_relaxed);
+	buffer->jumpRows.assign(2 * size_t(buffer->numBins), 0.f);
+	buffer->tags.reset(new std::atomic<uint32_t>[buffer->capacity]);
+	for (unsigned int i = 0; i < buffer->capacity; i++) buffer->tags[i].store(0, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		opened.push_back(buffer);
+	}
+	condition.notify_one();
+	return buffer;
+}
+
+void EnvelopeStream::threadLoop()
+{
+	// the duration takes a reference, PollMicroseconds has no definition outside the class
+	const auto pollInterval = std::chrono::microseconds(static_cast<unsigned int>(PollMicroseconds));
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		for (auto &buffer : opened) buffers.push_back(std::move(buffer));
+		opened.clear();
+		lock.unlock();
+
+		// buffers only referenced here aren't played anymore
+		buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const std::shared_ptr<StreamBuffer> & buffer) { return buffer.use_count() == 1; }), buffers.end());
+
+		unsigned int numLoaded = 0;
+		for (auto &buffer : buffers) numLoaded += fill(*buffer);
+
+		lock.lock();
+		if (numLoaded == 0 && opened.empty() && !stopping) condition.wait_for(lock, pollInterval);
+	}
+}
+
+unsigned int EnvelopeStream::fill(StreamBuffer & buffer)
+{
+	auto start = buffer.position.load(std::memory_order_acquire);
+	auto end   = std::min(start + buffer.headFrames, buffer.length);
+
+	auto missing = [&buffer](unsigned int frame)
+	{
+		return !buffer.regions.isHead(frame, buffer.headFrames) && buffer.tags[frame % buffer.capacity].load(std::memory_order_relaxed) != frame + 1;
+	};
+
+	unsigned int numLoaded = 0;
+	unsigned int frame = start;
+	while (frame < end)
+	{
+		if (!missing(frame))
+		{
+			frame++;
+			continue;
+		}
+
+		// the missing frames are loaded run by run, every bin is decoded once per run
+		unsigned int count = 1;
+		while (frame + count < end && missing(frame + count)) count++;
+
+		for (unsigned int k = 0; k < count; k++) buffer.tags[(frame + k) % buffer.capacity].store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		decoded.resize(count);
+		for (unsigned int f = 0; f < buffer.numBins; f++)
+		{
+			auto &envelope = *buffer.envelopes[f];
+			auto available = (frame < envelope.size()) ? std::min(count, envelope.size() - frame) : 0;
+			envelope.decode(frame, available, decoded.data());
+			std::fill(decoded.begin() + available, decoded.end(), 0.f);
+
+			for (unsigned int k = 0; k < count; k++) buffer.rows[size_t((frame + k) % buffer.capacity) * buffer.numBins + f].store(decoded[k], std::memory_order_relaxed);
+		}
+
+		for (unsigned int k = 0; k < count; k++) buffer.tags[(frame + k) % buffer.capacity].store(frame + k + 1, std::memory_order_release);
+
+		numLoaded += count;
+		frame	  += count;
+	}
+	return numLoaded;
+}
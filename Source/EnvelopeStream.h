@@ -0,0 +1,201 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TableBlend.h"
+
+/*
+	StreamBuffer holds the frames of a streamed note (see EnvelopeStream) around its read position. The heads of
+	the table (see ATable::makeStreamHeads()) are read from the bins, every other frame from a ring of frame-major
+	rows that the stream thread fills ahead of the player.
+
+	A frame has a slot of its own (frame modulo the capacity of the ring) and a tag telling which frame the slot
+	holds. The stream thread loads the frames [position, position + lookahead), where the position is the first
+	frame the player reads. The lookahead is the length of a head and the ring twice as long: the player only jumps
+	back into a head (loop, release), so the frames it reads and those being loaded never share a slot.
+*/
+class StreamBuffer
+{
+public:
+	// the methods below are called by the player, they never wait for the stream thread
+
+	// writes the frames [start, start + count) of all bins to 'rows' (frame-major, 'stride' floats per frame).
+	// 'scratch' holds 'count' floats. Frames that aren't loaded yet are silent and counted as underrun
+	inline void read(unsigned int start, unsigned int count, float *rows, unsigned int stride, float *scratch);
+
+	// amplitudes of all bins at a fractional position (see TablePlayer::amplitudeAt()), written to 'out'
+	inline void amplitudesAt(float position, float *out);
+
+	inline unsigned int getNumBins() const { return numBins; }
+
+private:
+	friend class EnvelopeStream;
+
+	// copies the row of 'frame' to the bins [0, numBins) of 'out', false if the slot holds another frame
+	inline bool readRow(unsigned int frame, float *out) const;
+
+	std::shared_ptr<const ATable> table;	// keeps the envelopes alive
+	std::vector<const Envelope*>  envelopes;	// in the order of the blend
+	std::vector<const Envelope*>  heads;
+	ATable::Regions				  regions;
+	unsigned int				  headFrames{ 0 };
+	unsigned int				  length{ 0 };
+	unsigned int				  numBins{ 0 };
+	unsigned int				  capacity{ 0 };	// frames of the ring
+
+	std::unique_ptr<std::atomic<float>[]>	 rows;	// capacity x numBins, relaxed: the tags order them
+	std::vector<float>						 jumpRows;	// two rows read by amplitudesAt()
+	std::unique_ptr<std::atomic<uint32_t>[]> tags;	// frame + 1 of every slot, 0 while empty or written
+
+	std::atomic<unsigned int>  position{ 0 };
+	std::atomic<uint64_t>	  *underruns{ nullptr };	// of the stream
+};
+
+/*
+	EnvelopeStream plays streamed tables (see TableManager::setStreaming()) like a sampler streams long samples
+	from disk: the heads of every table are resident, a background thread loads the frames after them from the
+	envelopes while the notes play. Envelopes of tables loaded from a cache reference the mapped file, only the
+	pages of the frames that are played are read from disk. Tables imported from text keep their envelopes in
+	memory, streaming them saves nothing.
+
+	open() is called with every note on, the buffer travels with the blend to the player. Buffers are dropped by
+	the stream thread once the player released them.
+*/
+class EnvelopeStream
+{
+public:
+	EnvelopeStream();
+	~EnvelopeStream();
+
+	EnvelopeStream(const EnvelopeStream &) = delete;
+	EnvelopeStream & operator=(const EnvelopeStream &) = delete;
+
+	// buffer for the frames of 'blend', nullptr if the blend isn't streamed: blends mixing two tables or reading
+	// a frame matrix and tables without heads are played from their envelopes. Don't call from the audio thread
+	std::shared_ptr<StreamBuffer> open(const TableBlend & blend);
+
+	// frames the players read before they were loaded, played as silence
+	uint64_t getUnderruns() const { return underruns.load(std::memory_order_relaxed); }
+
+	// the stream thread polls the read positions of the players in this interval while it has nothing to load
+	static const unsigned int PollMicroseconds = 500;
+
+	// shortest head for tables at 'frameRate' played in blocks of 'frameSize' samples: the stream loads one head
+	// ahead of the player, which reads the frames of the current block and the next
+	static unsigned int getMinHeadFrames(float frameRate, unsigned int frameSize, float sampleRate);
+
+private:
+	void threadLoop();
+
+	// loads the missing frames ahead of the player, returns the frames loaded
+	unsigned int fill(StreamBuffer & buffer);
+
+	std::vector<std::shared_ptr<StreamBuffer>> opened;	// handed over to the stream thread, guarded by mutex
+	std::vector<std::shared_ptr<StreamBuffer>> buffers;	// stream thread only
+	std::vector<float>						   decoded;	// frames of one bin, stream thread only
+
+	std::atomic<uint64_t>	underruns{ 0 };
+	std::mutex				mutex;
+	std::condition_variable condition;
+	bool					stopping{ false };
+
+	// declared last, started when the other members exist
+	std::thread				thread;
+};
+
+
+inline void StreamBuffer::read(unsigned int start, unsigned int count, float * out, unsigned int stride, float * scratch)
+{
+	position.store(start, std::memory_order_release);
+
+	bool anyHead = false, allHead = true;
+	for (unsigned int k = 0; k < count; k++)
+	{
+		bool head = regions.isHead(start + k, headFrames);
+		anyHead |= head;
+		allHead &= head;
+	}
+
+	// the heads are silent outside their frames, the streamed frames overwrite them
+	for (unsigned int f = 0; f < numBins; f++)
+	{
+		auto &head = *heads[f];
+		bool silent = !anyHead || start >= head.size() || head.isSilent(start, std::min(count, head.size() - start));
+		if (silent)
+		{
+			for (unsigned int k = 0; k < count; k++) out[k * stride + f] = 0;
+			continue;
+		}
+
+		auto available = std::min(count, head.size() - start);
+		head.decode(start, available, scratch);
+		std::fill(scratch + available, scratch + count, 0.f);
+		for (unsigned int k = 0; k < count; k++) out[k * stride + f] = scratch[k];
+	}
+	if (allHead) return;
+
+	for (unsigned int k = 0; k < count; k++)
+	{
+		auto frame = start + k;
+		if (frame >= length || regions.isHead(frame, headFrames)) continue;
+
+		if (!readRow(frame, out + k * stride))
+		{
+			std::fill(out + k * stride, out + k * stride + numBins, 0.f);
+			underruns->fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+inline void StreamBuffer::amplitudesAt(float position, float * out)
+{
+	if (length < 2)
+	{
+		std::fill(out, out + numBins, 0.f);
+		return;
+	}
+
+	position = std::min(std::max(position, 0.f), float(length - 2));
+	unsigned int frame = position;
+	float frac = position - frame;
+
+	for (unsigned int k = 0; k < 2; k++)
+	{
+		auto row = jumpRows.data() + k * numBins;
+		if (regions.isHead(frame + k, headFrames))
+		{
+			for (unsigned int f = 0; f < numBins; f++)
+			{
+				if (frame + k < heads[f]->size()) heads[f]->decode(frame + k, 1, row + f);
+				else							  row[f] = 0;
+			}
+		}
+		else if (!readRow(frame + k, row))
+		{
+			std::fill(row, row + numBins, 0.f);
+			underruns->fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	auto next = jumpRows.data() + numBins;
+	for (unsigned int f = 0; f < numBins; f++) out[f] = (1.f - frac) * jumpRows[f] + frac * next[f];
+}
+
+inline bool StreamBuffer::readRow(unsigned int frame, float * out) const
+{
+	// the stream thread clears the tag before it writes a slot, the row is valid if the tag didn't change meanwhile
+	auto &tag = tags[frame % capacity];
+	if (tag.load(std::memory_order_acquire) != frame + 1) return false;
+
+	// the row may be overwritten meanwhile, relaxed atomics make that a stale value instead of a data race
+	auto row = rows.get() + size_t(frame % capacity) * numBins;
+	for (unsigned int f = 0; f < numBins; f++) out[f] = row[f].load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return tag.load(std::memory_order_relaxed) == frame + 1;
+}
@@ -97,14 +97,19 @@ ATable * HarmonicTable::interpolateTable(const ATable & secondTable, int targetM
 		const auto &bin1 = t1.bins[binIdx];
 		const auto &bin2 = t2.bins[binIdx];
 
-		bin.envelope.resize(std::min(bin1.envelope.size(), bin2.envelope.size()));
+		std::vector<float> envelope(std::min(bin1.envelope.size(), bin2.envelope.size()));
+
+		// the source envelopes might be encoded
+		auto envelope1 = bin1.envelope.toVector();
+		auto envelope2 = bin2.envelope.toVector();
 
 		int sampleIdx = 0;
 		while ((sampleIdx < bin1.envelope.size()) && (sampleIdx < bin2.envelope.size()))
 		{
-			bin.envelope[sampleIdx] = t1Frac * bin1.envelope[sampleIdx] + t2Frac * bin2.envelope[sampleIdx];
+			envelope[sampleIdx] = t1Frac * envelope1[sampleIdx] + t2Frac * envelope2[sampleIdx];
 			sampleIdx++;
 		}
+		bin.envelope = Envelope(std::move(envelope));
 		newTable->bins.push_back(std::move(bin));
 		binIdx++;
 	}
@@ -113,7 +118,7 @@ ATable * HarmonicTable::interpolateTable(const ATable & secondTable, int targetM
 	return newTable;
 }
 
-ATable * HarmonicTable::createShiftedTable(int targetMidi)
+ATable * HarmonicTable::createShiftedTable(int targetMidi) const
 {
 	auto table = new HarmonicTable(*this);
 	table->shiftFrequencyTo(targetMidi);
@@ -122,3 +127,37 @@ ATable * HarmonicTable::createShiftedTable(int targetMidi)
 
 
 
+bool HarmonicTable::blendBins(const ATable & secondTable, int targetMidi, std::vector<BlendBin> & bins, unsigned int & length) const
+{
+	auto table2 = dynamic_cast<const HarmonicTable*>(&secondTable);
+
+	// same requirements as interpolateTable()
+	if (table2 == nullptr || this->cfg != table2->cfg) return false;
+
+	auto & t1 = (this->midiNote < table2->midiNote) ? *this : *table2;
+	auto & t2 = (this->midiNote < table2->midiNote) ? *table2 : *this;
+
+	if (t1.midiNote > targetMidi || t2.midiNote < targetMidi || t1.midiNote == t2.midiNote) return false;
+
+	float midiRange = t2.midiNote - t1.midiNote;
+	float t2Frac = static_cast<float>(targetMidi - t1.midiNote) / midiRange;
+	float t1Frac = 1. - t2Frac;
+
+	auto fundamental = 440 * pow(2., (static_cast<double>(targetMidi) - 69.) / 12.);
+
+	bins.clear();
+	length = std::min(t1.getEnvelopeLength(), t2.getEnvelopeLength());
+	for (int i = 0; (i < t1.bins.size()) && (i < t2.bins.size()); i++)
+	{
+		if (!t1.isActive(i) && !t2.isActive(i)) continue;
+
+		BlendBin bin;
+		bin.frequency	 = (i + 1) * fundamental;
+		bin.envelopes[0] = &t1.bins[i].envelope;
+		bin.envelopes[1] = &t2.bins[i].envelope;
+		bin.weights[0]	 = t1Frac;
+		bin.weights[1]	 = t2Frac;
+		bins.push_back(bin);
+	}
+	return true;
+}
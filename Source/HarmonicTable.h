@@ -43,7 +43,11 @@ private:
 
 
 	// Inherited via ATable
-	virtual ATable * createShiftedTable(int targetMidi) override;
+	virtual ATable * createShiftedTable(int targetMidi) const override;
+
+
+	// Inherited via ATable
+	virtual bool blendBins(const ATable & secondTable, int targetMidi, std::vector<BlendBin> & bins, unsigned int & length) const override;
 
 };
 
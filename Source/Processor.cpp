@@ -1,10 +1,11 @@
 #include "Processor.h"
 #include "VoiceLogic.h"
 #include <memory>
+#include <chrono>
 
-Processor::Processor(unsigned int numVoices, const TableManager * tableManager, bool doAuto)
+Processor::Processor(unsigned int numVoices, VelocityLayers * layers, bool doAuto, EnvelopeStream * stream)
 	:
-	tableManager(tableManager),
+	layers(layers),
 	numVoices(numVoices),
 	doAuto(doAuto)
 {
@@ -12,7 +13,7 @@ Processor::Processor(unsigned int numVoices, const TableManager * tableManager,
 	std::vector<VoiceManager::AVoiceHandle*> voiceHandles;
 	for (int i = 0; i < numVoices; i++)
 	{
-		voices.push_back(std::unique_ptr<VoiceProcessor>(new VoiceProcessor(i, tableManager)));
+		voices.push_back(std::unique_ptr<VoiceProcessor>(new VoiceProcessor(i, layers, stream, &releaseQueue)));
 		voiceHandles.push_back(voices[i].get());
 	}
 
@@ -25,23 +26,52 @@ Processor::Processor(unsigned int numVoices, const TableManager * tableManager,
 
 	for (int i = 0; i < 128; i++)
 	{
-		auto table = tableManager->getTable(i);
-		if (table != nullptr)
+		if (layers->hasTable(i))
 		{
 			if (autoData.lowerRange == 0) autoData.lowerRange = i;
 			autoData.upperRange = i;
 		}
 	}
 	autoData.lastNote = autoData.lowerRange;
+
+	controlThread = std::thread(&Processor::controlLoop, this);
+}
+
+Processor::~Processor()
+{
+	{
+		std::lock_guard<std::mutex> lock(controlMutex);
+		stopping = true;
+	}
+	controlCondition.notify_all();
+	if (controlThread.joinable()) controlThread.join();
+}
+
+void Processor::controlLoop()
+{
+	// a copy, the constant has no definition outside the class
+	const unsigned int intervalMS = ControlIntervalMS;
+	const auto		   interval	  = std::chrono::milliseconds(intervalMS);
+
+	std::unique_lock<std::mutex> lock(controlMutex);
+	while (!controlCondition.wait_for(lock, interval, [this] { return stopping; }))
+	{
+		lock.unlock();
+		releaseQueue.releaseAll();
+		if (doAuto) playAuto(intervalMS);
+		lock.lock();
+	}
 }
 
 void Processor::noteOn(double timeStamp, unsigned char ch, unsigned char note, unsigned char vel)
 {
+	std::lock_guard<std::mutex> lock(noteMutex);
 	voiceControl.noteOn(timeStamp, ch, note, vel);
 }
 
 void Processor::noteOff(double timeStamp, unsigned char ch, unsigned char note)
 {
+	std::lock_guard<std::mutex> lock(noteMutex);
 	voiceControl.noteOff(timeStamp, ch, note);
 }
 
@@ -51,13 +81,6 @@ void Processor::midiEvent(double timeStamp, std::vector<unsigned char>* message)
 
 void Processor::process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackData * data)
 {
-	if (doAuto)
-	{
-		float ms = 1000. * (cfg.frameSize * cfg.iSampleRate);
-		playAuto(ms);
-	}
-
-
 	for (int c = 0; c < cfg.outChannels; c++)
 	{
 		for (int i = 0; i < cfg.frameSize; i++)
@@ -86,9 +109,11 @@ void Processor::process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackDa
 
 void Processor::prepare(const AudioIO::CallbackConfig & cfg)
 {
+	// the players allocate for the largest table, a note on doesn't allocate on the audio thread
+	auto limits = layers->getPlaybackLimits();
 	for (auto &voice : voices)
 	{
-		voice->prepare(cfg);
+		voice->prepare(cfg, limits);
 	}
 }
 
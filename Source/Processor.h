@@ -1,18 +1,22 @@
 #pragma once
 
 #include "VoiceManager.h"
-#include "TableManager.h"
+#include "VelocityLayers.h"
 #include "TablePlayer.h"
 #include "AudioIO.h"
 #include "MidiIO.h"
 #include "VoiceProcessor.h"
 #include "VoiceLogic.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 class Processor : public AudioCallbackProvider, public MidiListener
 {
 public:
-	Processor(unsigned int numVoices, const TableManager *tableManager, bool doAuto);
-
+	// the voices play streamed tables with 'stream' (see EnvelopeStream), nullptr if the tables aren't streamed
+	Processor(unsigned int numVoices, VelocityLayers *layers, bool doAuto, EnvelopeStream *stream = nullptr);
+	~Processor();
 
 	virtual void noteOn(double timeStamp, unsigned char ch, unsigned char note, unsigned char vel) override;
 	virtual void noteOff(double timeStamp, unsigned char ch, unsigned char note) override;
@@ -20,8 +24,12 @@ public:
 	
 	virtual void process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackData * data) override;
 
+	// called by the control thread in auto mode, never from the audio callback (a note on prepares a blend)
 	void playAuto(float msIncrement);
 
+	// interval of the control thread, it drops the tables of finished notes (see ReleaseQueue) and plays auto mode
+	static const unsigned int ControlIntervalMS = 50;
+
 	void prepare(const AudioIO::CallbackConfig & cfg);
 
 
@@ -30,7 +38,10 @@ private:
 	std::unique_ptr<SimpleVoiceLogic> voiceLogic;
 
 	VoiceManager::Control		  voiceControl;
-	const TableManager * const tableManager;
+	VelocityLayers * const		  layers;
+
+	// references of the blends the voices played before, dropped by the control thread
+	ReleaseQueue				  releaseQueue;
 
 	std::vector<std::unique_ptr<VoiceProcessor>> voices;
 
@@ -51,4 +62,15 @@ private:
 	bool doAuto{ false };
 	AutoData autoData;
 
+	// MIDI and the control thread both play notes
+	std::mutex					  noteMutex;
+
+	// drops released tables and plays the notes of auto mode
+	void controlLoop();
+
+	std::thread					  controlThread;
+	std::mutex					  controlMutex;
+	std::condition_variable		  controlCondition;
+	bool						  stopping{ false };
+
 };
@@ -0,0 +1,226 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "ATable.h"
+
+class StreamBuffer;
+
+/*
+	TableBlend is what the TablePlayer plays: the bins of a note and the tables owning their envelopes. A note
+	with a table of its own plays that table, a note between two source tables can be mixed from both while
+	playing instead (see TableManager::setBlendPlayback), no table has to be created and kept for it.
+*/
+struct TableBlend
+{
+	// low-rank factors of the bins (see ATable::factorize()) with the templates in the order of the bins. The amplitudes
+	// of all bins in a frame are the activations of the frame times the templates
+	struct Factors
+	{
+		const float		  *activations{ nullptr };	// numFrames x rank, owned by the envelopes of the table
+		unsigned int	   rank{ 0 };
+		unsigned int	   numFrames{ 0 };
+		unsigned int	   stride{ 0 };				// floats per template, the number of bins padded to ATable::MatrixPadding
+		std::vector<float> templates;				// rank x stride, silent bins have a weight of 0
+	};
+
+	std::shared_ptr<const ATable>	tables[2];		// keep the envelopes referenced by the bins alive
+	std::vector<ATable::BlendBin>	bins;
+	ATable::Config					config;
+	ATable::Regions					regions;
+	unsigned int					length{ 0 };	// envelope frames
+
+	// amplitudes of the bins as frame-major matrix (see ATable::setFrameMatrix()), single tables only
+	std::shared_ptr<const ATable::FrameMatrix> matrix;
+
+	// single tables whose bins are all factorized together (or silent), nullptr otherwise
+	std::shared_ptr<const Factors> factors;
+
+	// frames of a streamed table (see EnvelopeStream::open()), nullptr if the player reads the envelopes
+	std::shared_ptr<StreamBuffer> stream;
+
+	// the largest blends of a bank, the player allocates its buffers for them before playing (see TablePlayer::prepare())
+	struct Limits
+	{
+		unsigned int numBins{ 0 };
+		float		 frameRate{ 0 };	// envelope frames per second, sampleRate / hopSize of the config
+	};
+
+	inline bool empty() const { return !tables[0]; }
+
+	// storage for the next blend: an empty blend keeping the capacity of the bins of 'blend' and its factors, if
+	// nothing else references them. Tables, matrix and stream of 'blend' are dropped
+	static inline TableBlend recycle(TableBlend && blend);
+
+	// the active bins of 'table', unchanged. The blend is built in 'storage' (see recycle())
+	static inline TableBlend fromTable(std::shared_ptr<const ATable> table, TableBlend && storage);
+	static inline TableBlend fromTable(std::shared_ptr<const ATable> table) { return fromTable(std::move(table), TableBlend()); }
+
+	// the bins of two tables of the same note mixed by index with 'secondWeight' (0..1), e.g. two velocity layers.
+	// The tables need the same bins and config, no trimmed loop (see ATable::Regions::trimmed) and mustn't be
+	// streamed (see ATable::makeStreamHeads()), the blend is empty otherwise. Tracks, noise bands and regions are taken from the table with the larger weight
+	static inline TableBlend crossfade(std::shared_ptr<const ATable> first, std::shared_ptr<const ATable> second, float secondWeight, TableBlend && storage);
+
+	// frames of a bin, mixed bins end with their shorter envelope
+	static inline unsigned int binLength(const ATable::BlendBin & bin);
+
+private:
+	// the factors shared by all bins of a single table, nullptr if they aren't. Bins of 'table' that are silent
+	// (see ATable::BinStats) may have no factors. The factors are written to 'spare' if nothing else references it
+	static inline std::shared_ptr<const Factors> gatherFactors(const std::vector<ATable::BlendBin> & bins, const ATable & table, unsigned int length, std::shared_ptr<const Factors> spare);
+};
+
+
+inline TableBlend TableBlend::recycle(TableBlend && blend)
+{
+	TableBlend storage;
+	storage.bins = std::move(blend.bins);
+	storage.bins.clear();
+	if (blend.factors.use_count() == 1) storage.factors = std::move(blend.factors);
+	blend = TableBlend();
+	return storage;
+}
+
+inline TableBlend TableBlend::fromTable(std::shared_ptr<const ATable> table, TableBlend && storage)
+{
+	auto blend = recycle(std::move(storage));
+	auto spare = std::move(blend.factors);
+	if (!table) return blend;
+
+	auto &bins = table->getBins();
+	auto addBin = [&blend](const ATable::Bin & bin)
+	{
+		ATable::BlendBin blendBin;
+		blendBin.frequency	  = bin.frequency;
+		blendBin.envelopes[0] = &bin.envelope;
+		blendBin.bandwidth	  = bin.bandwidth;
+		if (!bin.track.empty()) blendBin.track = &bin.track;
+		blend.bins.push_back(blendBin);
+	};
+
+	// the columns of the matrix are the bins the matrix was built for in the order of the ranking, a lower limit
+	// plays the first ones
+	blend.matrix = table->getFrameMatrix();
+	if (blend.matrix != nullptr)
+	{
+		auto numColumns = std::min<unsigned int>(blend.matrix->bins.size(), table->getNumActiveBins());
+		blend.bins.reserve(numColumns);
+		for (unsigned int c = 0; c < numColumns; c++) addBin(bins[blend.matrix->bins[c]]);
+	}
+	else
+	{
+		blend.bins.reserve(table->getNumActiveBins());
+		for (unsigned int b = 0; b < bins.size(); b++) if (table->isActive(b)) addBin(bins[b]);
+	}
+
+	blend.config  = table->getConfig();
+	blend.regions = table->getRegions();
+	blend.length  = table->getEnvelopeLength();
+	if (blend.matrix == nullptr) blend.factors = gatherFactors(blend.bins, *table, blend.length, std::move(spare));
+	blend.tables[0] = std::move(table);
+	return blend;
+}
+
+inline TableBlend TableBlend::crossfade(std::shared_ptr<const ATable> first, std::shared_ptr<const ATable> second, float secondWeight, TableBlend && storage)
+{
+	auto blend = recycle(std::move(storage));
+	blend.factors.reset();
+	if (!first || !second) return blend;
+
+	auto &bins1 = first->getBins();
+	auto &bins2 = second->getBins();
+	if (bins1.size() != bins2.size() || first->getConfig() != second->getConfig()) return blend;
+	if (first->getRegions().trimmed || second->getRegions().trimmed) return blend;
+	if (first->getHeadFrames() > 0 || second->getHeadFrames() > 0) return blend;
+
+	bool heavierSecond = secondWeight > 0.5f;
+
+	blend.bins.reserve(bins1.size());
+	for (unsigned int b = 0; b < bins1.size(); b++)
+	{
+		if (!first->isActive(b) && !second->isActive(b)) continue;
+
+		auto &heavier = heavierSecond ? bins2[b] : bins1[b];
+
+		ATable::BlendBin blendBin;
+		blendBin.frequency	  = heavier.frequency;
+		blendBin.envelopes[0] = &bins1[b].envelope;
+		blendBin.envelopes[1] = &bins2[b].envelope;
+		blendBin.weights[0]	  = 1.f - secondWeight;
+		blendBin.weights[1]	  = secondWeight;
+		blendBin.bandwidth	  = heavier.bandwidth;
+		if (!heavier.track.empty()) blendBin.track = &heavier.track;
+		blend.bins.push_back(blendBin);
+	}
+
+	blend.config  = first->getConfig();
+	blend.length  = std::min(first->getEnvelopeLength(), second->getEnvelopeLength());
+
+	// the loop has to end within the shorter table
+	auto &regions = heavierSecond ? second->getRegions() : first->getRegions();
+	int lastFrame = int(blend.length) - 1;
+	if (regions.hasLoop() && regions.loopStart < std::min(regions.loopEnd, lastFrame))
+	{
+		blend.regions.loopStart = regions.loopStart;
+		blend.regions.loopEnd	= std::min(regions.loopEnd, lastFrame);
+		if (regions.hasRelease()) blend.regions.releaseStart = std::max(blend.regions.loopEnd + 1, regions.releaseStart);
+	}
+	blend.tables[0] = std::move(first);
+	blend.tables[1] = std::move(second);
+	return blend;
+}
+
+inline std::shared_ptr<const TableBlend::Factors> TableBlend::gatherFactors(const std::vector<ATable::BlendBin> & bins, const ATable & table, unsigned int length, std::shared_ptr<const Factors> spare)
+{
+	// bins left out of a factorization are silent
+	auto isSilent = [&table](const Envelope * envelope)
+	{
+		auto bin = table.findBin(envelope);
+		return table.hasBinStats() && bin != nullptr && table.getBinStats()[bin - table.getBins().data()].peak <= 0;
+	};
+
+	const EnvelopeCodec::LowRankColumn * first = nullptr;
+	for (unsigned int f = 0; f < bins.size(); f++)
+	{
+		auto &envelope = *bins[f].envelopes[0];
+		if (envelope.getEncoding() != Envelope::Encoding::LowRank)
+		{
+			if (isSilent(&envelope)) continue;
+			return nullptr;
+		}
+
+		// the frames of every bin are rows of the activations
+		auto column = envelope.getLowRankColumn();
+		if (envelope.size() != length || column->numFrames < length) return nullptr;
+		if (first == nullptr) first = column;
+		else if (column->activations != first->activations || column->templates != first->templates) return nullptr;
+	}
+	if (first == nullptr) return nullptr;
+
+	auto factors = (spare.use_count() == 1) ? std::const_pointer_cast<Factors>(spare) : std::make_shared<Factors>();
+	factors->activations = first->activations;
+	factors->rank		 = first->rank;
+	factors->numFrames	 = first->numFrames;
+	factors->stride		 = (bins.size() + ATable::MatrixPadding - 1) / ATable::MatrixPadding * ATable::MatrixPadding;
+	factors->templates.assign(size_t(factors->rank) * factors->stride, 0.f);
+
+	for (unsigned int f = 0; f < bins.size(); f++)
+	{
+		auto &envelope = *bins[f].envelopes[0];
+		if (envelope.getEncoding() != Envelope::Encoding::LowRank) continue;
+
+		auto column = envelope.getLowRankColumn();
+		for (unsigned int k = 0; k < factors->rank; k++)
+		{
+			factors->templates[size_t(k) * factors->stride + f] = column->templates[size_t(k) * column->stride + column->column];
+		}
+	}
+	return factors;
+}
+
+inline unsigned int TableBlend::binLength(const ATable::BlendBin & bin)
+{
+	if (bin.envelopes[1] == nullptr) return bin.envelopes[0]->size();
+	return std::min(bin.envelopes[0]->size(), bin.envelopes[1]->size());
+}
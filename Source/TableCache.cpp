@@ -0,0 +1,443 @@
+#include "TableCache.h"
+#include "CQTTable.h"
+#include "HarmonicTable.h"
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+
+#include "Util/Hash.h"
+#include "Util/MappedFile.h"
+#include "Util/FilePath.h"
+
+const char TableCache::Magic[8] = { 'K', 'L', 'A', 'N', 'G', 'T', 'B', 'L' };
+
+static_assert(sizeof(float) == 4, "cache format expects 32 bit floats");
+
+
+bool TableCache::isCacheFile(const std::string & filename)
+{
+	std::ifstream infile(filename, std::ios::binary);
+	char magic[sizeof(Magic)];
+	if (!infile.read(magic, sizeof(magic))) return false;
+	return std::memcmp(magic, Magic, sizeof(Magic)) == 0;
+}
+
+void TableCache::store(const std::string & filename, const Content & content)
+{
+	std::vector<const ATable*>	tableList;
+	std::vector<TableOrigin>	originList;
+	uint64_t numBins = 0;
+	for (size_t i = 0; i < content.tables.size(); i++)
+	{
+		auto &table = content.tables[i];
+		if (table == nullptr) continue;
+		tableList.push_back(table.get());
+		originList.push_back(content.origins[i]);
+		numBins += table->getBins().size();
+	}
+
+	// #################### strings ####################
+
+	std::string strings = content.rootFile + content.options;
+	std::vector<uint32_t> pathOffsets;
+	for (const auto & source : content.sources)
+	{
+		pathOffsets.push_back(strings.size());
+		strings += source.path;
+	}
+
+	// #################### layout ####################
+
+	Header header;
+	std::memset(&header, 0, sizeof(Header));
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version			= Version;
+	header.endianTag		= EndianTag;
+	header.numTables		= tableList.size();
+	header.headerSize		= sizeof(Header);
+	header.numSources		= content.sources.size();
+	header.stringsSize		= strings.size();
+	header.rootFileLength	= content.rootFile.size();
+	header.optionsLength	= content.options.size();
+
+	auto binRecordsOffset	 = tableList.size() * sizeof(TableRecord);
+	auto sourceRecordsOffset = binRecordsOffset + numBins * sizeof(BinRecord);
+	auto stringsOffset		 = sourceRecordsOffset + content.sources.size() * sizeof(SourceRecord);
+
+	header.indexSize	= stringsOffset + strings.size();
+	header.dataOffset	= align(header.headerSize + header.indexSize);
+
+	std::vector<char> index(header.indexSize, 0);
+	auto tableRecords	= reinterpret_cast<TableRecord*>(index.data());
+	auto binRecords		= reinterpret_cast<BinRecord*>(index.data() + binRecordsOffset);
+	auto sourceRecords	= reinterpret_cast<SourceRecord*>(index.data() + sourceRecordsOffset);
+	std::copy(strings.begin(), strings.end(), index.begin() + stringsOffset);
+
+	uint64_t binCursor  = 0;
+	uint64_t dataCursor = header.dataOffset;
+
+	// envelopes shared by several tables (e.g. shifted tables) are stored once
+	using Block = std::pair<const void*, size_t>;
+	std::vector<Block>		  blocks;
+	std::map<Block, uint64_t> blockOffsets;
+
+	// returns the file offset of the block
+	auto addBlock = [&blocks, &blockOffsets, &dataCursor](const void * data, size_t size)
+	{
+		auto block = blockOffsets.emplace(Block(data, size), dataCursor);
+		if (block.second)
+		{
+			blocks.push_back(Block(data, size));
+			dataCursor = align(dataCursor + size);
+		}
+		return block.first->second;
+	};
+
+	for (size_t t = 0; t < tableList.size(); t++)
+	{
+		auto table		 = tableList[t];
+		auto cqtTable	 = dynamic_cast<const CQTTable*>(table);
+		auto &record	 = tableRecords[t];
+		auto &origin	 = originList[t];
+		auto config		 = table->getConfig();
+
+		record.midiNote			= table->getMidiNote();
+		record.type				= static_cast<uint32_t>(cqtTable ? TableType::CQT : TableType::Harmonic);
+		record.sampleRate		= config.sampleRate;
+		record.hopSize			= config.hopSize;
+		record.binsPerSemitone	= cqtTable ? cqtTable->getBinsPerSemitone() : 0;
+		record.numBins			= table->getBins().size();
+		record.binsOffset		= header.headerSize + binRecordsOffset + binCursor * sizeof(BinRecord);
+		record.originType		= static_cast<uint32_t>(origin.type);
+		record.originLower		= origin.lower;
+		record.originUpper		= origin.upper;
+		record.sourceFile		= origin.sourceFile;
+
+		auto &regions = table->getRegions();
+		record.loopStart		= regions.loopStart;
+		record.loopEnd			= regions.loopEnd;
+		record.releaseStart		= regions.releaseStart;
+		record.regionFlags		= regions.trimmed ? 1 : 0;
+		record.reserved			= 0;
+
+		// tables are ranked when they are prepared, the statistics are loaded instead of computed again
+		auto &bins	  = table->getBins();
+		auto &stats	  = table->getBinStats();
+		auto &ranking = table->getBinRanking();
+		bool  ranked  = table->hasBinStats();
+
+		std::vector<uint32_t> ranks(bins.size(), 0);
+		for (uint32_t r = 0; ranked && r < ranking.size(); r++) ranks[ranking[r]] = r;
+
+		for (size_t b = 0; b < bins.size(); b++)
+		{
+			const auto &bin = bins[b];
+			auto &binRecord = binRecords[binCursor++];
+			binRecord.frequency		 = bin.frequency;
+			binRecord.length		 = bin.envelope.size();
+			binRecord.encoding		 = static_cast<uint32_t>(bin.envelope.getEncoding());
+			binRecord.scale			 = bin.envelope.getScale();
+			binRecord.byteSize		 = bin.envelope.rawSize();
+			binRecord.rank			 = ranked ? ranks[b] : uint32_t(b);
+			binRecord.peak			 = ranked ? stats[b].peak : -1;	// -1: no statistics, computed when loading
+			binRecord.rms			 = ranked ? stats[b].rms : 0;
+			binRecord.energy		 = ranked ? stats[b].energy : 0;
+			binRecord.trackLength	 = bin.track.size();
+			binRecord.trackOffset	 = bin.track.empty() ? 0 : addBlock(bin.track.rawData(), bin.track.rawSize());
+			binRecord.bandwidth		 = bin.bandwidth;
+
+			if (bin.envelope.getEncoding() == Envelope::Encoding::LowRank)
+			{
+				// the factors are shared by the bins of the table, the column tells the bin apart
+				auto column = bin.envelope.getLowRankColumn();
+				auto activationsSize = size_t(column->numFrames) * column->rank * sizeof(float);
+
+				binRecord.envelopeOffset  = addBlock(column->activations, activationsSize);
+				binRecord.byteSize		  = activationsSize;
+				binRecord.templatesOffset = addBlock(column->templates, size_t(column->rank) * column->stride * sizeof(float));
+				binRecord.factorRank	  = column->rank;
+				binRecord.factorStride	  = column->stride;
+				binRecord.factorColumn	  = column->column;
+				binRecord.factorFrames	  = column->numFrames;
+			}
+			else
+			{
+				binRecord.envelopeOffset  = addBlock(bin.envelope.rawData(), bin.envelope.rawSize());
+				binRecord.templatesOffset = 0;
+				binRecord.factorRank	  = 0;
+				binRecord.factorStride	  = 0;
+				binRecord.factorColumn	  = 0;
+				binRecord.factorFrames	  = 0;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < content.sources.size(); i++)
+	{
+		auto &record = sourceRecords[i];
+		const auto &source = content.sources[i];
+		record.size				= source.size;
+		record.modificationTime = source.modificationTime;
+		record.hash				= source.hash;
+		record.pathOffset		= pathOffsets[i];
+		record.pathLength		= source.path.size();
+	}
+
+	header.dataSize		 = dataCursor - header.dataOffset;
+	header.indexChecksum = Hash::fnv1a(index.data(), index.size());
+	header.dataChecksum  = Hash::FNVOffset;
+
+	// #################### write ####################
+
+	// write to a temporary file, the cache file might still be mapped by this or another process
+	auto tempFilename = filename + ".tmp";
+
+	{
+		std::ofstream outfile(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!outfile.good()) throw std::runtime_error("Can't open cache file " + tempFilename);
+
+		static const char padding[Alignment] = { 0 };
+
+		outfile.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		outfile.write(index.data(), index.size());
+		outfile.write(padding, header.dataOffset - (header.headerSize + header.indexSize));
+
+		uint64_t position = header.dataOffset;
+		for (auto block : blocks)
+		{
+			auto bytes		= block.second;
+			auto padBytes	= align(position + bytes) - (position + bytes);
+
+			outfile.write(reinterpret_cast<const char*>(block.first), bytes);
+			outfile.write(padding, padBytes);
+
+			header.dataChecksum = Hash::fnv1a(block.first, bytes, header.dataChecksum);
+			header.dataChecksum = Hash::fnv1a(padding, padBytes, header.dataChecksum);
+			position += bytes + padBytes;
+		}
+
+		// write the final header, containing the data checksum
+		outfile.seekp(0);
+		outfile.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+		outfile.flush();
+		if (!outfile.good())
+		{
+			outfile.close();
+			std::remove(tempFilename.c_str());
+			throw std::runtime_error("Failed writing cache file " + tempFilename);
+		}
+	}
+
+	if (!FilePath::replaceFile(tempFilename, filename))
+	{
+		std::remove(tempFilename.c_str());
+		throw std::runtime_error("Can't replace cache file " + filename);
+	}
+}
+
+void TableCache::load(const std::string & filename, Content & content, bool verifyData)
+{
+	auto file = std::make_shared<MappedFile>(filename);
+	if (!file->isValid()) throw std::runtime_error("Can't map cache file " + filename);
+
+	auto data = file->data();
+	auto size = file->size();
+
+	// #################### header ####################
+
+	if (size < sizeof(Header)) throw std::runtime_error("Cache file too small");
+
+	auto header = reinterpret_cast<const Header*>(data);
+
+	if (std::memcmp(header->magic, Magic, sizeof(Magic)) != 0) throw std::runtime_error("Not a cache file");
+	if (header->endianTag != EndianTag)							throw std::runtime_error("Cache file was written with a different byte order");
+	if (header->version != Version)								throw std::runtime_error("Unsupported cache file version");
+	if (header->headerSize < sizeof(Header))					throw std::runtime_error("Invalid cache header");
+
+	bool indexInRange = (header->headerSize + header->indexSize <= size);
+	bool dataInRange  = (header->dataOffset + header->dataSize <= size);
+	if (!indexInRange || !dataInRange)							throw std::runtime_error("Cache file is truncated");
+
+	if (Hash::fnv1a(data + header->headerSize, header->indexSize) != header->indexChecksum)
+	{
+		throw std::runtime_error("Cache index checksum mismatch");
+	}
+
+	if (verifyData && Hash::fnv1a(data + header->dataOffset, header->dataSize) != header->dataChecksum)
+	{
+		throw std::runtime_error("Cache data checksum mismatch");
+	}
+
+	// #################### index ####################
+
+	auto index		= data + header->headerSize;
+	auto indexEnd	= header->headerSize + header->indexSize;
+
+	uint64_t tableRecordsSize	= uint64_t(header->numTables)  * sizeof(TableRecord);
+	uint64_t sourceRecordsSize	= uint64_t(header->numSources) * sizeof(SourceRecord);
+	uint64_t stringsOffset		= header->indexSize - header->stringsSize;
+	uint64_t sourceRecordsOffset = stringsOffset - sourceRecordsSize;
+
+	bool validIndex = (header->stringsSize <= header->indexSize)
+				   && (sourceRecordsSize <= stringsOffset)
+				   && (tableRecordsSize <= sourceRecordsOffset)
+				   && (uint64_t(header->rootFileLength) + header->optionsLength <= header->stringsSize);
+	if (!validIndex) throw std::runtime_error("Invalid cache index");
+
+	auto tableRecords	= reinterpret_cast<const TableRecord*>(index);
+	auto sourceRecords	= reinterpret_cast<const SourceRecord*>(index + sourceRecordsOffset);
+	auto strings		= index + stringsOffset;
+
+	Content newContent;
+	newContent.rootFile = std::string(strings, header->rootFileLength);
+	newContent.options  = std::string(strings + header->rootFileLength, header->optionsLength);
+
+	for (uint32_t i = 0; i < header->numSources; i++)
+	{
+		const auto & record = sourceRecords[i];
+		if (uint64_t(record.pathOffset) + record.pathLength > header->stringsSize) throw std::runtime_error("Invalid source record in cache");
+
+		SourceFile source;
+		source.path				= std::string(strings + record.pathOffset, record.pathLength);
+		source.size				= record.size;
+		source.modificationTime = record.modificationTime;
+		source.hash				= record.hash;
+		newContent.sources.push_back(source);
+	}
+
+	// #################### tables ####################
+
+	for (uint32_t t = 0; t < header->numTables; t++)
+	{
+		const auto & record = tableRecords[t];
+
+		bool binsInRange = (record.binsOffset >= header->headerSize) && (record.binsOffset + record.numBins * sizeof(BinRecord) <= indexEnd);
+		if (record.midiNote >= newContent.tables.size() || !binsInRange) throw std::runtime_error("Invalid table record in cache");
+
+		ATable * table = nullptr;
+		if (record.type == static_cast<uint32_t>(TableType::CQT))
+		{
+			auto cqtTable = new CQTTable();
+			cqtTable->setBinsPerSemitone(record.binsPerSemitone);
+			table = cqtTable;
+		}
+		else if (record.type == static_cast<uint32_t>(TableType::Harmonic))
+		{
+			table = new HarmonicTable();
+		}
+		else
+		{
+			throw std::runtime_error("Unknown table type in cache");
+		}
+		newContent.tables[record.midiNote] = std::shared_ptr<ATable>(table);
+
+		auto &origin = newContent.origins[record.midiNote];
+		origin.type			= static_cast<TableOrigin::Type>(record.originType);
+		origin.lower		= record.originLower;
+		origin.upper		= record.originUpper;
+		origin.sourceFile	= (record.sourceFile < static_cast<int>(newContent.sources.size())) ? record.sourceFile : -1;
+
+		ATable::Config config;
+		config.sampleRate	= record.sampleRate;
+		config.hopSize		= record.hopSize;
+
+		auto binRecords = reinterpret_cast<const BinRecord*>(data + record.binsOffset);
+
+		std::vector<ATable::Bin>	   bins(record.numBins);
+		std::vector<ATable::BinStats> stats(record.numBins);
+		std::vector<uint32_t>		   ranking(record.numBins, 0);
+		bool ranked = true;
+
+		for (uint32_t b = 0; b < record.numBins; b++)
+		{
+			const auto & binRecord = binRecords[b];
+
+			if (binRecord.rank >= record.numBins) throw std::runtime_error("Invalid bin record in cache");
+			ranking[binRecord.rank] = b;
+			stats[b].peak	= binRecord.peak;
+			stats[b].rms	= binRecord.rms;
+			stats[b].energy = binRecord.energy;
+			ranked &= (binRecord.peak >= 0);
+
+			if (binRecord.encoding >= EnvelopeCodec::NumEncodings) throw std::runtime_error("Unknown envelope encoding in cache");
+			auto encoding = static_cast<Envelope::Encoding>(binRecord.encoding);
+
+			bool envelopeInRange = (binRecord.envelopeOffset >= header->dataOffset)
+								&& (binRecord.envelopeOffset + binRecord.byteSize <= header->dataOffset + header->dataSize);
+			bool envelopeAligned = (binRecord.envelopeOffset % Alignment) == 0;
+			if (!envelopeInRange || !envelopeAligned) throw std::runtime_error("Invalid bin record in cache");
+
+			auto envelopeData = data + binRecord.envelopeOffset;
+			bins[b].frequency = binRecord.frequency;
+			bins[b].bandwidth = binRecord.bandwidth;
+			if (!(binRecord.bandwidth >= 0 && binRecord.bandwidth < 16)) throw std::runtime_error("Invalid bin record in cache");
+
+			if (encoding == Envelope::Encoding::LowRank)
+			{
+				EnvelopeCodec::LowRankColumn column;
+				column.activations = reinterpret_cast<const float*>(envelopeData);
+				column.templates   = reinterpret_cast<const float*>(data + binRecord.templatesOffset);
+				column.rank		   = binRecord.factorRank;
+				column.stride	   = binRecord.factorStride;
+				column.column	   = binRecord.factorColumn;
+				column.numFrames   = binRecord.factorFrames;
+
+				uint64_t templatesSize = uint64_t(column.rank) * column.stride * sizeof(float);
+				bool templatesInRange  = (binRecord.templatesOffset >= header->dataOffset)
+									  && (binRecord.templatesOffset + templatesSize <= header->dataOffset + header->dataSize);
+				bool validFactors	   = (binRecord.byteSize == uint64_t(column.numFrames) * column.rank * sizeof(float))
+									  && templatesInRange && (binRecord.templatesOffset % Alignment) == 0;
+
+				if (!validFactors || !EnvelopeCodec::isValid(encoding, &column, sizeof(column), binRecord.length)) throw std::runtime_error("Invalid envelope in cache");
+
+				// the factors reference the mapped file
+				bins[b].envelope = Envelope::lowRank(file, column, binRecord.length, true);
+			}
+			else
+			{
+				if (!EnvelopeCodec::isValid(encoding, envelopeData, binRecord.byteSize, binRecord.length)) throw std::runtime_error("Invalid envelope in cache");
+
+				// the envelope references the mapped file and keeps it alive
+				bins[b].envelope = Envelope(file, envelopeData, binRecord.length, encoding, binRecord.scale, binRecord.byteSize, true);
+			}
+
+			if (binRecord.trackLength > 0)
+			{
+				uint64_t trackSize = uint64_t(binRecord.trackLength) * sizeof(float);
+				bool trackInRange = (binRecord.trackOffset >= header->dataOffset)
+								 && (binRecord.trackOffset + trackSize <= header->dataOffset + header->dataSize);
+				if (!trackInRange || (binRecord.trackOffset % Alignment) != 0) throw std::runtime_error("Invalid bin record in cache");
+
+				bins[b].track = Envelope(file, data + binRecord.trackOffset, binRecord.trackLength, Envelope::Encoding::Float32, 1, trackSize, true);
+			}
+		}
+
+		table->setConfig(config);
+		table->setMidiNote(record.midiNote);
+		table->setBins(std::move(bins));
+
+		if (!ranked)												 table->updateBinStats();
+		else if (!table->setBinStats(std::move(stats), std::move(ranking))) throw std::runtime_error("Invalid bin statistics in cache");
+		table->refreshActiveBins();
+
+		ATable::Regions regions;
+		regions.loopStart	 = record.loopStart;
+		regions.loopEnd		 = record.loopEnd;
+		regions.releaseStart = record.releaseStart;
+		regions.trimmed		 = (record.regionFlags & 1) != 0;
+		table->setRegions(regions);
+	}
+
+	content = std::move(newContent);
+}
+
+uint64_t TableCache::align(uint64_t offset)
+{
+	return (offset + Alignment - 1) / Alignment * Alignment;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "ATable.h"
+#include "TableSource.h"
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+/*
+	TableCache reads and writes binary cache files (.table). The file is memory mapped when loaded and
+	envelopes reference the mapped data directly, nothing is deserialized or copied. Since the mapping is
+	shared and read-only, processes loading the same cache share its pages.
+
+	Layout (native byte order):
+		Header		fixed size, see struct Header
+		Index		one TableRecord per table, the BinRecords of all tables (including the loudness statistics of
+					every bin), one SourceRecord per source file and a blob with all strings (root file, options,
+					source paths)
+		Data		one block per envelope in the envelope's encoding (see EnvelopeCodec) and per frequency track,
+					every block starts at a 64 byte boundary. Envelopes shared by several tables are stored once,
+					their bin records reference the same block. LowRank envelopes reference the blocks of their
+					factors, the activations and the templates of the table
+
+	The index checksum is verified on every load. Verifying the data checksum touches every page of the
+	file and is only done when requested.
+*/
+class TableCache
+{
+public:
+	using TableArray  = std::array<std::shared_ptr<ATable>, 128>;
+	using OriginArray = std::array<TableOrigin, 128>;
+
+	struct Content
+	{
+		TableArray				tables;
+		OriginArray				origins;
+		std::vector<SourceFile> sources;	// source files, referenced by TableOrigin::sourceFile
+		std::string				rootFile;	// text file the tables were imported from
+		std::string				options;	// settings the prepared tables depend on
+	};
+
+	static const uint32_t Version	= 9;
+	static const size_t   Alignment = 64;
+
+	// returns true if the file starts with the cache file magic (caches of older versions are cereal archives)
+	static bool isCacheFile(const std::string &filename);
+
+	// both functions throw std::runtime_error on failure, 'content' is left untouched when loading fails
+	// the file is written to a temporary file first and renamed afterwards, a mapped cache file can be replaced that way
+	static void store(const std::string &filename, const Content &content);
+	static void load(const std::string &filename, Content &content, bool verifyData = false);
+
+private:
+
+	enum class TableType : uint32_t
+	{
+		CQT			= 1,
+		Harmonic	= 2
+	};
+
+	struct Header
+	{
+		char	 magic[8];			// "KLANGTBL"
+		uint32_t version;
+		uint32_t endianTag;			// EndianTag in the byte order of the writing machine
+		uint32_t numTables;
+		uint32_t headerSize;		// the index starts right after the header
+		uint32_t numSources;
+		uint32_t stringsSize;		// size of the string blob at the end of the index
+		uint32_t rootFileLength;	// first string in the blob
+		uint32_t optionsLength;		// second string in the blob
+		uint64_t indexSize;
+		uint64_t dataOffset;
+		uint64_t dataSize;
+		uint64_t indexChecksum;		// FNV-1a over the index
+		uint64_t dataChecksum;		// FNV-1a over the data section, including padding
+	};
+
+	struct TableRecord
+	{
+		uint32_t midiNote;
+		uint32_t type;				// TableType
+		float	 sampleRate;
+		float	 hopSize;
+		uint32_t binsPerSemitone;	// CQT tables only
+		uint32_t numBins;
+		uint64_t binsOffset;		// file offset of the first BinRecord of this table
+		uint32_t originType;		// TableOrigin::Type
+		int32_t  originLower;
+		int32_t  originUpper;
+		int32_t  sourceFile;
+		int32_t  loopStart;			// ATable::Regions, -1 if not set
+		int32_t  loopEnd;
+		int32_t  releaseStart;
+		uint32_t regionFlags;		// bit 0: trimmed
+		uint64_t reserved;
+	};
+
+	struct BinRecord
+	{
+		float	 frequency;
+		uint32_t length;			// number of envelope frames
+		uint64_t envelopeOffset;	// file offset of the envelope (the activations of LowRank envelopes), aligned to Alignment
+		uint32_t encoding;			// EnvelopeCodec::Encoding
+		float	 scale;				// scale of encoded envelopes
+		uint32_t byteSize;			// size of the envelope data
+		uint32_t rank;				// position in the loudness ranking of the table, see ATable::updateBinStats()
+		float	 peak;				// ATable::BinStats
+		float	 rms;
+		float	 energy;
+		uint32_t trackLength;		// frames of the frequency track (ATable::Bin::track), 0 if there is none
+		uint64_t trackOffset;		// file offset of the track, float32, aligned to Alignment
+		uint64_t templatesOffset;	// LowRank envelopes only (EnvelopeCodec::LowRankColumn), file offset of the templates
+		uint32_t factorRank;
+		uint32_t factorStride;
+		uint32_t factorColumn;
+		uint32_t factorFrames;		// frames of the activations
+		float	 bandwidth;			// octaves of noise bands (ATable::Bin::bandwidth), 0 for sines
+	};
+
+	struct SourceRecord
+	{
+		uint64_t size;
+		int64_t  modificationTime;
+		uint64_t hash;
+		uint32_t pathOffset;		// offset in the string blob
+		uint32_t pathLength;
+	};
+
+	static const uint32_t EndianTag = 0x01020304;
+	static const char	  Magic[8];
+
+	static uint64_t align(uint64_t offset);
+};
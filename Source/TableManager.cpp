@@ -1,4 +1,5 @@
 #include "TableManager.h"
+#include "TableCache.h"
 #include <memory>
 #include <fstream>
 #include <regex>
@@ -6,8 +7,15 @@
 #include <array>
 #include <atomic>
 #include <thread>
+#include <future>
+#include <cmath>
+#include <set>
 
 #include "Util/FilePath.h"
+#include "Util/FileStream.h"
+#include "Util/FileBatchReader.h"
+#include "Util/ThreadPool.h"
+#include "Util/Hash.h"
 
 #include "cereal/archives/binary.hpp"
 #include "cereal/types/array.hpp"
@@ -25,62 +33,530 @@ TableManager::TableManager(bool debugMode) : debugMode(debugMode)
 
 void TableManager::storeBinaryCache(std::string filename)
 {
-	std::ofstream outfile(filename, std::ios::binary);
-	cereal::BinaryOutputArchive archive(outfile);
-	this->serialize(archive);
+	TableCache::store(filename, createCacheContent(filename));
+}
+
+std::future<bool> TableManager::storeBinaryCacheAsync(std::string filename)
+{
+	// the snapshot only shares the tables, their bins aren't modified after preparation
+	auto content = std::make_shared<TableCache::Content>(createCacheContent(filename));
+	bool debugMode = this->debugMode;
+
+	return std::async(std::launch::async, [content, filename, debugMode]() -> bool
+	{
+		try
+		{
+			TableCache::store(filename, *content);
+			if (debugMode) std::printf("Cache file %s written\n", filename.c_str());
+			return true;
+		}
+		catch (const std::exception & e)
+		{
+			std::cout << "Error caching file: " << e.what() << std::endl;
+			return false;
+		}
+	});
+}
+
+TableCache::Content TableManager::createCacheContent(const std::string & filename) const
+{
+	// paths are stored relative to the cache file, so the bank can be moved as a whole
+	auto cachePath = FilePath::getPathOfFile(FilePath::makeAbsolute(filename));
+
+	TableCache::Content content;
+	content.tables	 = tables;
+	content.origins	 = origins;
+	content.sources	 = sources;
+	content.rootFile = FilePath::makeRelative(rootFile, cachePath);
+	content.options	 = getCacheOptions();
+
+	for (auto & source : content.sources) source.path = FilePath::makeRelative(source.path, cachePath);
+	return content;
 }
 
 void TableManager::loadBinaryCache(std::string filename)
 {
+	if (TableCache::isCacheFile(filename))
+	{
+		// the data checksum is only verified in debug mode, it requires reading the whole file
+		TableCache::Content content;
+		loadCacheContent(filename, content, debugMode);
+
+		tables		 = content.tables;
+		origins		 = content.origins;
+		sources		 = content.sources;
+		rootFile	 = content.rootFile;
+		cacheOptions = content.options;
+
+		for (auto & table : tables) if (table != nullptr) table->setFrameMatrix(frameMatrix);
+		return;
+	}
+
+	// caches written by older versions are cereal archives, they don't know about the sources of the tables
 	std::ifstream infile(filename, std::ios::binary);
 	cereal::BinaryInputArchive archive(infile);
 	this->serialize(archive);
+
+	sources.clear();
+	rootFile.clear();
+	cacheOptions.clear();
+	for (unsigned int i = 0; i < tables.size(); i++)
+	{
+		origins[i] = TableOrigin();
+		if (tables[i] != nullptr) origins[i].type = TableOrigin::Type::Source;
+	}
 }
 
-bool TableManager::importTextFile(std::string filename, bool useMT)
+bool TableManager::isCacheStale() const
 {
+	// caches without source information can't be checked
+	if (rootFile.empty()) return false;
 
-	auto fileType = getFileTypeFromFile(filename);
+	if (cacheOptions != getCacheOptions()) return true;
 
-	if (fileType == FileType::CQTTable)
+	for (const auto & source : sources)
 	{
-		
-		if(debugMode) std::printf("Importing CQT Table %s \n", filename.c_str());
-		// include file, done
-		bool res = importTableFile(createCQTTableFromFile(filename));
+		SourceFile current;
+		if (!FilePath::getFileInfo(source.path, current.size, current.modificationTime)) return true;
+		if (!source.sameStat(current)) return true;
+	}
+	return false;
+}
+
+std::string TableManager::getRootFile() const
+{
+	return rootFile;
+}
+
+void TableManager::setEncoding(Envelope::Encoding encoding)
+{
+	this->encoding = encoding;
+}
+
+void TableManager::setBreakpointTolerance(float tolerance)
+{
+	breakpointTolerance = tolerance;
+}
+
+void TableManager::setLoopDetection(bool enabled)
+{
+	loopDetection = enabled;
+}
+
+void TableManager::setLazyPreparation(bool enabled, unsigned int maxPreparedTables)
+{
+	lazyPreparation			= enabled;
+	this->maxPreparedTables = std::max(1u, maxPreparedTables);
+
+	if (enabled && preparationThread == nullptr) preparationThread = std::unique_ptr<ThreadPool>(new ThreadPool(1));
+}
+
+void TableManager::setBlendPlayback(bool enabled)
+{
+	blendPlayback = enabled;
+}
+
+void TableManager::setArena(bool enabled, Arena::Pages pages)
+{
+	// envelopes placed in the previous arena keep its blocks alive
+	arena = enabled ? std::unique_ptr<Arena>(new Arena(pages)) : nullptr;
+}
+
+void TableManager::setFrameMatrix(bool enabled)
+{
+	frameMatrix = enabled;
+}
+
+void TableManager::setPartialMerging(bool enabled)
+{
+	partialMerging = enabled;
+}
+
+void TableManager::setNoiseBands(float minFrequency, unsigned int bandsPerOctave)
+{
+	noiseMinFrequency	= std::max(0.f, minFrequency);
+	noiseBandsPerOctave = std::max(1u, bandsPerOctave);
+}
+
+void TableManager::setMaskPruning(bool enabled, float offset)
+{
+	maskPruning	  = enabled;
+	maskingOffset = offset;
+}
+
+void TableManager::setSparseFloor(float decibels)
+{
+	sparseFloor = std::pow(10.f, decibels / 20.f);
+}
+
+void TableManager::setModalFit(float decibels)
+{
+	modalTolerance = (decibels < 0) ? std::pow(10.f, decibels / 20.f) : 0;
+}
 
-		if (debugMode) std::printf("Finished importing %s \n", filename.c_str());
-		return res;
+void TableManager::setLowRank(float decibels)
+{
+	lowRankTolerance = (decibels < 0) ? std::pow(10.f, decibels / 20.f) : 0;
+}
+
+void TableManager::setMemoryBudget(uint64_t bytes)
+{
+	// dropped tables are prepared again by the lazy preparation
+	if (bytes > 0 && !lazyPreparation) setLazyPreparation(true, tables.size());
+
+	std::lock_guard<std::mutex> lock(importMutex);
+	memoryBudget = bytes;
+	if (lazyPreparation) evictPreparedTables();
+}
+
+TableManager::MemoryUsage TableManager::getMemoryUsage() const
+{
+	std::lock_guard<std::mutex> lock(importMutex);
+	return computeMemoryUsage();
+}
+
+void TableManager::printMemoryUsage() const
+{
+	auto usage = getMemoryUsage();
+	const double MB = 1024. * 1024.;
+
+	std::printf("Note  Origin        Envelopes (MB)  Own (MB)  Inactive (MB)  Matrix (MB)\n");
+	for (unsigned int i = 0; i < usage.notes.size(); i++)
+	{
+		auto const & note = usage.notes[i];
+		if (note.type == TableOrigin::Type::None) continue;
+
+		const char * type = (note.type == TableOrigin::Type::Source) ? "source" : (note.type == TableOrigin::Type::Shifted) ? "shifted" : "interpolated";
+		std::printf("%4u  %-12s  %14.2f  %8.2f  %13.2f  %11.2f\n", i, type,
+			note.envelopeBytes / MB, note.ownBytes / MB, note.inactiveBytes / MB, note.matrixBytes / MB);
+	}
+
+	std::printf("Sources %.2f MB, interpolated %.2f MB, shifted %.2f MB, inactive bins %.2f MB, matrices %.2f MB, bins %.2f MB\n",
+		usage.sourceBytes / MB, usage.interpolatedBytes / MB, usage.shiftedBytes / MB, usage.inactiveBytes / MB, usage.matrixBytes / MB, usage.binBytes / MB);
+	if (usage.headBytes > 0) std::printf("Heads of streamed tables %.2f MB, the envelopes are read while playing\n", usage.headBytes / MB);
+	std::printf("Total %.2f MB", usage.totalBytes / MB);
+	if (memoryBudget > 0) std::printf(", budget %.2f MB", memoryBudget / MB);
+	std::printf("\n");
+}
+
+void TableManager::printEncodingReport() const
+{
+	// errors are only measured for frames within ReportRange dB below the peak of their envelope,
+	// the encodings cover different ranges and anything quieter isn't audible next to the peak
+	const float ReportRange = 60;
+
+	std::printf("%-10s %12s %8s %14s %14s\n", "Encoding", "Memory (MB)", "Ratio", "Max Error (dB)", "Mean Error (dB)");
+
+	uint64_t floatBytes = 0;
+	for (auto const & table : tables)
+	{
+		if (table == nullptr) continue;
+		for (auto const & bin : table->getBins()) floatBytes += bin.envelope.size() * sizeof(float);
 	}
-	if (fileType == FileType::HarmonicTable)
+
+	for (unsigned int e = 0; e < EnvelopeCodec::NumEncodings; e++)
 	{
-		
-		if (debugMode) std::printf("Importing Harmonic Table %s \n", filename.c_str());
-		// include file, done
-		bool res = importTableFile(createHarmonicTableFromFile(filename));
+		auto encoding = static_cast<Envelope::Encoding>(e);
+
+		uint64_t bytes		= 0;
+		uint64_t numFrames	= 0;
+		double	 errorSum	= 0;
+		float	 maxError	= 0;
+
+		for (auto const & table : tables)
+		{
+			if (table == nullptr) continue;
+
+			for (auto const & bin : table->getBins())
+			{
+				auto original = bin.envelope.toVector();
+				auto encoded  = Envelope(original).encode(encoding, breakpointTolerance);
+				auto decoded  = encoded.toVector();
+				bytes += encoded.rawSize();
+
+				float floor = bin.envelope.peak() * std::pow(10.f, -ReportRange / 20.f);
+				for (unsigned int i = 0; i < original.size(); i++)
+				{
+					if (original[i] <= 0 || original[i] < floor) continue;
 
-		if (debugMode) std::printf("Finished importing %s \n", filename.c_str());
-		return res;
+					// frames decoded as silence count as the full range
+					float error = (decoded[i] > 0) ? std::abs(20.f * std::log10(decoded[i] / original[i])) : ReportRange;
+					maxError  = std::max(maxError, error);
+					errorSum += error;
+					numFrames++;
+				}
+			}
+		}
+
+		double ratio = (bytes > 0) ? double(floatBytes) / bytes : 0;
+		double mean	 = (numFrames > 0) ? errorSum / numFrames : 0;
+		std::printf("%-10s %12.2f %8.2f %14.3f %14.3f\n", EnvelopeCodec::getName(encoding), bytes / (1024. * 1024.), ratio, maxError, mean);
+	}
+}
+
+std::string TableManager::getCacheOptions() const
+{
+	// everything the tables depend on, cached tables are only reused when this matches
+	auto options = std::string("interpolation=1;encoding=") + EnvelopeCodec::getName(encoding) + ";";
+	if (encoding == Envelope::Encoding::Breakpoint) options += "tolerance=" + std::to_string(breakpointTolerance) + ";";
+	if (loopDetection) options += "loops=1;";
+	if (blendPlayback) options += "blend=1;";
+	if (sparseFloor > 0) options += "sparse=" + std::to_string(sparseFloor) + ";";
+	if (partialMerging)	 options += "partials=1;";
+	if (maskPruning) options += "mask=" + std::to_string(maskingOffset) + ";";
+	if (noiseMinFrequency > 0) options += "noise=" + std::to_string(noiseMinFrequency) + "/" + std::to_string(noiseBandsPerOctave) + ";";
+	if (modalTolerance > 0)	  options += "modal=" + std::to_string(modalTolerance) + ";";
+	if (lowRankTolerance > 0) options += "lowrank=" + std::to_string(lowRankTolerance) + ";";
+	if (binCompaction && activeBinLimit > 0) options += "active=" + std::to_string(activeBinLimit) + ";";
+	return options;
+}
+
+bool TableManager::importTextFileCached(std::string filename, std::string cacheFile, bool useMT)
+{
+	TableCache::Content cache;
+	bool cacheAvailable = false;
+
+	if (TableCache::isCacheFile(cacheFile))
+	{
+		try
+		{
+			loadCacheContent(cacheFile, cache, false);
+
+			// a cache written with other options is of no use, e.g. its envelopes are encoded differently
+			cacheAvailable = (cache.options == getCacheOptions());
+		}
+		catch (const std::exception &e)
+		{
+			std::cout << "Cache " << cacheFile << " can't be used: " << e.what() << std::endl;
+		}
+	}
+
+	CacheReuse reuse;
+	reuse.cache = &cache;
+	for (unsigned int i = 0; i < cache.sources.size(); i++)
+	{
+		reuse.sourceIndex[cache.sources[i].path] = i;
 	}
-	else if (fileType == FileType::IncludeFile)
+	for (unsigned int i = 0; i < cache.origins.size(); i++)
 	{
-		if (debugMode) std::printf("Importing Include File %s, \n", filename.c_str());
-		return importIncludeFile(filename, useMT);
+		auto &origin = cache.origins[i];
+		if (origin.type == TableOrigin::Type::Source && origin.sourceFile >= 0) reuse.noteOfSource[origin.sourceFile] = i;
 	}
 
-	return false;
+	// start from scratch, tables of unchanged sources are taken over from the cache while importing
+	tables	= TableCache::TableArray();
+	origins = TableCache::OriginArray();
+	sources.clear();
+	rootFile = FilePath::makeAbsolute(filename);
+	cacheOptions = getCacheOptions();
+
+	if (!importFiles(filename, useMT, cacheAvailable ? &reuse : nullptr)) return false;
+
+	// take over prepared tables whose source tables were reused unchanged
+	int reusedTables = 0;
+	if (cacheAvailable)
+	{
+		auto sourceReused = [&](int note) -> bool
+		{
+			if (note < 0 || note >= static_cast<int>(tables.size())) return false;
+			return (origins[note].type == TableOrigin::Type::Source) && (tables[note] != nullptr) && (tables[note] == cache.tables[note]);
+		};
+
+		for (unsigned int i = 0; i < tables.size(); i++)
+		{
+			const auto & origin = cache.origins[i];
+			if (tables[i] != nullptr || cache.tables[i] == nullptr) continue;
+
+			bool reusable = false;
+			if (origin.type == TableOrigin::Type::Interpolated) reusable = sourceReused(origin.lower) && sourceReused(origin.upper);
+			if (origin.type == TableOrigin::Type::Shifted)		reusable = sourceReused(origin.lower);
+
+			if (reusable)
+			{
+				tables[i]  = cache.tables[i];
+				origins[i] = origin;
+				reusedTables++;
+			}
+		}
+	}
+
+	if (debugMode) std::printf("Reused %d prepared tables from cache\n", reusedTables);
+
+	// prepares only notes that weren't taken over from the cache
+	return prepareTablesAutoRange();
+}
+
+void TableManager::loadCacheContent(const std::string & filename, TableCache::Content & content, bool verifyData)
+{
+	TableCache::load(filename, content, verifyData);
+
+	auto cachePath = FilePath::getPathOfFile(FilePath::makeAbsolute(filename));
+	if (!content.rootFile.empty()) content.rootFile = FilePath::makeAbsolute(content.rootFile, cachePath);
+	for (auto & source : content.sources) source.path = FilePath::makeAbsolute(source.path, cachePath);
+}
+
+bool TableManager::importTextFile(std::string filename, bool useMT)
+{
+	if (rootFile.empty()) rootFile = FilePath::makeAbsolute(filename);
+	return importFiles(filename, useMT, nullptr);
+}
+
+bool TableManager::importFiles(std::string filename, bool useMT, const CacheReuse * reuse)
+{
+	// every file of the include tree is read exactly once. All reads are queued at once,
+	// parsing starts as soon as a buffer arrives (on the parser pool when multi threading is used)
+	FileBatchReader reader(useMT ? NumIOThreads : 1);
+	ThreadPool		parsers(useMT ? ThreadPool::defaultSize() : 0);
+
+	std::vector<std::future<bool>> parseResults;
+	std::future<bool>			   rootParseResult;
+
+	bool success	  = true;
+	bool isRoot		  = true;
+	int  failedFiles  = 0;
+	int  reusedFiles  = 0;
+
+	reader.submit(filename);
+
+	FileBatchReader::Result file;
+	while (reader.next(file))
+	{
+		bool fileIsRoot = isRoot;
+		isRoot = false;
+
+		std::shared_ptr<std::istream> stream;
+		if (file.success) stream = FileStream::open(file.data, FileStream::getCompression(file.filename));
+
+		auto fileType = (stream != nullptr) ? getFileTypeFromStream(*stream) : FileType::Invalid;
+
+		// the files are parsed from their first line, the tag might come after some of the variables
+		if (fileType != FileType::Invalid) stream = FileStream::open(file.data, FileStream::getCompression(file.filename));
+
+		if (fileType == FileType::CQTTable || fileType == FileType::HarmonicTable)
+		{
+			if (debugMode)
+			{
+				auto typeName = (fileType == FileType::CQTTable) ? "CQT" : "Harmonic";
+				std::printf("Importing %s Table %s \n", typeName, file.filename.c_str());
+			}
+
+			auto filename = file.filename;
+			auto data	  = file.data;
+			auto parseFunc = [this, stream, fileType, filename, data, reuse]() -> bool
+			{
+				auto source = createSourceFile(filename, *data);
+
+				// the content might be unchanged although the file was touched
+				if (reuse && reuseCachedTable(source, *reuse, true))
+				{
+					if (debugMode) std::printf("Unchanged %s \n", filename.c_str());
+					return true;
+				}
+
+				bool res = importTableStream(*stream, fileType, source);
+				if (debugMode) std::printf("Finished importing %s \n", filename.c_str());
+				return res;
+			};
+
+			if (fileIsRoot) rootParseResult = parsers.enqueue(parseFunc);
+			else			parseResults.push_back(parsers.enqueue(parseFunc));
+		}
+		else if (fileType == FileType::IncludeFile)
+		{
+			if (debugMode) std::printf("Importing Include File %s, \n", file.filename.c_str());
+
+			addSourceFile(createSourceFile(file.filename, *file.data));
+
+			auto includeList = readIncludeList(*stream, file.filename);
+			if (stream->bad())
+			{
+				std::cout << "Could not import " << file.filename << std::endl;
+				if (fileIsRoot) success = false;
+				failedFiles++;
+			}
+
+			for (const auto & include : includeList)
+			{
+				// table files with unchanged size and modification time aren't read at all
+				SourceFile current;
+				current.path = FilePath::makeAbsolute(include);
+				bool statAvailable = FilePath::getFileInfo(include, current.size, current.modificationTime);
+
+				if (reuse && statAvailable && reuseCachedTable(current, *reuse, false))
+				{
+					reusedFiles++;
+					continue;
+				}
+				reader.submit(include);
+			}
+		}
+		else
+		{
+			std::cout << "Could not import " << file.filename << std::endl;
+			if (fileIsRoot) success = false;
+			failedFiles++;
+		}
+	}
+
+	for (auto & res : parseResults)
+	{
+		if (!res.get()) failedFiles++;
+	}
+
+	if (rootParseResult.valid()) success &= rootParseResult.get();
+
+	if (debugMode && reuse)			  std::printf("%d unchanged files taken from cache\n", reusedFiles);
+	if (debugMode && failedFiles > 0) std::printf("%d files failed to import\n", failedFiles);
+
+	return success;
+}
+
+bool TableManager::reuseCachedTable(const SourceFile & current, const CacheReuse & reuse, bool compareHash)
+{
+	auto sourceIt = reuse.sourceIndex.find(current.path);
+	if (sourceIt == reuse.sourceIndex.end()) return false;
+
+	auto noteIt = reuse.noteOfSource.find(sourceIt->second);
+	if (noteIt == reuse.noteOfSource.end()) return false; // not a table file
+
+	const auto & cached = reuse.cache->sources[sourceIt->second];
+	auto note = noteIt->second;
 
+	bool unchanged = compareHash ? ((cached.size == current.size) && (cached.hash == current.hash)) : cached.sameStat(current);
+	if (!unchanged || reuse.cache->tables[note] == nullptr) return false;
+
+	// keep the hash of the cache when only the stat was compared
+	SourceFile source = compareHash ? current : cached;
+
+	std::lock_guard<std::mutex> lock(importMutex);
+	setSourceTable(reuse.cache->tables[note], note, source);
+	return true;
+}
+
+SourceFile TableManager::createSourceFile(const std::string & filename, const std::vector<char>& content)
+{
+	SourceFile source;
+	source.path = FilePath::makeAbsolute(filename);
+	source.size = content.size();
+	source.hash = Hash::fnv1a(content.data(), content.size());
+
+	uint64_t size;
+	FilePath::getFileInfo(filename, size, source.modificationTime);
+	return source;
+}
+
+void TableManager::addSourceFile(const SourceFile & source)
+{
+	std::lock_guard<std::mutex> lock(importMutex);
+	sources.push_back(source);
 }
 
-bool TableManager::importIncludeFile(std::string filename, bool useMT)
+std::vector<std::string> TableManager::readIncludeList(std::istream & infile, const std::string & filename)
 {
 	unsigned int lineCounter = 0;
-	std::ifstream infile(filename);
 
 	auto prependPath = FilePath::getPathOfFile(filename);
 	
-	bool success = true;
-
 	std::vector<std::string> includeList;
 
 	std::string line;
@@ -99,75 +575,80 @@ bool TableManager::importIncludeFile(std::string filename, bool useMT)
 		{
 			auto file = FilePath::clipWhiteSpaces(line);
 			auto fullPath = prependPath + FilePath::delim() + file;
-			includeList.push_back(fullPath);
+			includeList.push_back(FileStream::resolveExisting(fullPath));
 		}
 
 	}
 
+	return includeList;
+}
+
+bool TableManager::importTableStream(std::istream & infile, FileType fileType, const SourceFile & source)
+{
+	if (fileType == FileType::CQTTable)		 return importTableFile(createCQTTableFromStream(infile, source.path), source);
+	if (fileType == FileType::HarmonicTable) return importTableFile(createHarmonicTableFromStream(infile, source.path), source);
+	return false;
+}
+
+bool TableManager::importTableFile(ATable *table, const SourceFile & source)
+{
+	// include file, done
+	if (table == nullptr) return false;
 
-	if (includeList.size() > 0)
+	// get assigned midi note
+	auto midiNote = table->getMidiNote();
+	if (midiNote > 127)
 	{
-		std::vector<bool> returnList(includeList.size(), true);
+		delete table;
+		return false;
+	}
 
-		auto callIncludeFunc = [&](unsigned int idx)
-		{
-			returnList[idx] = importTextFile(includeList[idx], false);
-		};
+	std::lock_guard<std::mutex> lock(importMutex);
 
-		if (useMT)
-		{
-			std::vector<std::thread> threadList;
-			
-			// start threads
-			for (int i = 0; i < includeList.size() - 1; i++) 
-				threadList.push_back(std::thread(callIncludeFunc, i));
+	// insert new table, replaces the currently assigned table if existing
+	setSourceTable(std::shared_ptr<ATable>(table), midiNote, source);
+	return true;
+}
 
-			// do work myself
-			returnList.push_back(true);
-			callIncludeFunc(includeList.size()-1);
+void TableManager::setSourceTable(std::shared_ptr<ATable> table, unsigned int midiNote, const SourceFile & source)
+{
+	tables[midiNote] = table;
 
-			// join all the threads
-			for (int i = 0; i < includeList.size() - 1; i++) 
-				threadList[i].join();
-		}
-		else
+	origins[midiNote] = TableOrigin();
+	origins[midiNote].type		 = TableOrigin::Type::Source;
+	origins[midiNote].sourceFile = sources.size();
+	sources.push_back(source);
+
+	// prepared tables depending on this note are outdated
+	for (unsigned int i = 0; i < origins.size(); i++)
+	{
+		bool prepared  = (origins[i].type == TableOrigin::Type::Interpolated) || (origins[i].type == TableOrigin::Type::Shifted);
+		bool dependent = (origins[i].lower == static_cast<int>(midiNote)) || (origins[i].upper == static_cast<int>(midiNote));
+		if (prepared && dependent)
 		{
-			for (int i = 0; i < includeList.size(); i++) 
-				callIncludeFunc(i);
+			tables[i]  = nullptr;
+			origins[i] = TableOrigin();
 		}
-		
-		bool success = true;
-		 
-		for (int i = 0; i < includeList.size() - 1; i++) 
-			success &= returnList[i];
-
 	}
-	return success;
 }
 
-bool TableManager::importTableFile(ATable *table)
+CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debugMode)
 {
-	// include file, done
-	if (table == nullptr) return false;
+	auto infile = FileStream::open(filename);
+	if (infile == nullptr) return nullptr;
 
-	// get assigned midi note
-	auto midiNote = table->getMidiNote();
-	if (midiNote > 127) return false;
+	if (getFileTypeFromStream(*infile) != FileType::CQTTable) return nullptr;
 
-	// remove currently assigned table, if existing
-	if (tables[midiNote] != nullptr) tables[midiNote] = nullptr;
+	// lines before the tag belong to the table as well
+	infile = FileStream::open(filename);
+	if (infile == nullptr) return nullptr;
 
-	// insert new table
-	tables[midiNote] = std::shared_ptr<ATable>(table);
-	return true;
+	return createCQTTableFromStream(*infile, filename, debugMode);
 }
 
-CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debugMode)
+CQTTable * TableManager::createCQTTableFromStream(std::istream & infile, const std::string & filename, bool debugMode)
 {
-	if (getFileTypeFromFile(filename) != FileType::CQTTable) return nullptr;
-
 	unsigned int lineCounter = 0;
-	std::ifstream infile(filename);
 
 	float binsPerSemitone = 0;
 
@@ -175,6 +656,7 @@ CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debug
 	std::vector<CQTTable::Bin> bins;
 	
 	int assignedMidiNote = -1;
+	ATable::Regions regions;
 
 	float currentFrequency = -1;
 	unsigned int freqBin = 0;
@@ -242,6 +724,22 @@ CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debug
 				}
 			} break;
 
+			// #################### Loop and release frames ####################
+			case FileVariable::LoopStart:
+			case FileVariable::LoopEnd:
+			case FileVariable::ReleaseStart:
+			{
+				int frame = -1;
+				if (!convertString(line, frame) || (frame < 0))
+				{
+					std::cout << "Invalid argument in line " << lineCounter << ", file: " << filename << std::endl;
+					return nullptr;
+				}
+				if (var == FileVariable::LoopStart)		regions.loopStart	 = frame;
+				if (var == FileVariable::LoopEnd)		regions.loopEnd		 = frame;
+				if (var == FileVariable::ReleaseStart)	regions.releaseStart = frame;
+			} break;
+
 			// #################### Amplitudes ####################
 			case FileVariable::Amplitudes:
 			{
@@ -259,15 +757,18 @@ CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debug
 				bins.push_back(CQTTable::Bin());
 				auto & binData = bins.back();
 				binData.frequency = currentFrequency;
-				binData.envelope.reserve(listSize);
+
+				std::vector<float> envelope;
+				envelope.reserve(listSize);
 
 				// import csv list into std vector, 
-				if (!readValueList(line, binData.envelope))
+				if (!readValueList(line, envelope))
 				{
 					std::cout << "Invalid argument in line " << lineCounter << ", file: " << filename << std::endl;
 					std::cout << "Amplitude list could not be paresd correctly" << std::endl;
 					return NULL;
 				}
+				binData.envelope = Envelope(std::move(envelope));
 
 				if (debugMode)
 				{
@@ -284,11 +785,15 @@ CQTTable * TableManager::createCQTTableFromFile(std::string filename, bool debug
 		}
 	}
 
+	// a truncated or corrupt compressed file stops the stream early (see FileStream::DecompressionBuf)
+	if (infile.bad()) return nullptr;
+
 	CQTTable * table = new CQTTable();
 	table->setConfig(cfg);
 	table->setBins(std::move(bins));
 	table->setMidiNote(assignedMidiNote);
 	table->setBinsPerSemitone(binsPerSemitone);
+	table->setRegions(regions);
 
 	table->normalizeBinSizes();
 
@@ -308,7 +813,7 @@ bool TableManager::prepareTablesAutoRange()
 	int highestTable = -1;
 	for (int i = 0; i < tables.size(); i++)
 	{
-		if (tables[i] != nullptr)
+		if (origins[i].type == TableOrigin::Type::Source)
 		{
 			if (i < lowestTable)  lowestTable = i;
 			if (i > highestTable) highestTable = i;
@@ -326,77 +831,407 @@ bool TableManager::prepareTables(std::pair<unsigned int, unsigned int> range)
 
 	if (range.second >= tables.size()) range.second = tables.size() - 1;
 
-	// lambda helpers
-	auto findNextTableFrom = [&](unsigned int idx) -> unsigned int
-	{
-		for (int k = idx; k < tables.size(); k++)
-		{
-			if (tables[k] != nullptr) return k;
-		}
-		return -1;
-	};
+	int numPrepared = 0;
 
-	int lastTableIdx = -1;
-	int nextTableIdx = -1;
+	// the sources might have changed since the last call
+	originalSources.clear();
 
-	for (int i = range.first; i >= 0; i--)
+	for (int i = range.first; i <= range.second; i++)
 	{
-		if (tables[i] != nullptr)
+		// prepared on demand, see getTable()
+		if (lazyPreparation)
 		{
-			lastTableIdx = i;
+			std::lock_guard<std::mutex> lock(importMutex);
+			lazyRange = range;
 			break;
 		}
-	}
-
-	nextTableIdx = findNextTableFrom(range.first);
 
-	for (int i = range.first; i <= range.second; i++)
-	{
-		if (tables[i] == nullptr)
+		if (origins[i].type != TableOrigin::Type::Source)
 		{
-			bool lastTableInRange = lastTableIdx != -1;
-			bool nextTableInRange = nextTableIdx != -1;
-			if (lastTableInRange && nextTableInRange)
+			auto origin = findOrigin(i);
+			if (origin.type == TableOrigin::Type::None) continue;
+
+			// mixed from the sources while playing, see getBlend()
+			if (blendPlayback && origin.type == TableOrigin::Type::Interpolated)
 			{
-				auto newTable = tables[lastTableIdx]->interpolateTable(*tables[nextTableIdx], i);
-				tables[i] = std::shared_ptr<ATable>(newTable);
-				if (newTable->getBins()[0].envelope.size() < 1)
-				{
-					return false;
-				}
+				tables[i]  = nullptr;
+				origins[i] = TableOrigin();
+				continue;
 			}
-			else if (lastTableInRange)
+
+			// tables that were already prepared from the same sources are kept
+			if ((tables[i] == nullptr) || (origins[i] != origin))
 			{
-				auto newTable = tables[lastTableIdx]->createShiftedTable(i);
-				tables[i] = std::shared_ptr<ATable>(newTable);
-				if (newTable->getBins()[0].envelope.size() < 1)
+				// shifted tables are copies, trimmed or encoded sources work as well
+				ATable * newTable = nullptr;
+				if (origin.type == TableOrigin::Type::Interpolated)
 				{
-					return false;
+					auto lower = getOriginalSource(origin.lower, tables[origin.lower]);
+					auto upper = getOriginalSource(origin.upper, tables[origin.upper]);
+					newTable = createPreparedTable(i, origin, *lower, *upper);
 				}
-			}
-			else if (nextTableInRange)
-			{
-				auto newTable = tables[nextTableIdx]->createShiftedTable(i);
-				tables[i] = std::shared_ptr<ATable>(newTable);
-				if (newTable->getBins()[0].envelope.size() < 1)
+				else
 				{
-					return false;
+					newTable = createPreparedTable(i, origin, *tables[origin.lower], *tables[origin.lower]);
 				}
+
+				if (newTable == nullptr) return false;
+
+				tables[i]  = std::shared_ptr<ATable>(newTable);
+				origins[i] = origin;
+				numPrepared++;
 			}
 		}
-		else
+
+	}
+
+	if (loopDetection)
+	{
+		// sources first, shifted tables take over the regions of their source and keep sharing its envelopes
+		for (int i = range.first; i <= range.second; i++)
 		{
-			lastTableIdx = i;
-			nextTableIdx = findNextTableFrom(i + 1);			
+			if (tables[i] == nullptr || origins[i].type != TableOrigin::Type::Source) continue;
+			if (!tables[i]->getRegions().hasLoop()) tables[i]->detectRegions();
 		}
+		for (int i = range.first; i <= range.second; i++)
+		{
+			if (tables[i] == nullptr || origins[i].type == TableOrigin::Type::Source || tables[i]->getRegions().hasLoop()) continue;
+
+			auto source = (origins[i].type == TableOrigin::Type::Shifted) ? tables[origins[i].lower] : nullptr;
+			if (source != nullptr && source->getRegions().hasLoop() && !source->getRegions().trimmed) tables[i]->setRegions(source->getRegions());
+			else																					   tables[i]->detectRegions();
+		}
+	}
 
+	// trimmed and encoded after preparing, interpolation always starts from the decoded source tables.
+	// Tables sharing envelopes (shifted tables and their source) share the trimmed / encoded envelopes as well
+	EnvelopeMemo memo;
+	int numLooped	= 0;
+	int numPartials = 0;
+	int numFactorized = 0;
+	ATable::ModalReport modal;
+	CQTTable::NoiseBandReport noise;
+	std::vector<std::pair<int, ATable::MaskingReport>> masking;
+	for (int i = range.first; i <= range.second; i++)
+	{
+		if (tables[i] == nullptr) continue;
+
+		auto cqtTable = dynamic_cast<CQTTable*>(tables[i].get());
+		if (partialMerging && cqtTable != nullptr) numPartials += cqtTable->mergePartials();
+		if (noiseMinFrequency > 0 && cqtTable != nullptr)
+		{
+			auto report = cqtTable->makeNoiseBands(noiseMinFrequency, noiseBandsPerOctave);
+			noise.numSines	  += report.numSines;
+			noise.numReplaced += report.numReplaced;
+			noise.numBands	  += report.numBands;
+			noise.energy	  += report.energy;
+			noise.noiseEnergy += report.noiseEnergy;
+			noise.flatness	  += report.flatness;
+		}
+		if (maskPruning) masking.emplace_back(i, tables[i]->pruneMasked(maskingOffset));
+
+		if (tables[i]->getRegions().hasLoop())
+		{
+			// blended notes read the source envelopes at the positions of the untrimmed tables
+			if (!blendPlayback) tables[i]->trimToRegions(&memo);
+			numLooped++;
+		}
+
+		tables[i]->setEncoding(encoding, breakpointTolerance, &memo);
+		if (modalTolerance > 0)
+		{
+			auto report = tables[i]->fitModes(modalTolerance, &memo);
+			modal.numBins	+= report.numBins;
+			modal.numFitted += report.numFitted;
+			modal.numModes	+= report.numModes;
+			modal.errorSum	+= report.errorSum;
+			modal.maxError	 = std::max(modal.maxError, report.maxError);
+		}
+		tables[i]->makeSparse(sparseFloor, &memo);
+		if (lowRankTolerance > 0 && tables[i]->factorize(lowRankTolerance, &memo) > 0) numFactorized++;
+		if (arena != nullptr) tables[i]->placeInArena(*arena, &memo);
 		tables[i]->refreshActiveBins();
+		tables[i]->setFrameMatrix(frameMatrix);
+	}
+
+	// lazily prepared tables are interpolated from the original sources as well
+	if (!lazyPreparation) originalSources.clear();
+
+	if (debugMode)
+	{
+		std::printf("Prepared %d tables, %d tables loop\n", numPrepared, numLooped);
+		if (partialMerging) std::printf("Merged %d partials\n", numPartials);
+		if (noiseMinFrequency > 0 && noise.numBands > 0)
+		{
+			// flatness near 0 dB: the replaced bins were noise to begin with, far below: tonal bins were replaced
+			std::printf("Replaced %u of %u sines by %u noise bands, %.1f dB of the energy, flatness %.1f dB\n", noise.numReplaced, noise.numSines,
+						noise.numBands, 10 * std::log10(noise.noiseEnergy / noise.energy), 10 * std::log10(noise.flatness / noise.noiseEnergy));
+		}
+		else if (noiseMinFrequency > 0) std::printf("Replaced 0 of %u sines by noise bands\n", noise.numSines);
+		if (maskPruning)
+		{
+			unsigned int numBins = 0, numPruned = 0;
+			for (auto &note : masking)
+			{
+				auto &report = note.second;
+				double share = 10 * std::log10(report.prunedEnergy / std::max(report.energy, 1e-30));
+				std::printf("Note %3d: pruned %4u of %4u bins (%.1f dB of the energy)\n", note.first, report.numPruned, report.numBins, share);
+				numBins	  += report.numBins;
+				numPruned += report.numPruned;
+			}
+			std::printf("Pruned %u of %u bins below the masking threshold\n", numPruned, numBins);
+		}
+		if (modalTolerance > 0 && modal.numFitted > 0)
+		{
+			std::printf("Fitted %u of %u bins with %.2f modes on average, error %.1f dB mean, %.1f dB max\n", modal.numFitted, modal.numBins,
+						double(modal.numModes) / modal.numFitted, 20 * std::log10(modal.errorSum / modal.numFitted), 20 * std::log10(modal.maxError));
+		}
+		else if (modalTolerance > 0) std::printf("Fitted 0 of %u bins\n", modal.numBins);
+		if (lowRankTolerance > 0) std::printf("Factorized %d tables\n", numFactorized);
+		printEnvelopeMemory();
 	}
 	return true;
 }
 
+void TableManager::printEnvelopeMemory() const
+{
+	uint64_t bytes		 = 0;
+	uint64_t sharedBytes = 0;
+	std::set<const void*> envelopes;
+
+	for (auto const & table : tables)
+	{
+		if (table == nullptr) continue;
+
+		for (auto const & bin : table->getBins())
+		{
+			bytes += bin.envelope.rawSize();
+			if (envelopes.insert(bin.envelope.rawData()).second) sharedBytes += bin.envelope.rawSize();
+		}
+	}
+	std::printf("Envelope memory: %.2f MB, %.2f MB without sharing\n", sharedBytes / (1024. * 1024.), bytes / (1024. * 1024.));
+
+	if (arena == nullptr) return;
+
+	auto stats = arena->getStats();
+	std::printf("Arena: %.2f MB used of %.2f MB, %llu envelopes in %llu blocks (%llu on huge pages)\n",
+		stats.used / (1024. * 1024.), stats.reserved / (1024. * 1024.), (unsigned long long)stats.allocations,
+		(unsigned long long)stats.blocks, (unsigned long long)stats.hugePageBlocks);
+}
+
+TableManager::MemoryUsage TableManager::computeMemoryUsage() const
+{
+	MemoryUsage usage;
+	std::set<const void*> envelopes;
+	std::set<const ATable::FrameMatrix*> matrices;
+
+	// envelopes shared with the source (shifted tables, memoized encodings) are counted for the source
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < tables.size(); i++) if (tables[i] != nullptr && origins[i].type == TableOrigin::Type::Source) order.push_back(i);
+	for (unsigned int i = 0; i < tables.size(); i++) if (tables[i] != nullptr && origins[i].type != TableOrigin::Type::Source) order.push_back(i);
+
+	for (auto i : order)
+	{
+		auto const & table = *tables[i];
+		auto & note = usage.notes[i];
+
+		// tables without an origin (e.g. loaded from an old cache) count as sources
+		note.type = (origins[i].type == TableOrigin::Type::None) ? TableOrigin::Type::Source : origins[i].type;
+
+		auto const & bins = table.getBins();
+		for (unsigned int b = 0; b < bins.size(); b++)
+		{
+			auto const & envelope = bins[b].envelope;
+			note.envelopeBytes += envelope.rawSize();
+
+			if (!envelopes.insert(envelope.rawData()).second) continue;
+			note.ownBytes += envelope.rawSize();
+			if (!table.isActive(b)) note.inactiveBytes += envelope.rawSize();
+		}
+
+		// factors of LowRank envelopes count like envelopes, for the first table referencing them
+		std::set<const float*> tableFactors;
+		for (auto const & bin : bins)
+		{
+			if (bin.envelope.getEncoding() != Envelope::Encoding::LowRank) continue;
+
+			auto column = bin.envelope.getLowRankColumn();
+			if (!tableFactors.insert(column->activations).second) continue;
+
+			uint64_t bytes = (uint64_t(column->numFrames) + column->stride) * column->rank * sizeof(float);
+			note.envelopeBytes += bytes;
+			if (envelopes.insert(column->activations).second) note.ownBytes += bytes;
+		}
+
+		// frequency tracks count like envelopes
+		for (auto const & bin : bins)
+		{
+			if (bin.track.empty()) continue;
+
+			note.envelopeBytes += bin.track.rawSize();
+			if (envelopes.insert(bin.track.rawData()).second) note.ownBytes += bin.track.rawSize();
+		}
+
+		for (auto const & bin : bins) note.headBytes += bin.head.rawSize();
+
+		auto matrix = table.getFrameMatrix();
+		if (matrix != nullptr && matrices.insert(matrix.get()).second)
+		{
+			note.matrixBytes = matrix->storage.capacity() * sizeof(float) + matrix->bins.capacity() * sizeof(uint32_t);
+		}
+
+		note.binBytes = bins.capacity() * sizeof(ATable::Bin)
+			+ table.getBinStats().capacity() * sizeof(ATable::BinStats)
+			+ table.getBinRanking().capacity() * sizeof(uint32_t) * 2;	// ranking and position of every bin in it
+
+		switch (note.type)
+		{
+			case TableOrigin::Type::Interpolated: usage.interpolatedBytes += note.ownBytes; break;
+			case TableOrigin::Type::Shifted:	  usage.shiftedBytes	  += note.ownBytes; break;
+			default:							  usage.sourceBytes		  += note.ownBytes; break;
+		}
+		usage.inactiveBytes += note.inactiveBytes;
+		usage.matrixBytes	+= note.matrixBytes;
+		usage.headBytes		+= note.headBytes;
+		usage.binBytes		+= note.binBytes;
+	}
+
+	usage.totalBytes = usage.sourceBytes + usage.interpolatedBytes + usage.shiftedBytes + usage.matrixBytes + usage.headBytes + usage.binBytes;
+	return usage;
+}
+
+TableOrigin TableManager::findOrigin(unsigned int midiNote) const
+{
+	int lower = -1;
+	int upper = -1;
+
+	for (int i = midiNote; i >= 0; i--)
+	{
+		if (origins[i].type == TableOrigin::Type::Source)
+		{
+			lower = i;
+			break;
+		}
+	}
+	for (int i = midiNote; i < static_cast<int>(origins.size()); i++)
+	{
+		if (origins[i].type == TableOrigin::Type::Source)
+		{
+			upper = i;
+			break;
+		}
+	}
+
+	TableOrigin origin;
+	if (lower == static_cast<int>(midiNote))
+	{
+		origin = origins[midiNote];
+	}
+	else if ((lower >= 0) && (upper >= 0))
+	{
+		origin.type  = TableOrigin::Type::Interpolated;
+		origin.lower = lower;
+		origin.upper = upper;
+	}
+	else if ((lower >= 0) || (upper >= 0))
+	{
+		origin.type  = TableOrigin::Type::Shifted;
+		origin.lower = (lower >= 0) ? lower : upper;
+	}
+	return origin;
+}
+
+ATable * TableManager::createPreparedTable(unsigned int midiNote, const TableOrigin & origin, const ATable & lower, const ATable & upper) const
+{
+	ATable * newTable = nullptr;
+
+	if (origin.type == TableOrigin::Type::Interpolated)
+	{
+		newTable = lower.interpolateTable(upper, midiNote);
+	}
+	else if (origin.type == TableOrigin::Type::Shifted)
+	{
+		newTable = lower.createShiftedTable(midiNote);
+	}
+
+	if (newTable == nullptr) return nullptr;
+
+	if (newTable->getBins().size() < 1 || newTable->getBins()[0].envelope.size() < 1)
+	{
+		delete newTable;
+		return nullptr;
+	}
+
+	// regions of interpolated tables are interpolated as well, if both sources define them
+	if (origin.type == TableOrigin::Type::Interpolated)
+	{
+		auto regions = interpolateRegions(midiNote, origin, lower, upper, newTable->getEnvelopeLength());
+		if (regions.hasLoop()) newTable->setRegions(regions);
+	}
+	return newTable;
+}
+
+ATable::Regions TableManager::interpolateRegions(unsigned int midiNote, const TableOrigin & origin, const ATable & lower, const ATable & upper, unsigned int length) const
+{
+	ATable::Regions regions;
+
+	auto &lowerRegions = lower.getRegions();
+	auto &upperRegions = upper.getRegions();
+	if (!lowerRegions.hasLoop() || !upperRegions.hasLoop()) return regions;
+
+	float upperFrac = float(int(midiNote) - origin.lower) / float(origin.upper - origin.lower);
+	auto interpolate = [upperFrac](int lower, int upper) { return static_cast<int>(std::round((1.f - upperFrac) * lower + upperFrac * upper)); };
+	int lastFrame = int(length) - 1;
+
+	regions.loopStart = interpolate(lowerRegions.loopStart, upperRegions.loopStart);
+	regions.loopEnd	  = std::min(interpolate(lowerRegions.loopEnd, upperRegions.loopEnd), lastFrame);
+	if (lowerRegions.hasRelease() && upperRegions.hasRelease())
+	{
+		regions.releaseStart = std::max(regions.loopEnd + 1, interpolate(lowerRegions.releaseStart, upperRegions.releaseStart));
+	}
+	return regions;
+}
+
+std::shared_ptr<const ATable> TableManager::getOriginalSource(unsigned int midiNote, std::shared_ptr<const ATable> table)
+{
+	// interpolating lossy encoded sources would add up the errors of both encodings. Sparse bins are lossless without a floor.
+	// Merged partials, noise bands and pruned tables are read again as well, interpolation mixes the bins one by one
+	bool trimmed = table->getRegions().trimmed || table->hasFrequencyTracks() || table->hasNoiseBands() || maskPruning;
+	bool encoded = std::any_of(table->getBins().begin(), table->getBins().end(), [this](const ATable::Bin & bin)
+	{
+		auto encoding = bin.envelope.getEncoding();
+		return (encoding != Envelope::Encoding::Float32) && (encoding != Envelope::Encoding::Sparse || sparseFloor > 0);
+	});
+	if (!trimmed && !encoded) return table;
+
+	auto &original = originalSources[midiNote];
+	if (original == nullptr) original = readSourceTable(midiNote);
+	return (original != nullptr) ? original : table;
+}
+
+std::shared_ptr<const ATable> TableManager::readSourceTable(unsigned int midiNote) const
+{
+	auto sourceFile = origins[midiNote].sourceFile;
+	if (sourceFile < 0 || sourceFile >= static_cast<int>(sources.size())) return nullptr;
+
+	auto &path = sources[sourceFile].path;
+	ATable * table = nullptr;
+
+	switch (getFileTypeFromFile(path))
+	{
+		case FileType::CQTTable:	  table = createCQTTableFromFile(path);		 break;
+		case FileType::HarmonicTable: table = createHarmonicTableFromFile(path); break;
+		default: break;
+	}
+
+	if (debugMode && table != nullptr) std::printf("Read %s again for interpolation\n", path.c_str());
+	return std::shared_ptr<const ATable>(table);
+}
+
 void TableManager::applyThreshold(float val)
 {
+	// the bins are ranked when the tables are prepared, this only moves the end of the active bins
+	std::lock_guard<std::mutex> lock(importMutex);
 	for (auto table : tables)
 	{
 		if (table != nullptr) table->applyThreshold(val);
@@ -405,14 +1240,106 @@ void TableManager::applyThreshold(float val)
 
 void TableManager::limitNumActiveBins(unsigned int num)
 {
+	std::lock_guard<std::mutex> lock(importMutex);
+	activeBinLimit = num;
+	unsigned int numCompacted = 0;
 	for (auto table : tables)
 	{
-		if (table != nullptr) table->limitNumActiveBins(num);
+		if (table == nullptr) continue;
+		table->limitNumActiveBins(num);
+		if (binCompaction) numCompacted += table->compactInactiveBins();
+	}
+	if (debugMode && numCompacted > 0) std::printf("Compacted %u inactive bins\n", numCompacted);
+}
+
+void TableManager::setBinCompaction(bool enabled)
+{
+	binCompaction = enabled;
+}
+
+void TableManager::setStreaming(unsigned int headFrames)
+{
+	std::lock_guard<std::mutex> lock(importMutex);
+	streamFrames = headFrames;
+	for (auto table : tables)
+	{
+		if (table != nullptr) table->makeStreamHeads(headFrames);
+	}
+}
+
+ResidentMemory::Stats TableManager::makeResident(ResidentMemory::Mode mode)
+{
+	std::lock_guard<std::mutex> lock(importMutex);
+	residency = mode;
+	if (mode == ResidentMemory::Mode::None) return ResidentMemory::Stats();
+
+	// prepared tables may be dropped (see evictPreparedTables()), they own their locked pages
+	auto evictable = [this](unsigned int i) { return lazyPreparation && origins[i].type != TableOrigin::Type::Source; };
+
+	for (unsigned int i = 0; i < tables.size(); i++)
+	{
+		if (tables[i] != nullptr && !evictable(i)) addResidentMemory(*tables[i]);
+	}
+	auto stats = residentMemory.apply(mode);
+
+	for (unsigned int i = 0; i < tables.size(); i++)
+	{
+		if (tables[i] == nullptr || !evictable(i)) continue;
+
+		addResidentMemory(*tables[i]);
+		stats += residentMemory.apply(mode, tables[i].get());
+	}
+	return stats;
+}
+
+void TableManager::addResidentMemory(const ATable & table)
+{
+	auto const & bins = table.getBins();
+	residentMemory.add(bins.data(), bins.size() * sizeof(ATable::Bin));
+	residentMemory.add(table.getBinStats().data(), table.getBinStats().size() * sizeof(ATable::BinStats));
+	residentMemory.add(table.getBinRanking().data(), table.getBinRanking().size() * sizeof(uint32_t));
+
+	for (auto const & bin : bins)
+	{
+		residentMemory.add(bin.track.rawData(), bin.track.rawSize());
+
+		// the envelopes of streamed bins are read by the stream thread
+		if (!bin.head.empty())
+		{
+			residentMemory.add(bin.head.rawData(), bin.head.rawSize());
+			continue;
+		}
+
+		residentMemory.add(bin.envelope.rawData(), bin.envelope.rawSize());
+		if (bin.envelope.getEncoding() == Envelope::Encoding::LowRank)
+		{
+			auto column = bin.envelope.getLowRankColumn();
+			residentMemory.add(column->activations, size_t(column->numFrames) * column->rank * sizeof(float));
+			residentMemory.add(column->templates, size_t(column->rank) * column->stride * sizeof(float));
+		}
+	}
+
+	auto matrix = table.getFrameMatrix();
+	if (matrix != nullptr)
+	{
+		residentMemory.add(matrix->storage.data(), matrix->storage.size() * sizeof(float));
+		residentMemory.add(matrix->bins.data(), matrix->bins.size() * sizeof(uint32_t));
+	}
+}
+
+void TableManager::shareEnvelopes(EnvelopePool & pool)
+{
+	std::lock_guard<std::mutex> lock(importMutex);
+	for (auto table : tables)
+	{
+		if (table != nullptr) table->shareEnvelopes(pool);
 	}
 }
 
 void TableManager::unlimitNumActiveBins()
 {
+	std::lock_guard<std::mutex> lock(importMutex);
+	activeBinLimit = 0;
 	for (auto table : tables) if (table != nullptr) table->refreshActiveBins();
 }
 
@@ -438,26 +1365,263 @@ TableManager::ErrorCode TableManager::sanity()
 	return ErrorCode::NoError;
 }
 
-const ATable * TableManager::getTable(unsigned int midiNote) const
+std::shared_ptr<const ATable> TableManager::getTable(unsigned int midiNote)
+{
+	if (midiNote >= tables.size()) return nullptr;
+
+	std::lock_guard<std::mutex> lock(importMutex);
+
+	if (tables[midiNote] != nullptr)
+	{
+		lastUse[midiNote] = ++useCounter;
+		return tables[midiNote];
+	}
+
+	if (!isPreparable(midiNote)) return nullptr;
+
+	// neighbours are likely played next
+	requestTable(midiNote);
+	requestTable(int(midiNote) - 1);
+	requestTable(int(midiNote) + 1);
+
+	// until the table is prepared, the nearest ready table is played at the requested pitch
+	for (int distance = 1; distance < static_cast<int>(tables.size()); distance++)
+	{
+		for (int note : { int(midiNote) - distance, int(midiNote) + distance })
+		{
+			if (note < 0 || note >= static_cast<int>(tables.size()) || tables[note] == nullptr) continue;
+
+			std::shared_ptr<ATable> shifted(tables[note]->createShiftedTable(midiNote));
+			shifted->refreshActiveBins();
+			if (activeBinLimit > 0) shifted->limitNumActiveBins(activeBinLimit);
+			if (activeBinLimit > 0 && binCompaction) shifted->compactInactiveBins();
+			if (streamFrames > 0) shifted->makeStreamHeads(streamFrames);
+			return shifted;
+		}
+	}
+	return nullptr;
+}
+
+TableBlend TableManager::getBlend(unsigned int midiNote, TableBlend && storage)
+{
+	if (midiNote >= tables.size()) return TableBlend::recycle(std::move(storage));
+
+	{
+		std::lock_guard<std::mutex> lock(importMutex);
+
+		if (isBlended(midiNote))
+		{
+			auto origin = findOrigin(midiNote);
+
+			auto blend = TableBlend::recycle(std::move(storage));
+			blend.factors.reset();
+			blend.tables[0] = tables[origin.lower];
+			blend.tables[1] = tables[origin.upper];
+
+			if (blend.tables[0]->blendBins(*blend.tables[1], midiNote, blend.bins, blend.length) && blend.length > 1)
+			{
+				blend.config  = blend.tables[0]->getConfig();
+				blend.regions = interpolateRegions(midiNote, origin, *blend.tables[0], *blend.tables[1], blend.length);
+				return blend;
+			}
+			storage = std::move(blend);
+		}
+	}
+
+	return TableBlend::fromTable(getTable(midiNote), std::move(storage));
+}
+
+TableBlend::Limits TableManager::getPlaybackLimits()
+{
+	// tables prepared later are derived from these (or shifted copies of them), their bins are the same
+	std::lock_guard<std::mutex> lock(importMutex);
+
+	TableBlend::Limits limits;
+	for (auto const & table : tables)
+	{
+		if (table == nullptr) continue;
+
+		auto cfg = table->getConfig();
+		limits.numBins = std::max<unsigned int>(limits.numBins, table->getBins().size());
+		if (cfg.hopSize > 0) limits.frameRate = std::max(limits.frameRate, float(cfg.sampleRate) / cfg.hopSize);
+	}
+	return limits;
+}
+
+bool TableManager::playsBlend(unsigned int midiNote)
 {
-	if (midiNote > tables.size()) return nullptr;
+	if (midiNote >= tables.size()) return false;
 
-	return tables[midiNote].get();
+	std::lock_guard<std::mutex> lock(importMutex);
+	return isBlended(midiNote);
 }
 
+bool TableManager::hasTable(unsigned int midiNote)
+{
+	if (midiNote >= tables.size()) return false;
+
+	std::lock_guard<std::mutex> lock(importMutex);
+	if (tables[midiNote] != nullptr) return true;
+	return isPreparable(midiNote) || isBlended(midiNote);
+}
+
+bool TableManager::isPreparable(int midiNote) const
+{
+	if (!lazyPreparation || midiNote < static_cast<int>(lazyRange.first) || midiNote > static_cast<int>(lazyRange.second)) return false;
+
+	auto type = findOrigin(midiNote).type;
+	if (blendPlayback && type == TableOrigin::Type::Interpolated) return false;
+	return type != TableOrigin::Type::None;
+}
+
+bool TableManager::isBlended(int midiNote) const
+{
+	if (!blendPlayback || tables[midiNote] != nullptr) return false;
+	return findOrigin(midiNote).type == TableOrigin::Type::Interpolated;
+}
+
+void TableManager::requestTable(int midiNote)
+{
+	if (!isPreparable(midiNote)) return;
+	if (tables[midiNote] != nullptr || pending[midiNote]) return;
+
+	pending[midiNote] = true;
+	preparationThread->enqueue([this, midiNote]() { prepareLazyTable(midiNote); });
+}
+
+void TableManager::prepareLazyTable(unsigned int midiNote)
+{
+	TableOrigin origin;
+	std::shared_ptr<const ATable> lower;
+	std::shared_ptr<const ATable> upper;
+	{
+		std::lock_guard<std::mutex> lock(importMutex);
+
+		origin = findOrigin(midiNote);
+		if (tables[midiNote] != nullptr || origin.type == TableOrigin::Type::None)
+		{
+			pending[midiNote] = false;
+			return;
+		}
+		lower = tables[origin.lower];
+		upper = (origin.type == TableOrigin::Type::Interpolated) ? tables[origin.upper] : lower;
+	}
+
+	// interpolation needs the complete source tables, see prepareTables()
+	if (origin.type == TableOrigin::Type::Interpolated)
+	{
+		lower = getOriginalSource(origin.lower, lower);
+		upper = getOriginalSource(origin.upper, upper);
+	}
+
+	std::shared_ptr<ATable> table;
+	if (lower != nullptr && upper != nullptr) table = std::shared_ptr<ATable>(createPreparedTable(midiNote, origin, *lower, *upper));
+	if (table != nullptr) finishPreparedTable(*table);
+
+	std::lock_guard<std::mutex> lock(importMutex);
+	pending[midiNote] = false;
+
+	// the sources might have been replaced meanwhile
+	if (table == nullptr || findOrigin(midiNote) != origin) return;
+
+	// the table was just written and is resident, but not locked
+	if (residency == ResidentMemory::Mode::Lock)
+	{
+		addResidentMemory(*table);
+		residentMemory.apply(ResidentMemory::Mode::Lock, table.get());
+	}
+
+	tables[midiNote]  = table;
+	origins[midiNote] = origin;
+	lastUse[midiNote] = ++useCounter;
+	evictPreparedTables();
+
+	if (debugMode) std::printf("Prepared table %d\n", midiNote);
+}
+
+void TableManager::evictPreparedTables()
+{
+	while (true)
+	{
+		unsigned int numPrepared = 0;
+		int leastRecent = -1;
+
+		for (unsigned int i = 0; i < tables.size(); i++)
+		{
+			if (tables[i] == nullptr || origins[i].type == TableOrigin::Type::Source) continue;
+
+			numPrepared++;
+			if (leastRecent < 0 || lastUse[i] < lastUse[leastRecent]) leastRecent = i;
+		}
+
+		// the table prepared last is kept, otherwise a budget below the sources would drop every table right away
+		if (numPrepared <= 1) return;
+
+		if (numPrepared <= maxPreparedTables)
+		{
+			if (memoryBudget == 0) return;
+
+			auto bytes = computeMemoryUsage().totalBytes;
+			if (bytes <= memoryBudget) return;
+
+			if (debugMode) std::printf("Memory budget exceeded (%.2f MB), dropping table %d\n", bytes / (1024. * 1024.), leastRecent);
+		}
+
+		// voices still playing the table keep it alive, its memory isn't locked any more
+		residentMemory.remove(tables[leastRecent].get());
+		tables[leastRecent]	 = nullptr;
+		origins[leastRecent] = TableOrigin();
+	}
+}
+
+void TableManager::finishPreparedTable(ATable & table) const
+{
+	if (loopDetection && !table.getRegions().hasLoop()) table.detectRegions();
+
+	auto cqtTable = dynamic_cast<CQTTable*>(&table);
+	if (partialMerging && cqtTable != nullptr) cqtTable->mergePartials();
+	if (noiseMinFrequency > 0 && cqtTable != nullptr) cqtTable->makeNoiseBands(noiseMinFrequency, noiseBandsPerOctave);
+	if (maskPruning) table.pruneMasked(maskingOffset);
+
+	if (!blendPlayback) table.trimToRegions();
+
+	table.setEncoding(encoding, breakpointTolerance);
+	if (modalTolerance > 0) table.fitModes(modalTolerance);
+	table.makeSparse(sparseFloor);
+	if (lowRankTolerance > 0) table.factorize(lowRankTolerance);
+	if (arena != nullptr) table.placeInArena(*arena);
+	table.refreshActiveBins();
+	if (activeBinLimit > 0) table.limitNumActiveBins(activeBinLimit);
+	if (activeBinLimit > 0 && binCompaction) table.compactInactiveBins();
+	table.setFrameMatrix(frameMatrix);
+	if (streamFrames > 0) table.makeStreamHeads(streamFrames);
+}
+
+
 HarmonicTable * TableManager::createHarmonicTableFromFile(std::string filename, bool debugMode)
 {
-	if (getFileTypeFromFile(filename) != FileType::HarmonicTable) return nullptr;
+	auto infile = FileStream::open(filename);
+	if (infile == nullptr) return nullptr;
 
+	if (getFileTypeFromStream(*infile) != FileType::HarmonicTable) return nullptr;
+
+	// lines before the tag belong to the table as well
+	infile = FileStream::open(filename);
+	if (infile == nullptr) return nullptr;
+
+	return createHarmonicTableFromStream(*infile, filename, debugMode);
+}
+
+HarmonicTable * TableManager::createHarmonicTableFromStream(std::istream & infile, const std::string & filename, bool debugMode)
+{
 	unsigned int lineCounter = 0;
-	std::ifstream infile(filename);
-	
 	
 
 	CQTTable::Config cfg;
 	std::map<unsigned int, CQTTable::Bin> binMap;
 
 	int assignedMidiNote = -1;
+	ATable::Regions regions;
 
 	unsigned int maxHarmonic = 0;
 	float currentHarmonic = -1;
@@ -519,6 +1683,22 @@ HarmonicTable * TableManager::createHarmonicTableFromFile(std::string filename,
 				if (currentHarmonic > maxHarmonic) maxHarmonic = currentHarmonic;
 			} break;
 
+			// #################### Loop and release frames ####################
+			case FileVariable::LoopStart:
+			case FileVariable::LoopEnd:
+			case FileVariable::ReleaseStart:
+			{
+				int frame = -1;
+				if (!convertString(line, frame) || (frame < 0))
+				{
+					std::cout << "Invalid argument in line " << lineCounter << ", file: " << filename << std::endl;
+					return nullptr;
+				}
+				if (var == FileVariable::LoopStart)		regions.loopStart	 = frame;
+				if (var == FileVariable::LoopEnd)		regions.loopEnd		 = frame;
+				if (var == FileVariable::ReleaseStart)	regions.releaseStart = frame;
+			} break;
+
 			// #################### Amplitudes ####################
 			case FileVariable::Amplitudes:
 			{
@@ -536,15 +1716,18 @@ HarmonicTable * TableManager::createHarmonicTableFromFile(std::string filename,
 				binMap[currentHarmonic] = CQTTable::Bin();
 				auto & binData = binMap[currentHarmonic];
 				binData.frequency = 0;
-				binData.envelope.reserve(listSize);
+
+				std::vector<float> envelope;
+				envelope.reserve(listSize);
 
 				// import csv list into std vector, 
-				if (!readValueList(line, binData.envelope))
+				if (!readValueList(line, envelope))
 				{
 					std::cout << "Invalid argument in line " << lineCounter << ", file: " << filename << std::endl;
 					std::cout << "Amplitude list could not be paresd correctly" << std::endl;
 					return NULL;
 				}
+				binData.envelope = Envelope(std::move(envelope));
 
 				if (debugMode)
 				{
@@ -573,10 +1756,14 @@ HarmonicTable * TableManager::createHarmonicTableFromFile(std::string filename,
 	}
 
 
+	// a truncated or corrupt compressed file stops the stream early (see FileStream::DecompressionBuf)
+	if (infile.bad()) return nullptr;
+
 	HarmonicTable * table = new HarmonicTable();
 	table->setConfig(cfg);
 	table->setBins(std::move(bins));
 	table->shiftFrequencyTo(assignedMidiNote);
+	table->setRegions(regions);
 
 	table->normalizeBinSizes();
 
@@ -591,8 +1778,14 @@ HarmonicTable * TableManager::createHarmonicTableFromFile(std::string filename,
 
 TableManager::FileType TableManager::getFileTypeFromFile(std::string filename)
 {	
-	std::ifstream infile(filename);
-	// we expect something like variable=value, value is a int, float or list of both (separated by comma)
+	auto infile = FileStream::open(filename);
+	if (infile == nullptr) return FileType::Invalid;
+	return getFileTypeFromStream(*infile);
+}
+
+TableManager::FileType TableManager::getFileTypeFromStream(std::istream & infile)
+{
+	// the whole file is searched for the type tag, the stream is left right after it
 
 	static std::regex regexInclude("[\\s]*\\[IncludeFile\\][\\s]*", std::regex::icase);
 	static std::regex regexCQTTable("[\\s]*\\[CQTTableFile\\][\\s]*", std::regex::icase);
@@ -622,6 +1815,9 @@ TableManager::FileVariable TableManager::getVariable(const std::string & input)
 	static std::regex regexAmplitudes("[\\s]*Amplitudes?[\\s]*", std::regex::icase);
 	static std::regex regexMidiNote("[\\s]*MidiNote[\\s]*", std::regex::icase);
 	static std::regex regexHarmonic("[\\s]*Harmonic[\\s]*", std::regex::icase);
+	static std::regex regexLoopStart("[\\s]*LoopStart[\\s]*", std::regex::icase);
+	static std::regex regexLoopEnd("[\\s]*LoopEnd[\\s]*", std::regex::icase);
+	static std::regex regexReleaseStart("[\\s]*ReleaseStart[\\s]*", std::regex::icase);
 
 	if (std::regex_match(input, regexInclude))			return FileVariable::Include;
 	if (std::regex_match(input, regexSampleRate))		return FileVariable::SampleRate;
@@ -631,6 +1827,9 @@ TableManager::FileVariable TableManager::getVariable(const std::string & input)
 	if (std::regex_match(input, regexAmplitudes))		return FileVariable::Amplitudes;
 	if (std::regex_match(input, regexMidiNote))			return FileVariable::MidiNote;
 	if (std::regex_match(input, regexHarmonic))			return FileVariable::Harmonic;
+	if (std::regex_match(input, regexLoopStart))		return FileVariable::LoopStart;
+	if (std::regex_match(input, regexLoopEnd))			return FileVariable::LoopEnd;
+	if (std::regex_match(input, regexReleaseStart))		return FileVariable::ReleaseStart;
 
 
 	return FileVariable::NoVariable;
@@ -3,10 +3,22 @@
 #include "HarmonicTable.h"
 #include "CQTTable.h"
 #include "ATable.h"
+#include "TableSource.h"
+#include "TableCache.h"
+#include "TableBlend.h"
 
 #include <memory>
 #include <vector>
 #include <array>
+#include <istream>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <future>
+
+#include "Util/ThreadPool.h"
+#include "Util/Arena.h"
+#include "Util/ResidentMemory.h"
 
 
 class TableManager
@@ -30,6 +42,33 @@ public:
 
 	
 
+	// bytes of the tables, see getMemoryUsage()
+	struct MemoryUsage
+	{
+		struct Note
+		{
+			TableOrigin::Type type{ TableOrigin::Type::None };
+			uint64_t envelopeBytes{ 0 };	// envelopes, low-rank factors and frequency tracks of the table, including those shared with other tables
+			uint64_t ownBytes{ 0 };			// envelopes not counted for a table before (sources are counted first)
+			uint64_t inactiveBytes{ 0 };	// part of ownBytes in inactive bins
+			uint64_t matrixBytes{ 0 };		// frame matrix, see setFrameMatrix()
+			uint64_t headBytes{ 0 };		// heads of streamed tables, see setStreaming()
+			uint64_t binBytes{ 0 };			// bins and their statistics without envelopes
+		};
+
+		std::array<Note, 128> notes;
+
+		// own bytes by origin, every envelope is counted once
+		uint64_t sourceBytes{ 0 };
+		uint64_t interpolatedBytes{ 0 };
+		uint64_t shiftedBytes{ 0 };
+		uint64_t inactiveBytes{ 0 };	// part of the three above in inactive bins
+		uint64_t matrixBytes{ 0 };
+		uint64_t headBytes{ 0 };
+		uint64_t binBytes{ 0 };
+		uint64_t totalBytes{ 0 };		// all of the above, inactive bins included once
+	};
+
 	enum class FileVariable
 	{
 		NoVariable,			// used as an invalid-variable state
@@ -40,7 +79,10 @@ public:
 		MidiNote,			// midi note this talbe is supposed to be used for
 		Frequency,			// followed by a float defines the frequency of the following bin
 		Harmonic,			// followed by a float defines the harmonic index of the following bin
-		Amplitudes			// data of a frequency-bin, envelope-samples
+		Amplitudes,			// data of a frequency-bin, envelope-samples
+		LoopStart,			// first envelope frame of the sustain loop
+		LoopEnd,			// envelope frame at which playback jumps back to LoopStart
+		ReleaseStart		// envelope frame playback jumps to on note off
 	};
 
 public:
@@ -48,25 +90,155 @@ public:
 
 	void loadBinaryCache(std::string fileName);
 	void storeBinaryCache(std::string fileName);
+
+	// writes the cache on a background thread from a snapshot of the current tables, the tables may be
+	// used (and active bins changed) meanwhile. The future returns false if writing failed
+	std::future<bool> storeBinaryCacheAsync(std::string fileName);
 	
 	bool importTextFile(std::string fileName, bool useMT);
+
+	// imports the text file like importTextFile, tables of unchanged source files and the prepared tables
+	// depending only on those are taken from the cache file instead of parsing / preparing them again.
+	// Prepares the tables afterwards
+	bool importTextFileCached(std::string fileName, std::string cacheFile, bool useMT);
+
+	// true if a source file of the loaded cache changed since the cache was written
+	bool isCacheStale() const;
+
+	// text file the tables were imported from, empty if unknown (e.g. caches of older versions)
+	std::string getRootFile() const;
+
+	// encoding of the envelopes, applied when tables are prepared
+	void setEncoding(Envelope::Encoding encoding);
+
+	// maximum error (dB) of Breakpoint envelopes
+	void setBreakpointTolerance(float tolerance);
+
+	// neighbouring bins of CQT tables sharing one partial are merged into a single bin with a frequency track when tables
+	// are prepared (see CQTTable::mergePartials()), the player runs one sine per partial instead of one per bin
+	void setPartialMerging(bool enabled);
+
+	// bins of CQT tables at and above 'minFrequency' (Hz) are grouped into noise bands 1 / 'bandsPerOctave' octaves wide
+	// when tables are prepared (see CQTTable::makeNoiseBands()), the player runs a filtered noise per band instead of a sine
+	// per bin. 0 (the default) disables it. Debug mode reports the bins replaced and how noise-like they were
+	void setNoiseBands(float minFrequency, unsigned int bandsPerOctave = 3);
+
+	// bins masked by the other bins of their table in every frame are silenced when tables are prepared (see
+	// ATable::pruneMasked()), 'offset' is the distance (dB) of the masking threshold below the masker. Debug mode
+	// reports the bins pruned per note
+	void setMaskPruning(bool enabled, float offset = 12);
+
+	// bins that are mostly silent are stored as Sparse envelopes when tables are prepared (see ATable::makeSparse()).
+	// Frames more than 'decibels' below the loudest frame of their table become silence in those bins. Without a floor
+	// (the default) only silent frames are dropped
+	void setSparseFloor(float decibels);
+
+	// bins that decay exponentially after their peak are stored as attack plus a few decaying modes when tables are
+	// prepared (see ATable::fitModes()), the player renders them without reading envelopes. 'decibels' is the error
+	// allowed relative to a bin, 0 (the default) disables it. Debug mode reports the bins fitted and their errors
+	void setModalFit(float decibels);
+
+	// tables are replaced by a low-rank factorization when they are prepared (see ATable::factorize()), if that takes
+	// less memory. 'decibels' is the error allowed relative to the table, 0 (the default) disables it
+	void setLowRank(float decibels);
+
+	// searches sustain loops and release segments of tables that don't define them when tables are prepared.
+	// Tables with a loop are trimmed to attack + loop + release
+	void setLoopDetection(bool enabled);
+
+	// prepares tables that aren't imported on demand instead of in prepareTables(): getTable() schedules the requested
+	// note (and its neighbours) on a background thread. At most maxPreparedTables prepared tables are kept, the least
+	// recently requested ones are dropped
+	void setLazyPreparation(bool enabled, unsigned int maxPreparedTables = DefaultMaxPreparedTables);
+
+	// notes between two source tables aren't prepared, the player mixes the envelopes of both sources instead
+	// (see getBlend()). Only source and shifted tables are kept in memory. Tables aren't trimmed in this mode,
+	// the envelopes of the sources have to line up
+	void setBlendPlayback(bool enabled);
+
+	// envelopes of imported and prepared tables are copied to an arena when the tables are prepared, the envelopes
+	// of a bank lie next to each other in large (optionally huge page) blocks. Envelopes of a loaded cache are
+	// already laid out in the mapped file and stay there
+	void setArena(bool enabled, Arena::Pages pages = Arena::Pages::Normal);
+
+	// tables keep their active bins as frame-major float matrix (see ATable::setFrameMatrix()), applied when tables
+	// are prepared or loaded
+	void setFrameMatrix(bool enabled);
+
+	// keeps the memory of all tables (see MemoryUsage::totalBytes) below 'bytes' by dropping the least recently used
+	// prepared tables, they are prepared again from their sources when played. Needs lazy preparation, which is
+	// enabled without a table limit if it is off. Source tables are never dropped. 0: no budget
+	void setMemoryBudget(uint64_t bytes);
+
+	// bytes of every table and the totals by origin. Tables dropped from the manager that are still played aren't counted
+	MemoryUsage getMemoryUsage() const;
+	void		printMemoryUsage() const;
+
+	// prints memory and amplitude error of every envelope encoding for the current tables.
+	// The errors are measured against the current envelopes, call before the tables are encoded
+	void printEncodingReport() const;
 	
 	bool prepareTablesAutoRange();
 	bool prepareTables(std::pair<unsigned int, unsigned int> range = { 0,128 });
 
+	// the active bins of the tables, cheap enough to change while playing. Voices take over a change with their next note
 	void applyThreshold(float val);
 	void limitNumActiveBins(unsigned int num);
 	void unlimitNumActiveBins();
 
+	// frees the envelopes of the bins outside the limit (see ATable::compactInactiveBins()) whenever a limit is applied,
+	// tables prepared later are compacted as well. The limit becomes part of the cache options, a cache written
+	// afterwards holds the active bins only. Set it before importing, the tables must not be played while a limit is
+	// applied. Raising the limit afterwards doesn't bring the bins back
+	void setBinCompaction(bool enabled);
+
+	// keeps the first 'headFrames' frames of every table, its loop and its release resident (see ATable::makeStreamHeads()),
+	// an EnvelopeStream loads the frames after them while playing. Tables prepared later get heads as well, 0 drops
+	// them. Blend playback mixes two tables and isn't streamed. Heads shorter than EnvelopeStream::getMinHeadFrames()
+	// underrun, tables imported from text save no memory (see EnvelopeStream). Apply after importing, not while playing
+	void setStreaming(unsigned int headFrames);
+
+	// brings the memory of the tables into RAM before they are played (see ResidentMemory), so the first note of a
+	// table doesn't page fault on the audio thread. Streamed tables only have their heads made resident, the stream
+	// thread reads the rest. With Lock, tables prepared later are locked as well (they are resident once written),
+	// dropped tables are unlocked (see evictPreparedTables()). Call after the tables are loaded, limited, streamed
+	// and shared; returns the pages of this call
+	ResidentMemory::Stats makeResident(ResidentMemory::Mode mode);
+
+	// lets the tables share envelopes with identical content through 'pool' (see ATable::shareEnvelopes()), e.g. with
+	// the tables of another velocity layer. Tables prepared afterwards don't take part. Not while the tables are played
+	void shareEnvelopes(EnvelopePool & pool);
+
 	ErrorCode sanity();
 
-	const ATable * getTable(unsigned int midiNote) const;
+	// table of midiNote. With lazy preparation a table that isn't ready yet is scheduled and the nearest ready table,
+	// shifted to midiNote, is returned meanwhile. Don't call from the audio thread
+	std::shared_ptr<const ATable> getTable(unsigned int midiNote);
+
+	// what the player plays for midiNote: the table of the note (see getTable()) or, with blend playback, the blend
+	// of its source tables, built in 'storage' (see TableBlend::recycle()). Don't call from the audio thread
+	TableBlend getBlend(unsigned int midiNote, TableBlend && storage = TableBlend());
+
+	// true if getBlend() mixes the source tables of midiNote (see setBlendPlayback()) instead of playing a table
+	bool playsBlend(unsigned int midiNote);
+
+	// bins and frame rate of the largest table, the player allocates for them before playing
+	TableBlend::Limits getPlaybackLimits();
+
+	// true if a table for midiNote exists, can be prepared or blended, doesn't schedule anything
+	bool hasTable(unsigned int midiNote);
+
+	static const unsigned int DefaultMaxPreparedTables = 32;
 
 public:
 
 	static CQTTable * createCQTTableFromFile(std::string filename, bool debugMode = false);
 	static HarmonicTable * createHarmonicTableFromFile(std::string filename, bool debugMode = false);
 
+	// parse a table from a stream positioned at the start of the file, the file type tag is skipped like any line without a variable
+	static CQTTable * createCQTTableFromStream(std::istream &infile, const std::string &filename, bool debugMode = false);
+	static HarmonicTable * createHarmonicTableFromStream(std::istream &infile, const std::string &filename, bool debugMode = false);
+
 	// #################### SERIALIZATION ####################
 private:
 
@@ -79,11 +251,83 @@ private:
 	// #################### HELPER ####################
 private:
 
-	bool importIncludeFile(std::string fileName, bool useMT);
-	bool importTableFile(ATable *table);
+	// lookup of the cached tables that can be reused while importing
+	struct CacheReuse
+	{
+		const TableCache::Content * cache{ nullptr };
+		std::map<std::string, int>	sourceIndex;	// path -> index in cache->sources
+		std::map<int, int>			noteOfSource;	// index in cache->sources -> midi note of the table
+	};
+
+	bool importFiles(std::string filename, bool useMT, const CacheReuse *reuse);
+	bool importTableStream(std::istream &infile, FileType fileType, const SourceFile &source);
+	bool importTableFile(ATable *table, const SourceFile &source);
+
+	// takes the cached table of source file 'current' if it didn't change, compares either the content hash or size and modification time
+	bool reuseCachedTable(const SourceFile &current, const CacheReuse &reuse, bool compareHash);
+
+	// inserts a source table, prepared tables depending on the note are dropped. Expects importMutex to be locked
+	void setSourceTable(std::shared_ptr<ATable> table, unsigned int midiNote, const SourceFile &source);
+	void addSourceFile(const SourceFile &source);
+
+	// determines the source notes the table of midiNote is prepared from
+	TableOrigin findOrigin(unsigned int midiNote) const;
+
+	// adds the memory the player reads of a table to residentMemory, see makeResident()
+	void addResidentMemory(const ATable &table);
+
+	// memory of all envelopes, counting envelopes shared by several tables once, and the usage of the arena
+	void printEnvelopeMemory() const;
+
+	// see getMemoryUsage(), expects importMutex to be locked
+	MemoryUsage computeMemoryUsage() const;
+
+	// true if midiNote is within the prepared range and can be prepared from source tables, expects importMutex to be locked
+	bool isPreparable(int midiNote) const;
+
+	// schedules the preparation of midiNote, expects importMutex to be locked
+	void requestTable(int midiNote);
+
+	// prepares the table of midiNote on the preparation thread
+	void prepareLazyTable(unsigned int midiNote);
+
+	// drops the least recently used prepared tables above maxPreparedTables or the memory budget, the last prepared
+	// table is kept. Expects importMutex to be locked
+	void evictPreparedTables();
+
+	// loop detection, partial merging, trimming, encoding and the active bin limit of a prepared table
+	void finishPreparedTable(ATable &table) const;
+	ATable *	createPreparedTable(unsigned int midiNote, const TableOrigin &origin, const ATable &lower, const ATable &upper) const;
+
+	// regions of an interpolated note, interpolated from the source regions if both sources loop
+	ATable::Regions interpolateRegions(unsigned int midiNote, const TableOrigin &origin, const ATable &lower, const ATable &upper, unsigned int length) const;
+
+	// true if midiNote is played as a blend of its source tables, expects importMutex to be locked
+	bool isBlended(int midiNote) const;
+
+	// source table of midiNote as imported, used for interpolation. Trimmed or lossy encoded sources are read from
+	// their file again, once per source (kept in originalSources)
+	std::shared_ptr<const ATable> getOriginalSource(unsigned int midiNote, std::shared_ptr<const ATable> table);
+	std::shared_ptr<const ATable> readSourceTable(unsigned int midiNote) const;
+
+	// settings the prepared tables depend on, stored in the cache
+	std::string getCacheOptions() const;
+
+	// snapshot of the tables and their sources, paths relative to the cache file
+	TableCache::Content createCacheContent(const std::string &filename) const;
+
+	// loads the cache and converts its paths to absolute paths
+	static void loadCacheContent(const std::string &filename, TableCache::Content &content, bool verifyData);
+	static SourceFile createSourceFile(const std::string &filename, const std::vector<char> &content);
+
+	// returns the full paths of all files included by an include file
+	static std::vector<std::string> readIncludeList(std::istream &infile, const std::string &filename);
 
 	static FileType		getFileTypeFromFile(std::string filename);
 
+	// detects the file type from the type tag, which may be on any line. The stream is left after the tag
+	static FileType		getFileTypeFromStream(std::istream &infile);
+
 	// returns the variable specified by string 'input'
 	static FileVariable getVariable(const std::string &input);
 
@@ -100,9 +344,51 @@ private:
 	static int			estimateValueListSize(const std::string &str);
 		
 private:
+	static const unsigned int NumIOThreads			 = 8;	// number of parallel file reads when importing with multi threading
+
 	std::array<std::shared_ptr<ATable>, 128> tables;
+	std::array<TableOrigin, 128>			 origins;	// how each table was created
+	std::vector<SourceFile>					 sources;	// all imported text files, including include files
+	std::string								 rootFile;
+	std::string								 cacheOptions;	// options of the loaded cache
+	Envelope::Encoding						 encoding{ Envelope::Encoding::Float32 };
+	float									 breakpointTolerance{ EnvelopeCodec::DefaultBreakpointTolerance };
+	bool									 loopDetection{ false };
+	bool									 partialMerging{ false };
+	float									 noiseMinFrequency{ 0 };	// Hz, see setNoiseBands()
+	unsigned int							 noiseBandsPerOctave{ 3 };
+	bool									 maskPruning{ false };
+	float									 maskingOffset{ 12 };	// dB, see setMaskPruning()
+	float									 sparseFloor{ 0 };	// relative to the loudest frame of a table, see setSparseFloor()
+	float									 lowRankTolerance{ 0 };	// relative error, see setLowRank()
+	float									 modalTolerance{ 0 };	// relative error, see setModalFit()
+	bool									 blendPlayback{ false };
+	std::unique_ptr<Arena>					 arena;		// nullptr: envelopes aren't placed in an arena
+	bool									 frameMatrix{ false };
+	std::atomic<unsigned int>				 activeBinLimit{ 0 };	// 0: all bins active, read by the preparation thread
+	bool									 binCompaction{ false };
+	std::atomic<unsigned int>				 streamFrames{ 0 };	// see setStreaming(), read by the preparation thread
+	ResidentMemory							 residentMemory;
+	ResidentMemory::Mode					 residency{ ResidentMemory::Mode::None };	// see makeResident()
+
+	// sources read again by getOriginalSource(), cleared by prepareTables(). Only used by the thread preparing tables
+	std::map<int, std::shared_ptr<const ATable>> originalSources;
+
+	// lazy preparation
+	bool							lazyPreparation{ false };
+	unsigned int					maxPreparedTables{ DefaultMaxPreparedTables };
+	std::array<uint64_t, 128>		lastUse{};		// use counter value of the last request of each table
+	std::array<bool, 128>			pending{};		// scheduled for preparation
+	std::pair<unsigned int, unsigned int> lazyRange{ 0, 127 };	// range of the last prepareTables() call
+	uint64_t						useCounter{ 0 };
+	uint64_t						memoryBudget{ 0 };	// 0: no budget
+
+	mutable std::mutex importMutex; // guards tables, origins and sources while importing with multiple threads and while preparing lazily
 
 	bool debugMode;
+
+	// declared last, the destructor finishes the running preparations while the other members still exist
+	std::unique_ptr<ThreadPool> preparationThread;
 };
 
 inline TableManager::ErrorCode operator|(const TableManager::ErrorCode &lhs, const TableManager::ErrorCode & rhs)
@@ -4,11 +4,12 @@ TablePlayer::TablePlayer()
 {	
 }
 
-void TablePlayer::prepare(const AudioIO::CallbackConfig & cfg)
+void TablePlayer::prepare(const AudioIO::CallbackConfig & cfg, TableBlend::Limits limits)
 {
 	readPosInt  = std::vector<int>(cfg.frameSize, 0);
 	readPosFrac = std::vector<float>(cfg.frameSize, 0);
 	writeBuffer = std::vector<float>(cfg.frameSize, 0);
+	fadeGain	= std::vector<float>(cfg.frameSize, 0);
 
 	masterEnv.setAttack(0);
 	masterEnv.setRelease(44100 * 0.01);
@@ -16,29 +17,87 @@ void TablePlayer::prepare(const AudioIO::CallbackConfig & cfg)
 	if (this->cfg == nullptr) this->cfg = std::unique_ptr<AudioIO::CallbackConfig>( new AudioIO::CallbackConfig(cfg));
 	*this->cfg = cfg;
 
+	// setBlend() runs on the audio thread, it finds the buffers allocated
+	unsigned int blockFrames = (limits.frameRate > 0) ? std::ceil(cfg.frameSize * limits.frameRate / cfg.sampleRate) + 3 : 0;
+	reserve(limits.numBins, blockFrames);
+
 	prepareTablePlayback();
 }
 
 void TablePlayer::process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackData * data)
 {	
 	// return if we don't have a table
-	if (!table) return;
+	if (blend.empty()) return;
 
 	// we bypass overhead from vectors by 
-	auto readPosInt = this->readPosInt.data();
-	auto readPosFrac = this->readPosFrac.data();
 	auto writeBuffer = this->writeBuffer.data();
 
 	// get Data
-	auto &tableBins			= table->getActiveBins();
-	auto tableLength		= table->getEnvelopeLength();
+	auto &tableBins			= blend.bins;
+	auto tableLength		= blend.length;
 	auto lastValidReadPos	= tableLength - 2;
 
 	// prepare write channel, 
 	for (int i = 0; i < cfg.frameSize; i++)
 	{
 		writeBuffer[i] = 0;
-		readPos += readInc;
+	}
+	
+	auto numBins = std::min(generators.size(), tableBins.size());
+
+	// the block is split where the read position jumps back to the loop start
+	int begin = 0;
+	while (begin < cfg.frameSize)
+	{
+		int end = computeReadPositions(begin, cfg.frameSize);
+
+		if (frequencyTracks) updateFrequencies(begin, end, numBins);
+
+		if (breakpointPlayback) processBreakpoints(begin, end, numBins);
+		else					processFrames(begin, end, numBins);
+
+		begin = end;
+	}
+
+	// the release segment was played completely
+	if (released && readPos >= lastValidReadPos) masterEnv.setGate(0);
+
+	// apply envelope
+	for (int i = 0; i < cfg.frameSize; i++)
+	{
+		data->write[0][i] += 0.5 * writeBuffer[i] * masterEnv.tick();
+	}
+}
+
+int TablePlayer::computeReadPositions(int begin, int end)
+{
+	auto readPosInt	 = this->readPosInt.data();
+	auto readPosFrac = this->readPosFrac.data();
+	auto fadeGain	 = this->fadeGain.data();
+
+	float lastValidReadPos = blend.length - 2;
+
+	if (releasePending)
+	{
+		releasePending = false;
+		if (readPos + readInc < releaseStart) jumpTo(releaseStart);
+	}
+
+	bool looping = (loopEnd >= 0) && !released;
+
+	for (int i = begin; i < end; i++)
+	{
+		float next = readPos + readInc;
+		if (looping && next >= loopEnd)
+		{
+			// the jump starts a new run
+			if (i > begin) return i;
+
+			jumpTo(next - (loopEnd - loopStart));
+			next = readPos + readInc;
+		}
+
+		readPos = next;
 		if (readPos <= lastValidReadPos) 
 		{
 			readPosInt[i]  = readPos;
@@ -49,68 +108,533 @@ void TablePlayer::process(const AudioIO::CallbackConfig & cfg, AudioIO::Callback
 			readPosInt[i]  = lastValidReadPos;
 			readPosFrac[i] = 0;
 		}
+
+		fadeGain[i] = fading ? std::max(0.f, 1.f - (readPos - fadeStart) / ATable::CrossfadeFrames) : 0;
+	}
+
+	if (fading && (readPos - fadeStart) >= ATable::CrossfadeFrames) fading = false;
+	return end;
+}
+
+void TablePlayer::jumpTo(float position)
+{
+	auto &tableBins = blend.bins;
+	auto numBins	= std::min(generators.size(), tableBins.size());
+
+	// the remainder of a running fade is part of the current amplitude
+	float gain = fading ? std::max(0.f, 1.f - (readPos - fadeStart) / ATable::CrossfadeFrames) : 0;
+
+	if (blend.stream != nullptr)
+	{
+		// streamed envelopes aren't read on the audio thread
+		auto current = this->streamAmplitudes.data();
+		auto target	 = current + numBins;
+		blend.stream->amplitudesAt(readPos, current);
+		blend.stream->amplitudesAt(position, target);
+		for (unsigned int f = 0; f < numBins; f++) fadeOffsets[f] = current[f] + gain * fadeOffsets[f] - target[f];
+	}
+	else
+	{
+		for (unsigned int f = 0; f < numBins; f++)
+		{
+			auto &bin = tableBins[f];
+			fadeOffsets[f] = amplitudeAt(bin, readPos) + gain * fadeOffsets[f] - amplitudeAt(bin, position);
+		}
+	}
+
+	// the next sample is read at 'position'
+	readPos	  = position - readInc;
+	fadeStart = position;
+	fading	  = true;
+}
+
+float TablePlayer::amplitudeAt(const Envelope & envelope, float position) const
+{
+	if (envelope.size() < 2) return 0;
+
+	position = std::min(std::max(position, 0.f), float(envelope.size() - 2));
+	unsigned int frame = position;
+	float frac = position - frame;
+
+	float frames[2];
+	envelope.decode(frame, 2, frames);
+	return (1.f - frac) * frames[0] + frac * frames[1];
+}
+
+float TablePlayer::amplitudeAt(const ATable::BlendBin & bin, float position) const
+{
+	float amplitude = bin.weights[0] * amplitudeAt(*bin.envelopes[0], position);
+	if (bin.envelopes[1] != nullptr) amplitude += bin.weights[1] * amplitudeAt(*bin.envelopes[1], position);
+	return amplitude;
+}
+
+void TablePlayer::updateFrequencies(int begin, int end, unsigned int numBins)
+{
+	// once per run, at the read position in its middle. The generators keep their phase
+	int   middle   = (begin + end - 1) / 2;
+	float position = readPosInt[middle] + readPosFrac[middle];
+
+	for (unsigned int f = 0; f < numBins; f++)
+	{
+		auto &bin = blend.bins[f];
+		if (bin.track == nullptr) continue;
+
+		auto freq = bin.frequency * amplitudeAt(*bin.track, position) * cfg->iSampleRate;
+		generators[f].setFrequency((freq < 0.5) ? freq : 0);
+	}
+}
+
+void TablePlayer::decodeFrames(const ATable::BlendBin & bin, unsigned int start, unsigned int count, float * out)
+{
+	auto length	   = TableBlend::binLength(bin);
+	auto available = (start < length) ? std::min(count, length - start) : 0;
+
+	bin.envelopes[0]->decode(start, available, out);
+
+	// mixed like interpolateTable() mixes the envelopes
+	if (bin.envelopes[1] != nullptr)
+	{
+		auto mix = this->mixBuffer.data();
+		bin.envelopes[1]->decode(start, available, mix);
+
+		for (unsigned int i = 0; i < available; i++)
+		{
+			out[i] = out[i] * bin.weights[0] + mix[i] * bin.weights[1];
+		}
+	}
+
+	// bins shorter than the blend are silent at the end
+	std::fill(out + available, out + count, 0.f);
+}
+
+void TablePlayer::multiplyFactors(unsigned int start, unsigned int count, unsigned int numBins)
+{
+	auto &factors = *blend.factors;
+	auto buffer	  = this->envelopeBuffer.data();
+	auto stride	  = envelopeBufferStride;
+
+	// one row per frame, the templates are added up weighted by the activations of the frame
+	for (unsigned int k = 0; k < count; k++)
+	{
+		auto row = buffer + k * stride;
+		std::fill(row, row + numBins, 0.f);
+		if (start + k >= factors.numFrames) continue;
+
+		auto activations = factors.activations + size_t(start + k) * factors.rank;
+		for (unsigned int r = 0; r < factors.rank; r++)
+		{
+			auto weight	   = activations[r];
+			auto templates = factors.templates.data() + size_t(r) * factors.stride;
+			for (unsigned int f = 0; f < numBins; f++) row[f] += weight * templates[f];
+		}
+
+		// like EnvelopeCodec decodes LowRank envelopes
+		for (unsigned int f = 0; f < numBins; f++) row[f] = std::max(0.f, row[f]);
+	}
+}
+
+bool TablePlayer::isSilent(const ATable::BlendBin & bin, unsigned int start, unsigned int count) const
+{
+	auto length = TableBlend::binLength(bin);
+	if (start >= length) return true;
+
+	count = std::min(count, length - start);
+	return bin.envelopes[0]->isSilent(start, count) && (bin.envelopes[1] == nullptr || bin.envelopes[1]->isSilent(start, count));
+}
+
+bool TablePlayer::addModes(const ATable::BlendBin & bin, const SineGenComplex & generator, int begin, int end)
+{
+	auto &envelope = *bin.envelopes[0];
+	if (bin.envelopes[1] != nullptr || bin.bandwidth > 0 || envelope.getEncoding() != Envelope::Encoding::Modal) return false;
+
+	// the read position has to advance by readInc on every sample, it stops at the end of the table
+	float first = readPosInt[begin] + readPosFrac[begin];
+	float last	= readPosInt[end - 1] + readPosFrac[end - 1];
+
+	EnvelopeCodec::ModalHeader header;
+	auto modes = envelope.getModalModes(header);
+	if (first < header.attackFrames || last >= std::min<float>(header.endFrame, blend.length) - 2) return false;
+
+	// every sample rotates and decays once, so the rotators start one read increment before the first position
+	for (uint32_t m = 0; m < header.numModes; m++)
+	{
+		double decay = modes[m].decay;
+		auto   phase = generator.getPhase() * (modes[m].amplitude * std::pow(decay, double(first) - header.attackFrames - readInc));
+		auto   step	 = generator.getIncrement() * std::pow(decay, double(readInc));
+
+		rotatorReal[numRotators] = phase.real();
+		rotatorImag[numRotators] = phase.imag();
+		stepReal[numRotators]	 = step.real();
+		stepImag[numRotators]	 = step.imag();
+		numRotators++;
+	}
+	return true;
+}
+
+void TablePlayer::processFrames(int begin, int end, unsigned int numBins)
+{
+	auto readPosInt	 = this->readPosInt.data();
+	auto readPosFrac = this->readPosFrac.data();
+	auto writeBuffer = this->writeBuffer.data();
+	auto fadeGain	 = this->fadeGain.data();
+	auto &tableBins	 = blend.bins;
+
+	// the envelope frames used by this run, frame-major: a sample reads two rows with the amplitudes of all bins.
+	// Read positions become relative to the first frame
+	int firstFrame	= readPosInt[begin];
+	int numFrames	= std::min<int>(readPosInt[end - 1] - firstFrame + 2, maxBlockFrames);
+
+	const float * frames;
+	unsigned int  stride;
+
+	// bins silent in all frames of the run are left out, their generators only advance. Sparse envelopes tell
+	// without decoding, the other bins are checked after decoding
+	auto audible	= this->audibleBins.data();
+	int numAudible	= 0;
+	bool fadeActive = fadeGain[begin] > 0;
+	numRotators		= 0;
+
+	if (blend.stream != nullptr || blend.matrix != nullptr || blend.factors != nullptr)
+	{
+		if (blend.stream != nullptr)
+		{
+			// the heads are resident, the frames after them come from the stream thread
+			blend.stream->read(firstFrame, numFrames, this->envelopeBuffer.data(), envelopeBufferStride, this->frameBuffer.data());
+			frames = this->envelopeBuffer.data();
+			stride = envelopeBufferStride;
+		}
+		else if (blend.matrix != nullptr)
+		{
+			frames = blend.matrix->row(firstFrame);
+			stride = blend.matrix->stride;
+		}
+		else
+		{
+			multiplyFactors(firstFrame, numFrames, numBins);
+			frames = this->envelopeBuffer.data();
+			stride = envelopeBufferStride;
+		}
+
+		for (unsigned int f = 0; f < numBins; f++)
+		{
+			// the modes of streamed bins are in the envelopes, their frames are played instead
+			bool silent = !(fadeActive && fadeOffsets[f] != 0);
+			if (silent && blend.stream == nullptr && addModes(tableBins[f], generators[f], begin, end)) continue;
+
+			for (int k = 0; k < numFrames && silent; k++) silent = (frames[k * stride + f] == 0);
+
+			if (!silent) audible[numAudible++] = f;
+		}
+	}
+	else
+	{
+		auto decoded = this->frameBuffer.data();
+		auto buffer	 = this->envelopeBuffer.data();
+		stride = envelopeBufferStride;
+
+		for (unsigned int f = 0; f < numBins; f++)
+		{
+			bool fadeSilent = !(fadeActive && fadeOffsets[f] != 0);
+			if (fadeSilent && isSilent(tableBins[f], firstFrame, numFrames)) continue;
+
+			// decaying bins need no frames, their generators advance like those of silent bins
+			if (fadeSilent && addModes(tableBins[f], generators[f], begin, end)) continue;
+
+			decodeFrames(tableBins[f], firstFrame, numFrames, decoded);
+
+			bool silent = fadeSilent;
+			for (int k = 0; k < numFrames; k++)
+			{
+				buffer[k * stride + f] = decoded[k];
+				silent &= (decoded[k] == 0);
+			}
+
+			if (!silent) audible[numAudible++] = f;
+		}
+		frames = buffer;
+	}
+
+	for (int f = 0, k = 0; f < numBins; f++)
+	{
+		if (k < numAudible && audible[k] == f) k++;
+		else								   generators[f].skip(end - begin);
+	}
+
+	// audible noise bands are played apart from the sines, their generators aren't used
+	auto noise	 = this->noiseBins.data();
+	int numNoise = 0;
+	if (noiseBandBins)
+	{
+		int numSines = 0;
+		for (int k = 0; k < numAudible; k++)
+		{
+			auto f = audible[k];
+			if (tableBins[f].bandwidth > 0) noise[numNoise++]	= f;
+			else							audible[numSines++] = f;
+		}
+		numAudible = numSines;
+	}
+
+	// the rotators of different modes are independent, they run side by side
+	if (numRotators > 0)
+	{
+		auto real	= rotatorReal.data();
+		auto imag	= rotatorImag.data();
+		auto stepRe = stepReal.data();
+		auto stepIm = stepImag.data();
+
+		for (int i = begin; i < end; i++)
+		{
+			double sum = 0;
+			for (unsigned int r = 0; r < numRotators; r++)
+			{
+				double re = real[r] * stepRe[r] - imag[r] * stepIm[r];
+				double im = real[r] * stepIm[r] + imag[r] * stepRe[r];
+				real[r] = re;
+				imag[r] = im;
+				sum += im;
+			}
+			writeBuffer[i] += static_cast<float>(sum);
+		}
+	}
+
+	for (int i = begin; i < end; i++)
+	{
+		readPosInt[i] = std::min(readPosInt[i] - firstFrame, numFrames - 2);
+	}
+
+	// one band after the other, the filter state stays in registers
+	for (int k = 0; k < numNoise; k++)
+	{
+		auto f	   = noise[k];
+		auto &band = noiseBands[f];
+		float offset = fadeActive ? fadeOffsets[f] : 0;
+
+		for (int i = begin; i < end; i++)
+		{
+			auto row = frames + readPosInt[i] * stride;
+
+			float amplitude = (1.f - readPosFrac[i]) * row[f] + (readPosFrac[i]) * row[f + stride];
+			amplitude += offset * fadeGain[i];
+
+			writeBuffer[i] += band.tick() * amplitude;
+		}
+	}
+
+	// the fade gain only decreases within a run
+	if (fadeActive)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			auto row = frames + readPosInt[i] * stride;
+
+			for (int k = 0; k < numAudible; k++)
+			{
+				auto f = audible[k];
+				auto generator = &generators[f];
+
+				float amplitude = (1.f - readPosFrac[i]) * row[f] + (readPosFrac[i]) * row[f + stride];
+				amplitude += fadeOffsets[f] * fadeGain[i];
+
+				writeBuffer[i] += generator->tick() * amplitude;
+			}
+		}
+		return;
 	}
 	
-	auto numBins = std::min(generators.size(), tableBins.size());
-	
-	for (int i = 0; i < cfg.frameSize; i++)
+	for (int i = begin; i < end; i++)
 	{
-		for (int f = 0; f <numBins; f++)
+		auto row = frames + readPosInt[i] * stride;
+
+		for (int k = 0; k < numAudible; k++)
 		{
-			auto &bin = tableBins[f]; // create a reference to the amplitude table to lower access overhead
-			auto &envelope = bin->envelope;
+			auto f = audible[k];
 			auto generator = &generators[f];
 
-			float amplitude = (1.f - readPosFrac[i]) * envelope[readPosInt[i]] + (readPosFrac[i]) * envelope[readPosInt[i] + 1];
+			float amplitude = (1.f - readPosFrac[i]) * row[f] + (readPosFrac[i]) * row[f + stride];
 			float sine = generator->tick();
 
 			writeBuffer[i] += sine * amplitude;
 		}
 	}
+}
 
-	// apply envelope
-	for (int i = 0; i < cfg.frameSize; i++)
+void TablePlayer::processBreakpoints(int begin, int end, unsigned int numBins)
+{
+	auto readPosInt	 = this->readPosInt.data();
+	auto readPosFrac = this->readPosFrac.data();
+	auto writeBuffer = this->writeBuffer.data();
+	auto fadeGain	 = this->fadeGain.data();
+	auto &tableBins	 = blend.bins;
+
+	// read positions stop here, see computeReadPositions()
+	float lastPosition = blend.length - 2;
+	bool  fadeActive   = fadeGain[begin] > 0;
+
+	for (unsigned int f = 0; f < numBins; f++)
 	{
-		data->write[0][i] += 0.5 * writeBuffer[i] * masterEnv.tick();
+		auto &envelope	= *tableBins[f].envelopes[0];
+		auto points		= envelope.getBreakpoints();
+		auto numPoints	= envelope.getNumBreakpoints();
+		auto generator	= &generators[f];
+		auto &segment	= segments[f];
+
+		float position = readPosInt[begin] + readPosFrac[begin];
+
+		// segments are walked forward, start over if the position went back
+		if (segment + 1 >= numPoints || points[segment].frame > position) segment = 0;
+
+		int i = begin;
+		while (i < end)
+		{
+			while (segment + 2 < numPoints && points[segment + 1].frame <= position) segment++;
+
+			float amplitude = (numPoints > 1) ? EnvelopeCodec::interpolate(points + segment, position) : points[0].value;
+			float increment = 0;
+			int	  run		= end - i;
+
+			// linear until the end of the segment (or the last read position)
+			if (numPoints > 1 && position < lastPosition)
+			{
+				float segmentEnd = std::min<float>(points[segment + 1].frame, lastPosition);
+				float slope		 = (points[segment + 1].value - points[segment].value) / float(points[segment + 1].frame - points[segment].frame);
+
+				increment = slope * readInc;
+				run		  = std::max(1, std::min(run, static_cast<int>(std::ceil((segmentEnd - position) / readInc))));
+			}
+
+			if (fadeActive)
+			{
+				for (int n = i; n < i + run; n++)
+				{
+					writeBuffer[n] += generator->tick() * (amplitude + fadeOffsets[f] * fadeGain[n]);
+					amplitude += increment;
+				}
+			}
+			else
+			{
+				for (int n = i; n < i + run; n++)
+				{
+					writeBuffer[n] += generator->tick() * amplitude;
+					amplitude += increment;
+				}
+			}
+
+			i += run;
+			if (i < end) position = readPosInt[i] + readPosFrac[i];
+		}
 	}
 }
 
-void TablePlayer::setTable(const ATable * table)
+void TablePlayer::setTable(std::shared_ptr<const ATable> table)
 {
-	this->table = table; 
+	setBlend(TableBlend::fromTable(std::move(table)));
+}
+
+void TablePlayer::setBlend(TableBlend && blend)
+{
+	// the previous blend goes back to the caller, releasing its tables is left to the caller's thread
+	std::swap(this->blend, blend);
 	prepareTablePlayback();
 }
 
 void TablePlayer::noteOn()
 {
 	this->readPos = 0;
+	this->released		 = false;
+	this->releasePending = false;
+	this->fading		 = false;
+	std::fill(segments.begin(), segments.end(), 0);
 	this->masterEnv.setGate(1);
 }
 
 void TablePlayer::noteOff()
 {
-	this->masterEnv.setGate(0);
+	// tables with a release segment keep playing until the segment ends
+	bool playRelease = (releaseStart >= 0) && !released;
+	released = true;
+
+	if (playRelease) releasePending = true;
+	else			 this->masterEnv.setGate(0);
 }
 
 void TablePlayer::prepareTablePlayback()
 {
 	if (cfg == nullptr) return;
-	if (table == nullptr) return;
+	if (blend.empty()) return;
+
+	auto numBins = blend.bins.size();
 
-	auto numBins = table->getActiveBins().size();
+	readInc = blend.config.sampleRate / (cfg->sampleRate * blend.config.hopSize);
 
-	if (generators.size() < numBins) generators = std::vector<SineGenComplex>(numBins);
+	// a block reads at most frameSize * readInc + 1 frames, one more for rounding
+	maxBlockFrames		 = std::min<unsigned int>(std::ceil(cfg->frameSize * readInc) + 3, blend.length);
+	envelopeBufferStride = (numBins + ATable::MatrixPadding - 1) / ATable::MatrixPadding * ATable::MatrixPadding;
 
+	// nothing to allocate for blends within the limits of prepare()
+	reserve(numBins, maxBlockFrames);
 
 	for (int f = 0; f < numBins; f++)
 	{
 		generators[f] = SineGenComplex(); // reset sine gen
-		auto freq = table->getActiveBins()[f]->frequency * cfg->iSampleRate;
+		auto freq = blend.bins[f].frequency * cfg->iSampleRate;
 		generators[f].setFrequency((freq < 0.5) ? freq : 0);
 		//generators[f].setMaster(&generators[0]);
+
+		// every band gets noise of its own
+		if (blend.bins[f].bandwidth <= 0) continue;
+		noiseBands[f] = NoiseBand();
+		noiseBands[f].setBand(freq, blend.bins[f].bandwidth);
+		noiseBands[f].setSeed(f + 1);
 	}
 
-	readInc = table->getConfig().sampleRate / (cfg->sampleRate * table->getConfig().hopSize);
+	frequencyTracks = std::any_of(blend.bins.begin(), blend.bins.end(), [](const ATable::BlendBin & bin) { return bin.track != nullptr; });
+	noiseBandBins	= std::any_of(blend.bins.begin(), blend.bins.end(), [](const ATable::BlendBin & bin) { return bin.bandwidth > 0; });
+
+	// tables with breakpoint envelopes only are played segment by segment, everything else is decoded per block.
+	// Blended bins are mixed frame by frame, a frame matrix is read directly
+	breakpointPlayback = (blend.matrix == nullptr) && (blend.stream == nullptr) && !noiseBandBins;
+	for (int f = 0; f < numBins; f++)
+	{
+		auto &bin = blend.bins[f];
+		breakpointPlayback &= (bin.envelopes[1] == nullptr) && (bin.envelopes[0]->size() == blend.length);
+		breakpointPlayback &= (bin.envelopes[0]->getEncoding() == Envelope::Encoding::Breakpoint);
+	}
+
+	// loops shorter than a few samples would jump on every sample
+	auto &regions = blend.regions;
+	float length  = blend.length;
+	bool loopValid = regions.hasLoop() && (regions.loopEnd < length) && (regions.loopEnd - regions.loopStart > 2 * readInc);
+
+	loopStart	 = loopValid ? regions.loopStart : -1;
+	loopEnd		 = loopValid ? regions.loopEnd	 : -1;
+	releaseStart = (regions.hasRelease() && regions.releaseStart + 1 < length) ? regions.releaseStart : -1;
+	fading		 = false;
+	std::fill(segments.begin(), segments.end(), 0);
+}
+
+void TablePlayer::reserve(unsigned int numBins, unsigned int blockFrames)
+{
+	auto stride = (numBins + ATable::MatrixPadding - 1) / ATable::MatrixPadding * ATable::MatrixPadding;
+
+	if (generators.size()  < numBins) generators  = std::vector<SineGenComplex>(numBins);
+	if (noiseBands.size()  < numBins) noiseBands  = std::vector<NoiseBand>(numBins);
+	if (segments.size()	   < numBins) segments	  = std::vector<unsigned int>(numBins, 0);
+	if (fadeOffsets.size() < numBins) fadeOffsets = std::vector<float>(numBins, 0);
+
+	if (envelopeBuffer.size() < blockFrames * stride) envelopeBuffer = std::vector<float>(blockFrames * stride, 0);
+	if (frameBuffer.size() < blockFrames) frameBuffer = std::vector<float>(blockFrames, 0);
+	if (mixBuffer.size()   < blockFrames) mixBuffer	  = std::vector<float>(blockFrames, 0);
+	if (audibleBins.size() < numBins)	  audibleBins = std::vector<unsigned int>(numBins, 0);
+	if (noiseBins.size()   < numBins)	  noiseBins	  = std::vector<unsigned int>(numBins, 0);
+	if (streamAmplitudes.size() < 2 * numBins) streamAmplitudes = std::vector<float>(2 * numBins, 0);
+
+	auto maxRotators = numBins * EnvelopeCodec::MaxModalModes;
+	if (rotatorReal.size() < maxRotators)
+	{
+		rotatorReal = rotatorImag = std::vector<double>(maxRotators, 0);
+		stepReal	= stepImag	  = std::vector<double>(maxRotators, 0);
+	}
 }
 
 
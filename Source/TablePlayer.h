@@ -1,6 +1,8 @@
 #pragma once
 
 #include "CQTTable.h"
+#include "TableBlend.h"
+#include "EnvelopeStream.h"
 #include <fstream>
 #include <complex>
 #include <memory>
@@ -11,6 +13,7 @@
 #include "Util/EnvelopeGen.h"
 #include "Util/QuickMovingAverage.h"
 
+using DSPBasics::NoiseBand;
 using DSPBasics::OnePole;
 using DSPBasics::SineGen;
 using DSPBasics::SineGenComplex;
@@ -20,8 +23,11 @@ class TablePlayer
 public:
 	TablePlayer();
 
-	void prepare(const AudioIO::CallbackConfig & cfg);
-	void setTable(const ATable *table);
+	// allocates the buffers for blends up to 'limits' (see TableBlend::Limits), a larger blend allocates when it is set
+	void prepare(const AudioIO::CallbackConfig & cfg, TableBlend::Limits limits = TableBlend::Limits());
+	void setTable(std::shared_ptr<const ATable> table);
+	// takes over 'blend', which receives the blend played before
+	void setBlend(TableBlend && blend);
 
 	void process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackData *data);
 
@@ -33,9 +39,44 @@ private:
 
 	void prepareTablePlayback();
 
+	// grows the buffers to 'numBins' bins and 'blockFrames' envelope frames per block, never shrinks them
+	void reserve(unsigned int numBins, unsigned int blockFrames);
+
+	// advances the read position for the samples [begin, end), returns the sample at which the position jumps
+	// (loop end) or 'end'. A jump that is due at 'begin' is done first
+	int computeReadPositions(int begin, int end);
+
+	// moves the read position to 'position', the amplitude of every bin fades from its current value over CrossfadeFrames
+	void jumpTo(float position);
+
+	// amplitude of an envelope / a bin at a fractional position, frequency tracks are read the same way
+	float amplitudeAt(const Envelope & envelope, float position) const;
+	float amplitudeAt(const ATable::BlendBin & bin, float position) const;
+
+	// sets the frequency of the bins with a frequency track (see ATable::Bin::track) for the samples [begin, end)
+	void updateFrequencies(int begin, int end, unsigned int numBins);
+
+	// writes the frames [start, start + count) of a bin to 'out', mixes both envelopes of blended bins
+	void decodeFrames(const ATable::BlendBin & bin, unsigned int start, unsigned int count, float *out);
+
+	// writes the frames [start, start + count) of all bins to envelopeBuffer, from the factors of the blend
+	void multiplyFactors(unsigned int start, unsigned int count, unsigned int numBins);
+
+	// true if the frames [start, start + count) of a bin are known to be silent without decoding (Sparse envelopes)
+	bool isSilent(const ATable::BlendBin & bin, unsigned int start, unsigned int count) const;
+
+	// adds a rotator per mode of a bin with a Modal envelope for the samples [begin, end), if the run is past its attack
+	// and before its end. The rotators are damped copies of the generator, which isn't advanced. Returns false if the
+	// bin has to be played from its frames
+	bool addModes(const ATable::BlendBin & bin, const SineGenComplex & generator, int begin, int end);
+
+	// fill writeBuffer with the active bins for the samples [begin, end), the read positions don't jump within
+	void processFrames(int begin, int end, unsigned int numBins);		// interpolates decoded envelope frames (or matrix rows / factor products)
+	void processBreakpoints(int begin, int end, unsigned int numBins);	// walks the segments of breakpoint envelopes
+
 private:
 
-	const ATable *table{ nullptr };
+	TableBlend blend;
 
 	float readPos{ 0 }; // read position
 	float readInc{ 0 }; // per sample read position increment
@@ -44,8 +85,26 @@ private:
 	bool tablePreparationRequired{ false };
 	bool gated{ false };
 
+	// sustain loop and release of the table, loopEnd < 0 if the table doesn't loop
+	float loopStart{ -1 };
+	float loopEnd{ -1 };
+	float releaseStart{ -1 };
+	bool  released{ false };		// note off, the loop isn't repeated anymore
+	bool  releasePending{ false };	// jump to the release at the start of the next block
+
+	// crossfade after a jump: fadeOffsets (old - new amplitude per bin) fade out linearly with the read position
+	std::vector<float>	fadeOffsets;
+	std::vector<float>	fadeGain;		// per sample
+	float				fadeStart{ 0 };	// read position the fade started at
+	bool				fading{ false };
+
 	// sine generators
 	std::vector<SineGenComplex>		generators;
+	bool							frequencyTracks{ false };	// a bin has a frequency track
+
+	// filtered noise of the bins that are noise bands (see ATable::Bin::bandwidth), indexed like the generators
+	std::vector<NoiseBand>			noiseBands;
+	bool							noiseBandBins{ false };		// a bin is a noise band
 	AREnvelope						masterEnv;
 	
 	// fast access buffers for read positions
@@ -53,6 +112,27 @@ private:
 	std::vector<float>	readPosFrac;
 	std::vector<float>  writeBuffer;
 
+	// envelope frames read by the current block, decoded for every active bin and stored frame-major
+	// like ATable::FrameMatrix (or multiplied from the factors of the blend). Not used if the blend comes with a matrix
+	std::vector<float>  envelopeBuffer;
+	unsigned int		envelopeBufferStride{ 0 }; // floats per frame, the number of bins padded
+	unsigned int		maxBlockFrames{ 0 };	   // frames a block reads at most
+	std::vector<float>  frameBuffer;			   // frames of one bin before they are spread over the rows
+	std::vector<float>  mixBuffer;				   // frames of the second envelope of a blended bin
+	std::vector<unsigned int> audibleBins;		   // bins that aren't silent in the frames of the current run
+	std::vector<unsigned int> noiseBins;		   // of those, the noise bands
+	std::vector<float>	streamAmplitudes;		   // amplitudes before and after a jump of streamed blends
+
+	// modes of the bins played without envelope frames in the current run (see addModes()), one complex multiply
+	// per mode and sample. Real and imaginary parts are kept apart
+	std::vector<double> rotatorReal, rotatorImag;
+	std::vector<double> stepReal, stepImag;
+	unsigned int		numRotators{ 0 };
+
+	// current segment of every active bin, if all envelopes are breakpoint envelopes
+	bool						breakpointPlayback{ false };
+	std::vector<unsigned int>	segments;
+
 	std::unique_ptr<AudioIO::CallbackConfig > cfg;
 	
 };
@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+/*
+	Bookkeeping of where tables come from. The TableManager records the source text file of every imported
+	table and the source notes of every prepared (interpolated / shifted) table, the cache stores both so that
+	only tables with changed sources have to be rebuilt.
+*/
+
+// text file a source table was parsed from
+struct SourceFile
+{
+	std::string path;
+	uint64_t	size{ 0 };
+	int64_t		modificationTime{ 0 };	// seconds since epoch
+	uint64_t	hash{ 0 };				// FNV-1a of the file content
+
+	inline bool sameStat(const SourceFile & rhs) const
+	{
+		return (size == rhs.size) && (modificationTime == rhs.modificationTime);
+	}
+};
+
+// describes how the table of a midi note was created
+struct TableOrigin
+{
+	enum class Type : uint32_t
+	{
+		None		 = 0,	// no table
+		Source		 = 1,	// parsed from a text file, see sourceFile
+		Interpolated = 2,	// interpolated between the source tables of notes lower and upper
+		Shifted		 = 3	// shifted from the source table of note lower
+	};
+
+	Type type{ Type::None };
+	int  lower{ -1 };
+	int  upper{ -1 };
+	int  sourceFile{ -1 };	// index of the SourceFile, source tables only
+
+	inline bool operator==(const TableOrigin & rhs) const
+	{
+		return (type == rhs.type) && (lower == rhs.lower) && (upper == rhs.upper);
+	}
+	inline bool operator!=(const TableOrigin & rhs) const { return !(*this == rhs); }
+};
@@ -0,0 +1,225 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#if _WIN32
+	#include <malloc.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+/*
+	Arena hands out 64 byte aligned memory from large blocks, so data allocated one after another (e.g. the
+	envelopes of a table) lies next to each other instead of being scattered over the heap. Allocations aren't
+	freed one by one, a block is released once the arena moved on to the next block and every allocation of the
+	block is gone (see allocate()).
+
+	Blocks can be backed by huge pages, which saves TLB entries when walking many envelopes:
+		Transparent		the block is aligned to the huge page size and the kernel is advised to use transparent
+						huge pages for it
+		Explicit		the block is mapped from the huge page pool, which has to be reserved by the system
+						(vm.nr_hugepages). Falls back to normal pages if the pool is exhausted
+	Huge pages are only supported on Linux, other systems use normal pages.
+*/
+class Arena
+{
+public:
+	enum class Pages
+	{
+		Normal,
+		Transparent,
+		Explicit
+	};
+
+	struct Stats
+	{
+		uint64_t reserved{ 0 };			// bytes of all blocks created
+		uint64_t used{ 0 };				// bytes handed out, including alignment
+		uint64_t allocations{ 0 };
+		uint64_t blocks{ 0 };
+		uint64_t hugePageBlocks{ 0 };	// blocks backed by huge pages (as far as the system told)
+	};
+
+	static const size_t Alignment		 = 64;
+	static const size_t HugePageSize	 = 2 * 1024 * 1024;
+	static const size_t DefaultBlockSize = 2 * HugePageSize;
+
+	inline Arena(Pages pages = Pages::Normal, size_t blockSize = DefaultBlockSize);
+
+	Arena(const Arena &) = delete;
+	Arena & operator=(const Arena &) = delete;
+
+	// returns 'size' bytes, 'owner' is set to a reference keeping them alive. Returns nullptr if out of memory
+	inline void * allocate(size_t size, std::shared_ptr<const void> & owner);
+
+	inline Stats getStats() const;
+	inline Pages getPages() const { return pages; }
+
+	// "normal", "thp" or "huge", returns false for anything else
+	static inline bool parsePages(const std::string & name, Pages & pages);
+
+private:
+	class Block;
+
+	static inline size_t align(size_t size, size_t alignment) { return (size + alignment - 1) / alignment * alignment; }
+
+	Pages					pages;
+	size_t					blockSize;
+	std::shared_ptr<Block>	current;
+	size_t					offset{ 0 };	// next free byte in current
+	Stats					stats;
+	mutable std::mutex		mutex;
+};
+
+// memory of a block, released when the last allocation referencing it is gone
+class Arena::Block
+{
+public:
+	inline Block(size_t size, Pages pages);
+	inline ~Block();
+
+	Block(const Block &) = delete;
+	Block & operator=(const Block &) = delete;
+
+	char *	data{ nullptr };
+	size_t	size{ 0 };
+	bool	huge{ false };
+
+private:
+	bool	mapped{ false };	// mmap'ed instead of allocated
+};
+
+
+inline Arena::Arena(Pages pages, size_t blockSize) : pages(pages)
+{
+	// std::max takes references, Alignment has no definition outside the class
+	size_t alignment = Alignment;
+	this->blockSize = align(std::max(blockSize, alignment), alignment);
+}
+
+inline void * Arena::allocate(size_t size, std::shared_ptr<const void>& owner)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	size = align(std::max<size_t>(size, 1), Alignment);
+
+	// large allocations get a block of their own, the current block stays in use
+	std::shared_ptr<Block> block;
+	if (size > blockSize / 4)
+	{
+		block = std::make_shared<Block>(size, pages);
+	}
+	else
+	{
+		if (current == nullptr || offset + size > current->size)
+		{
+			current = std::make_shared<Block>(blockSize, pages);
+			offset	= 0;
+		}
+		block = current;
+	}
+
+	if (block->data == nullptr)
+	{
+		if (block == current) current = nullptr;
+		return nullptr;
+	}
+
+	// a new block
+	if (block != current || offset == 0)
+	{
+		stats.reserved += block->size;
+		stats.blocks++;
+		if (block->huge) stats.hugePageBlocks++;
+	}
+
+	char * data = block->data;
+	if (block == current)
+	{
+		data   += offset;
+		offset += size;
+	}
+
+	stats.used += size;
+	stats.allocations++;
+
+	owner = std::shared_ptr<const void>(block, data);
+	return data;
+}
+
+inline Arena::Stats Arena::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+inline bool Arena::parsePages(const std::string & name, Pages & pages)
+{
+	if		(name == "normal")	pages = Pages::Normal;
+	else if (name == "thp")		pages = Pages::Transparent;
+	else if (name == "huge")	pages = Pages::Explicit;
+	else return false;
+	return true;
+}
+
+#if _WIN32
+
+inline Arena::Block::Block(size_t size, Pages pages)
+{
+	// large pages need a privilege on Windows, normal pages are used
+	data = static_cast<char*>(_aligned_malloc(size, Alignment));
+	if (data != nullptr) this->size = size;
+}
+
+inline Arena::Block::~Block()
+{
+	if (data != nullptr) _aligned_free(data);
+}
+
+#else
+
+inline Arena::Block::Block(size_t size, Pages pages)
+{
+#ifdef MAP_HUGETLB
+	if (pages == Pages::Explicit)
+	{
+		auto hugeSize = align(size, HugePageSize);
+		void * ptr = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED)
+		{
+			data	   = static_cast<char*>(ptr);
+			this->size = hugeSize;
+			huge	   = true;
+			mapped	   = true;
+			return;
+		}
+	}
+#endif
+
+	// transparent huge pages only back ranges aligned to the huge page size
+	size_t alignment = (pages == Pages::Normal) ? Alignment : HugePageSize;
+	void * ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size) != 0) return;
+
+	data	   = static_cast<char*>(ptr);
+	this->size = size;
+
+#ifdef MADV_HUGEPAGE
+	if (pages != Pages::Normal) huge = (madvise(ptr, size, MADV_HUGEPAGE) == 0);
+#endif
+}
+
+inline Arena::Block::~Block()
+{
+	if (data == nullptr) return;
+
+	if (mapped) munmap(data, size);
+	else		free(data);
+}
+
+#endif
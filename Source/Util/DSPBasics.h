@@ -1,5 +1,6 @@
 #pragma once
 #include <complex>
+#include <cstdint>
 
 #ifndef M_PI
 	#define M_PI 3.14159265358979323846
@@ -16,10 +17,18 @@ namespace DSPBasics
 		inline void	 setFrequency(double normalizedFrequency);
 		inline float tick();
 
+		// advances the phase by 'numSamples' ticks without computing them
+		inline void	 skip(unsigned int numSamples);
+
+		// phase of the last tick and rotation per sample, e.g. to run damped copies of the generator
+		inline const std::complex<double> & getPhase()	   const { return phase; }
+		inline const std::complex<double> & getIncrement() const { return phaseInc; }
+
 	private:
 
 		std::complex<double>  phase;
 		std::complex<double>  phaseInc;
+		double				  frequency{ 0 };
 	};
 
 	class SineGen
@@ -60,6 +69,28 @@ namespace DSPBasics
 	};
 
 
+	// white noise through a band pass (RBJ biquad with 0 dB peak gain). The output has the power of a sine with
+	// amplitude 1, noise bands and sines of the same amplitude are equally loud
+	class NoiseBand
+	{
+	public:
+		NoiseBand() = default;
+
+		// center frequency and width in octaves between the -3 dB points. Silent at or above Nyquist
+		inline void	 setBand(double normalizedFrequency, double octaves);
+
+		// generators with different seeds are uncorrelated
+		inline void	 setSeed(uint32_t seed);
+		inline float tick();
+
+	private:
+		uint32_t state{ 1 };
+		float	 b0{ 0 };	// b1 = 0, b2 = -b0
+		float	 a1{ 0 };
+		float	 a2{ 0 };
+		float	 x1{ 0 }, x2{ 0 }, y1{ 0 }, y2{ 0 };
+	};
+
 	class OnePole
 	{
 	public:
@@ -88,7 +119,8 @@ inline DSPBasics::SineGenComplex::SineGenComplex() :
 
 inline void DSPBasics::SineGenComplex::setFrequency(double normalizedFrequency)
 {
-	this->phaseInc = std::polar<double>(1., normalizedFrequency * 2. * M_PI);
+	this->phaseInc	= std::polar<double>(1., normalizedFrequency * 2. * M_PI);
+	this->frequency = normalizedFrequency;
 }
 
 inline float DSPBasics::SineGenComplex::tick()
@@ -97,6 +129,53 @@ inline float DSPBasics::SineGenComplex::tick()
 	return phase.imag();
 }
 
+inline void DSPBasics::SineGenComplex::skip(unsigned int numSamples)
+{
+	phase *= std::polar<double>(1., std::fmod(frequency * numSamples, 1.) * 2. * M_PI);
+}
+
+inline void DSPBasics::NoiseBand::setBand(double normalizedFrequency, double octaves)
+{
+	if (normalizedFrequency <= 0 || normalizedFrequency >= 0.5)
+	{
+		b0 = a1 = a2 = 0;
+		return;
+	}
+
+	double w	 = 2. * M_PI * normalizedFrequency;
+	double alpha = std::sin(w) * std::sinh(std::log(2.) / 2. * octaves * w / std::sin(w));
+	double a0	 = 1. + alpha;
+
+	// the power gain of the band pass is alpha / (1 + alpha), uniform noise has a power of 1/3 and the sine 1/2
+	double gain = std::sqrt(1.5 * (1. + alpha) / alpha);
+
+	b0 = static_cast<float>(gain * alpha / a0);
+	a1 = static_cast<float>(-2. * std::cos(w) / a0);
+	a2 = static_cast<float>((1. - alpha) / a0);
+}
+
+inline void DSPBasics::NoiseBand::setSeed(uint32_t seed)
+{
+	// xorshift needs a state other than 0, neighbouring seeds are spread apart
+	state = seed * 2654435761u;
+	if (state == 0) state = 1;
+}
+
+inline float DSPBasics::NoiseBand::tick()
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	float x = static_cast<int32_t>(state) * (1.f / 2147483648.f);
+
+	float y = b0 * (x - x2) - a1 * y1 - a2 * y2;
+	x2 = x1;
+	x1 = x;
+	y2 = y1;
+	y1 = y;
+	return y;
+}
+
 void DSPBasics::OnePole::setCutoff(float normalizedCutoff)
 {
 	a1 = -std::exp(-2.0 * M_PI * normalizedCutoff);
@@ -0,0 +1,647 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+/*
+	EnvelopeCodec implements the sample encodings of envelopes. All encodings except Float32 store the
+	samples relative to a per envelope scale (the peak amplitude), the scale is kept next to the data.
+
+		Float32		4 bytes per frame, lossless
+		Float16		2 bytes per frame, half precision. Values more than 84 dB below the scale are flushed to zero
+		Decibel8	1 byte per frame, log amplitude in 0.375 dB steps covering 95 dB, 0 is silence
+		Delta8		1 byte per frame plus a 2 byte key frame every 32 frames. Log amplitude in 0.25 dB steps
+					covering 120 dB, stored as difference to the previous frame. Changes faster than 31.75 dB
+					per frame are spread over several frames
+		Breakpoint	8 bytes per breakpoint, the envelope is linear between breakpoints. simplify() picks the
+					breakpoints so the envelope stays within a dB tolerance, smooth decays need only a few
+		Sparse		only the runs of frames above a floor as float32, everything else is silence. 4 bytes for the
+					number of runs, 12 bytes per run (SparseRun) and 4 bytes per frame within a run. For bins that
+					are mostly silent, see encodeSparse()
+		LowRank		one column of a factorized table (see LowRank.h), the frames are the activations of the
+					table times the template weights of the bin. The data is a LowRankColumn referencing the
+					factors, which are shared by all bins of the table. Created by ATable::factorize() only
+		Modal		a sum of exponential decays after the attack (see ModalFit.h), the frames of the attack as float32.
+					12 bytes for the ModalHeader, 8 bytes per mode (ModalMode) and 4 bytes per attack frame. Frames
+					from the end frame on are silent. For percussive bins, created by ATable::fitModes() only
+
+	decode() converts a range of frames into floats. The conversion loops are branch free so the compiler
+	can vectorize them, Delta8 has to accumulate the differences first.
+*/
+namespace EnvelopeCodec
+{
+	enum class Encoding : uint32_t
+	{
+		Float32	   = 0,
+		Float16	   = 1,
+		Decibel8   = 2,
+		Delta8	   = 3,
+		Breakpoint = 4,
+		Sparse	   = 5,
+		LowRank	   = 6,
+		Modal	   = 7
+	};
+
+	const unsigned int NumEncodings		 = 8;
+
+	const float		   Decibel8Step		 = 0.375f;	// dB per level
+	const unsigned int Decibel8Levels	 = 256;		// level 0 is silence
+
+	const float		   Delta8Step		 = 0.25f;	// dB per level
+	const unsigned int Delta8Levels		 = 481;		// level 0 is -120 dB
+	const unsigned int Delta8KeyInterval = 32;		// frames per key frame
+
+	const float		   DefaultBreakpointTolerance = 0.5f;	// dB
+	const float		   BreakpointRange			  = 80.f;	// dB below the peak in which the tolerance applies
+
+	const unsigned int SparseMaxGap		 = 3;		// shorter gaps between runs are stored, a run costs as much as 3 frames
+
+	struct Breakpoint
+	{
+		uint32_t frame;
+		float	 value;
+	};
+
+	struct SparseRun
+	{
+		uint32_t start;		// first frame
+		uint32_t length;	// frames
+		uint32_t offset;	// index of the first value of the run in the values of all runs
+	};
+
+	struct LowRankColumn
+	{
+		const float *activations;	// numFrames x rank
+		const float *templates;		// rank x stride
+		uint32_t	 rank;
+		uint32_t	 stride;		// floats per template
+		uint32_t	 column;		// of the bin in the templates
+		uint32_t	 numFrames;		// of the activations
+	};
+
+	const unsigned int MaxLowRank		 = 64;
+
+	struct ModalHeader
+	{
+		uint32_t attackFrames;	// stored as they are, after the modes
+		uint32_t numModes;
+		uint32_t endFrame;		// first silent frame
+	};
+
+	struct ModalMode
+	{
+		float amplitude;	// at the end of the attack
+		float decay;		// factor per frame, (0, 1]
+	};
+
+	const unsigned int MaxModalModes	 = 4;
+
+	inline const char * getName(Encoding encoding);
+
+	// accepts the names returned by getName(), returns false if unknown. LowRank and Modal can't be picked, envelopes
+	// can't be converted to them one by one
+	inline bool parseName(const std::string &name, Encoding &encoding);
+
+	// number of bytes required to store 'length' frames, 0 for Breakpoint, Sparse, LowRank and Modal (variable size)
+	inline size_t getByteSize(Encoding encoding, unsigned int length);
+
+	// encodes 'length' frames into 'out' (getByteSize() bytes), returns the scale the frames are stored relative to.
+	// Not for Breakpoint, Sparse, LowRank and Modal, see simplify(), encodeSparse() and encodeModal()
+	inline float encode(Encoding encoding, const float *samples, unsigned int length, uint8_t *out);
+
+	// decodes the frames [start, start + count) of an encoded envelope with 'length' frames ('byteSize' bytes) into 'out'
+	inline void decode(Encoding encoding, const void *data, size_t byteSize, unsigned int length, float scale, unsigned int start, unsigned int count, float *out);
+
+	// checks that 'byteSize' bytes of data are a valid envelope with 'length' frames. The factors referenced by
+	// LowRank envelopes can't be checked, only the column itself
+	inline bool isValid(Encoding encoding, const void *data, size_t byteSize, unsigned int length);
+
+	// picks breakpoints so that the linear interpolation between them is within 'tolerance' dB of the samples
+	// (Ramer-Douglas-Peucker with the error measured in dB). The first and last frame are always breakpoints
+	inline std::vector<Breakpoint> simplify(const float *samples, unsigned int length, float tolerance);
+
+	// value of the segment starting at 'point' at (fractional) frame 'position'
+	inline float interpolate(const Breakpoint *point, float position);
+
+	// encodes the runs of frames above 'floor' as Sparse envelope, the frames outside the runs decode to silence.
+	// Runs closer than SparseMaxGap frames are joined, the frames in between are kept
+	inline std::vector<uint8_t> encodeSparse(const float *samples, unsigned int length, float floor);
+
+	// runs of a Sparse envelope, the values follow the runs
+	inline const SparseRun * getSparseRuns(const void *data, uint32_t &numRuns);
+
+	// stores the modes and the first 'header.attackFrames' frames of 'samples'
+	inline std::vector<uint8_t> encodeModal(const ModalHeader &header, const ModalMode *modes, const float *samples);
+
+	// modes of a Modal envelope, the attack frames follow the modes
+	inline const ModalMode * getModalModes(const void *data, ModalHeader &header);
+
+	// true if the frames [start, start + count) are known to be silent without decoding them, only Sparse and Modal
+	// envelopes tell. Frames beyond the end of the envelope are silent
+	inline bool isSilent(Encoding encoding, const void *data, unsigned int length, unsigned int start, unsigned int count);
+
+
+	// #################### HELPER ####################
+
+	inline uint16_t floatToHalf(float value);
+
+	// amplitude relative to the scale for every level
+	inline const float * getDecibel8Table();
+	inline const float * getDelta8Table();
+
+	// converts an amplitude relative to the scale into a (not rounded) log level
+	inline float toLevel(float relative, float step, unsigned int numLevels);
+};
+
+
+// #################### FREE FUNCTIONS ####################
+
+const char * EnvelopeCodec::getName(Encoding encoding)
+{
+	switch (encoding)
+	{
+		case Encoding::Float32:	   return "f32";
+		case Encoding::Float16:	   return "f16";
+		case Encoding::Decibel8:   return "db8";
+		case Encoding::Delta8:	   return "delta8";
+		case Encoding::Breakpoint: return "bp";
+		case Encoding::Sparse:	   return "sparse";
+		case Encoding::LowRank:	   return "lowrank";
+		case Encoding::Modal:	   return "modal";
+		default:				   return "invalid";
+	}
+}
+
+bool EnvelopeCodec::parseName(const std::string & name, Encoding & encoding)
+{
+	for (unsigned int i = 0; i < NumEncodings; i++)
+	{
+		if (static_cast<Encoding>(i) == Encoding::LowRank || static_cast<Encoding>(i) == Encoding::Modal) continue;
+
+		if (name == getName(static_cast<Encoding>(i)))
+		{
+			encoding = static_cast<Encoding>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t EnvelopeCodec::getByteSize(Encoding encoding, unsigned int length)
+{
+	switch (encoding)
+	{
+		case Encoding::Float32:	 return size_t(length) * sizeof(float);
+		case Encoding::Float16:	 return size_t(length) * sizeof(uint16_t);
+		case Encoding::Decibel8: return size_t(length);
+		case Encoding::Delta8:	 return size_t((length + Delta8KeyInterval - 1) / Delta8KeyInterval) * sizeof(uint16_t) + length;
+		default:				 return 0;
+	}
+}
+
+float EnvelopeCodec::encode(Encoding encoding, const float * samples, unsigned int length, uint8_t * out)
+{
+	if (encoding == Encoding::Float32)
+	{
+		std::memcpy(out, samples, length * sizeof(float));
+		return 1;
+	}
+
+	float scale = 0;
+	for (unsigned int i = 0; i < length; i++) scale = std::max(scale, std::abs(samples[i]));
+	if (scale <= 0) scale = 1;
+
+	if (encoding == Encoding::Float16)
+	{
+		auto halfs = reinterpret_cast<uint16_t*>(out);
+		for (unsigned int i = 0; i < length; i++) halfs[i] = floatToHalf(samples[i] / scale);
+	}
+	else if (encoding == Encoding::Decibel8)
+	{
+		for (unsigned int i = 0; i < length; i++)
+		{
+			auto level = toLevel(std::abs(samples[i]) / scale, Decibel8Step, Decibel8Levels);
+
+			// level 0 is silence, everything that would round to it is dropped
+			out[i] = (level < 0.5f) ? 0 : static_cast<uint8_t>(std::max(1.f, std::round(level)));
+		}
+	}
+	else if (encoding == Encoding::Delta8)
+	{
+		auto keys	= reinterpret_cast<uint16_t*>(out);
+		auto deltas = reinterpret_cast<int8_t*>(out + getByteSize(encoding, length) - length);
+
+		// the differences are taken to the reconstructed level, rounding errors don't accumulate
+		int level = 0;
+		for (unsigned int i = 0; i < length; i++)
+		{
+			int target = static_cast<int>(std::round(std::max(0.f, toLevel(std::abs(samples[i]) / scale, Delta8Step, Delta8Levels))));
+
+			if (i % Delta8KeyInterval == 0)
+			{
+				level = target;
+				keys[i / Delta8KeyInterval] = static_cast<uint16_t>(level);
+				deltas[i] = 0;
+			}
+			else
+			{
+				int delta = std::min(127, std::max(-127, target - level));
+				deltas[i] = static_cast<int8_t>(delta);
+				level += delta;
+			}
+		}
+	}
+	return scale;
+}
+
+void EnvelopeCodec::decode(Encoding encoding, const void * data, size_t byteSize, unsigned int length, float scale, unsigned int start, unsigned int count, float * out)
+{
+	if (count == 0) return;
+
+	if (encoding == Encoding::Float32)
+	{
+		std::memcpy(out, static_cast<const float*>(data) + start, count * sizeof(float));
+	}
+	else if (encoding == Encoding::Float16)
+	{
+		auto halfs = static_cast<const uint16_t*>(data) + start;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			// rebias the exponent, halfs are normal numbers or zero
+			uint32_t magnitude = halfs[i] & 0x7fff;
+			uint32_t bits	   = (uint32_t(halfs[i] & 0x8000) << 16) | ((magnitude != 0) ? (magnitude << 13) + 0x38000000 : 0);
+
+			float value;
+			std::memcpy(&value, &bits, sizeof(float));
+			out[i] = value * scale;
+		}
+	}
+	else if (encoding == Encoding::Decibel8)
+	{
+		auto levels = static_cast<const uint8_t*>(data) + start;
+		auto table	= getDecibel8Table();
+		for (unsigned int i = 0; i < count; i++) out[i] = table[levels[i]] * scale;
+	}
+	else if (encoding == Encoding::Delta8)
+	{
+		auto bytes	= static_cast<const uint8_t*>(data);
+		auto keys	= reinterpret_cast<const uint16_t*>(bytes);
+		auto deltas = reinterpret_cast<const int8_t*>(bytes + getByteSize(encoding, length) - length);
+		auto table	= getDelta8Table();
+
+		// start at the key frame in front of the range
+		unsigned int frame = start - start % Delta8KeyInterval;
+		int level = keys[frame / Delta8KeyInterval];
+		for (frame++; frame <= start; frame++) level += deltas[frame];
+
+		int maxLevel = Delta8Levels - 1;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned int idx = start + i;
+			if (i > 0) level = (idx % Delta8KeyInterval == 0) ? keys[idx / Delta8KeyInterval] : level + deltas[idx];
+
+			// the cache file might be corrupted, never index outside the table
+			out[i] = table[std::min(maxLevel, std::max(0, level))] * scale;
+		}
+	}
+	else if (encoding == Encoding::Breakpoint)
+	{
+		auto points	   = static_cast<const Breakpoint*>(data);
+		auto numPoints = byteSize / sizeof(Breakpoint);
+
+		// first segment containing start, then walk along
+		auto compare = [](const Breakpoint &point, unsigned int frame) { return point.frame <= frame; };
+		size_t segment = std::lower_bound(points, points + numPoints, start, compare) - points;
+		segment = (segment > 0) ? segment - 1 : 0;
+
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned int frame = start + i;
+			while (segment + 2 < numPoints && points[segment + 1].frame <= frame) segment++;
+			out[i] = (segment + 1 < numPoints) ? interpolate(points + segment, float(frame)) : points[segment].value;
+		}
+	}
+	else if (encoding == Encoding::Sparse)
+	{
+		uint32_t numRuns;
+		auto runs	= getSparseRuns(data, numRuns);
+		auto values = reinterpret_cast<const float*>(runs + numRuns);
+		auto end	= start + count;
+
+		std::fill(out, out + count, 0.f);
+
+		// first run ending behind start
+		auto compare = [](unsigned int frame, const SparseRun &run) { return frame < run.start + run.length; };
+		for (auto run = std::upper_bound(runs, runs + numRuns, start, compare); run != runs + numRuns && run->start < end; run++)
+		{
+			auto first = std::max(start, run->start);
+			auto last  = std::min(end, run->start + run->length);
+			std::memcpy(out + (first - start), values + run->offset + (first - run->start), (last - first) * sizeof(float));
+		}
+	}
+	else if (encoding == Encoding::LowRank)
+	{
+		auto column = static_cast<const LowRankColumn*>(data);
+		auto rank	= std::min<uint32_t>(column->rank, MaxLowRank);
+
+		// the weights of the bin are strided, gathered once
+		float weights[MaxLowRank];
+		for (uint32_t k = 0; k < rank; k++) weights[k] = column->templates[size_t(k) * column->stride + column->column];
+
+		// the approximation can undershoot near silence, amplitudes aren't negative
+		auto activations = column->activations + size_t(start) * column->rank;
+		for (unsigned int i = 0; i < count; i++, activations += column->rank)
+		{
+			float sum = 0;
+			for (uint32_t k = 0; k < rank; k++) sum += activations[k] * weights[k];
+			out[i] = std::max(0.f, sum);
+		}
+	}
+	else if (encoding == Encoding::Modal)
+	{
+		ModalHeader header;
+		auto modes	= getModalModes(data, header);
+		auto attack = reinterpret_cast<const float*>(modes + header.numModes);
+
+		unsigned int i = 0;
+		for (; i < count && start + i < header.attackFrames; i++) out[i] = attack[start + i];
+
+		// every mode is a geometric series from the end of the attack on
+		auto decaying = std::max(i, std::min(count, header.endFrame - std::min(start, header.endFrame)));
+		std::fill(out + i, out + count, 0.f);
+		for (uint32_t m = 0; m < header.numModes && i < decaying; m++)
+		{
+			double value = modes[m].amplitude * std::pow(double(modes[m].decay), double(start + i - header.attackFrames));
+			for (unsigned int k = i; k < decaying; k++)
+			{
+				out[k] += static_cast<float>(value);
+				value  *= modes[m].decay;
+			}
+		}
+	}
+}
+
+bool EnvelopeCodec::isValid(Encoding encoding, const void * data, size_t byteSize, unsigned int length)
+{
+	if (static_cast<uint32_t>(encoding) >= NumEncodings) return false;
+
+	if (encoding == Encoding::Sparse)
+	{
+		if (byteSize < sizeof(uint32_t)) return false;
+
+		uint32_t numRuns;
+		auto runs = getSparseRuns(data, numRuns);
+		if (numRuns > (byteSize - sizeof(uint32_t)) / sizeof(SparseRun)) return false;
+
+		// runs are ordered, don't overlap and their values are stored one after another
+		uint64_t numValues = 0;
+		uint64_t frame	   = 0;
+		for (uint32_t i = 0; i < numRuns; i++)
+		{
+			if (runs[i].length == 0 || runs[i].start < frame || runs[i].offset != numValues) return false;
+			frame	   = uint64_t(runs[i].start) + runs[i].length;
+			numValues += runs[i].length;
+		}
+		return (frame <= length) && (byteSize == sizeof(uint32_t) + numRuns * sizeof(SparseRun) + numValues * sizeof(float));
+	}
+
+	if (encoding == Encoding::LowRank)
+	{
+		if (byteSize != sizeof(LowRankColumn)) return false;
+
+		auto column = static_cast<const LowRankColumn*>(data);
+		return (column->activations != nullptr) && (column->templates != nullptr) && (column->rank > 0) && (column->rank <= MaxLowRank)
+			&& (column->column < column->stride) && (length <= column->numFrames);
+	}
+
+	if (encoding == Encoding::Modal)
+	{
+		if (byteSize < sizeof(ModalHeader)) return false;
+
+		ModalHeader header;
+		auto modes = getModalModes(data, header);
+		if (header.numModes > MaxModalModes || header.attackFrames > header.endFrame || header.endFrame > length) return false;
+		if (byteSize != sizeof(ModalHeader) + header.numModes * sizeof(ModalMode) + size_t(header.attackFrames) * sizeof(float)) return false;
+
+		// the player renders the modes as they are, they have to decay
+		for (uint32_t m = 0; m < header.numModes; m++)
+		{
+			if (!(modes[m].amplitude >= 0) || std::isinf(modes[m].amplitude) || !(modes[m].decay > 0 && modes[m].decay <= 1)) return false;
+		}
+		return true;
+	}
+
+	if (encoding != Encoding::Breakpoint) return byteSize == getByteSize(encoding, length);
+
+	auto points	   = static_cast<const Breakpoint*>(data);
+	auto numPoints = byteSize / sizeof(Breakpoint);
+
+	if (byteSize % sizeof(Breakpoint) != 0) return false;
+	if (length == 0) return numPoints == 0;
+	if (numPoints == 0 || points[0].frame != 0 || points[numPoints - 1].frame != length - 1) return false;
+
+	for (size_t i = 1; i < numPoints; i++)
+	{
+		if (points[i].frame <= points[i - 1].frame) return false;
+	}
+	return true;
+}
+
+std::vector<EnvelopeCodec::Breakpoint> EnvelopeCodec::simplify(const float * samples, unsigned int length, float tolerance)
+{
+	if (length == 0) return std::vector<Breakpoint>();
+
+	float peak = 0;
+	for (unsigned int i = 0; i < length; i++) peak = std::max(peak, std::abs(samples[i]));
+
+	// everything below the floor is considered equal to it
+	float floor = std::max(peak * std::pow(10.f, -BreakpointRange / 20.f), 1e-20f);
+	auto toDecibel = [floor](float value) { return 20.f * std::log10(std::max(std::abs(value), floor)); };
+
+	std::vector<bool> keep(length, false);
+	keep[0]			 = true;
+	keep[length - 1] = true;
+
+	// segments [first, last] that still have to be checked
+	std::vector<std::pair<unsigned int, unsigned int>> segments;
+	if (length > 2) segments.push_back({ 0, length - 1 });
+
+	while (!segments.empty())
+	{
+		auto segment = segments.back();
+		segments.pop_back();
+
+		Breakpoint first = { segment.first, samples[segment.first] };
+		Breakpoint last	 = { segment.second, samples[segment.second] };
+		Breakpoint points[2] = { first, last };
+
+		// frame with the largest error of the linear segment
+		float		 maxError = 0;
+		unsigned int maxFrame = 0;
+		for (unsigned int i = segment.first + 1; i < segment.second; i++)
+		{
+			float error = std::abs(toDecibel(interpolate(points, float(i))) - toDecibel(samples[i]));
+			if (error > maxError)
+			{
+				maxError = error;
+				maxFrame = i;
+			}
+		}
+
+		if (maxError > tolerance)
+		{
+			keep[maxFrame] = true;
+			if (maxFrame - segment.first  > 1) segments.push_back({ segment.first, maxFrame });
+			if (segment.second - maxFrame > 1) segments.push_back({ maxFrame, segment.second });
+		}
+	}
+
+	std::vector<Breakpoint> breakpoints;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		if (keep[i]) breakpoints.push_back({ i, samples[i] });
+	}
+	return breakpoints;
+}
+
+float EnvelopeCodec::interpolate(const Breakpoint * point, float position)
+{
+	float slope = (point[1].value - point[0].value) / float(point[1].frame - point[0].frame);
+	return point[0].value + slope * (position - float(point[0].frame));
+}
+
+
+std::vector<uint8_t> EnvelopeCodec::encodeSparse(const float * samples, unsigned int length, float floor)
+{
+	std::vector<SparseRun> runs;
+	std::vector<float>	   values;
+
+	for (unsigned int i = 0; i < length; i++)
+	{
+		if (std::abs(samples[i]) <= floor) continue;
+
+		if (!runs.empty() && i - (runs.back().start + runs.back().length) <= SparseMaxGap)
+		{
+			// the gap becomes part of the run
+			auto &run = runs.back();
+			values.insert(values.end(), samples + run.start + run.length, samples + i + 1);
+			run.length = i + 1 - run.start;
+		}
+		else
+		{
+			runs.push_back({ i, 1, static_cast<uint32_t>(values.size()) });
+			values.push_back(samples[i]);
+		}
+	}
+
+	uint32_t numRuns = runs.size();
+	std::vector<uint8_t> out(sizeof(uint32_t) + runs.size() * sizeof(SparseRun) + values.size() * sizeof(float));
+
+	auto bytes = out.data();
+	std::memcpy(bytes, &numRuns, sizeof(uint32_t));
+	if (!runs.empty())	 std::memcpy(bytes + sizeof(uint32_t), runs.data(), runs.size() * sizeof(SparseRun));
+	if (!values.empty()) std::memcpy(bytes + sizeof(uint32_t) + runs.size() * sizeof(SparseRun), values.data(), values.size() * sizeof(float));
+	return out;
+}
+
+const EnvelopeCodec::SparseRun * EnvelopeCodec::getSparseRuns(const void * data, uint32_t & numRuns)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+	std::memcpy(&numRuns, bytes, sizeof(uint32_t));
+	return reinterpret_cast<const SparseRun*>(bytes + sizeof(uint32_t));
+}
+
+std::vector<uint8_t> EnvelopeCodec::encodeModal(const ModalHeader & header, const ModalMode * modes, const float * samples)
+{
+	size_t modesSize = header.numModes * sizeof(ModalMode);
+	std::vector<uint8_t> out(sizeof(ModalHeader) + modesSize + size_t(header.attackFrames) * sizeof(float));
+
+	auto bytes = out.data();
+	std::memcpy(bytes, &header, sizeof(ModalHeader));
+	if (header.numModes > 0)	 std::memcpy(bytes + sizeof(ModalHeader), modes, modesSize);
+	if (header.attackFrames > 0) std::memcpy(bytes + sizeof(ModalHeader) + modesSize, samples, header.attackFrames * sizeof(float));
+	return out;
+}
+
+const EnvelopeCodec::ModalMode * EnvelopeCodec::getModalModes(const void * data, ModalHeader & header)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+	std::memcpy(&header, bytes, sizeof(ModalHeader));
+	return reinterpret_cast<const ModalMode*>(bytes + sizeof(ModalHeader));
+}
+
+bool EnvelopeCodec::isSilent(Encoding encoding, const void * data, unsigned int length, unsigned int start, unsigned int count)
+{
+	if (start >= length) return true;
+
+	if (encoding == Encoding::Modal)
+	{
+		ModalHeader header;
+		getModalModes(data, header);
+		return start >= header.endFrame;
+	}
+	if (encoding != Encoding::Sparse) return false;
+
+	uint32_t numRuns;
+	auto runs = getSparseRuns(data, numRuns);
+
+	// the first run ending behind start has to begin behind the range
+	auto compare = [](unsigned int frame, const SparseRun &run) { return frame < run.start + run.length; };
+	auto run = std::upper_bound(runs, runs + numRuns, start, compare);
+	return run == runs + numRuns || run->start >= start + count;
+}
+
+
+// #################### HELPER ####################
+
+uint16_t EnvelopeCodec::floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(float));
+
+	uint32_t sign	   = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude < 0x38800000)	 return sign;			// below the smallest normal half, flushed to zero
+	if (magnitude >= 0x477fe000) return sign | 0x7bff;	// largest half
+
+	// rebias the exponent and round the mantissa to nearest
+	return static_cast<uint16_t>(sign | ((magnitude - 0x38000000 + 0x1000) >> 13));
+}
+
+const float * EnvelopeCodec::getDecibel8Table()
+{
+	static const std::vector<float> table = []()
+	{
+		std::vector<float> table(Decibel8Levels, 0);
+		for (unsigned int i = 1; i < Decibel8Levels; i++)
+		{
+			table[i] = std::pow(10.f, (float(i) - (Decibel8Levels - 1)) * Decibel8Step / 20.f);
+		}
+		return table;
+	}();
+	return table.data();
+}
+
+const float * EnvelopeCodec::getDelta8Table()
+{
+	static const std::vector<float> table = []()
+	{
+		std::vector<float> table(Delta8Levels, 0);
+		for (unsigned int i = 0; i < Delta8Levels; i++)
+		{
+			table[i] = std::pow(10.f, (float(i) - (Delta8Levels - 1)) * Delta8Step / 20.f);
+		}
+		return table;
+	}();
+	return table.data();
+}
+
+float EnvelopeCodec::toLevel(float relative, float step, unsigned int numLevels)
+{
+	if (relative <= 0) return -1;
+	return (numLevels - 1) + 20.f * std::log10(relative) / step;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+
+#include "ThreadPool.h"
+
+/*
+	FileBatchReader reads whole files into memory on a pool of I/O threads. Submitted reads are queued
+	so the storage always has outstanding requests, completed buffers are handed out by next() in
+	completion order, not in submission order.
+	At most maxBuffers files are in memory at once: a buffer counts from its read until the caller and
+	everything it handed the buffer to released it, further reads wait for a buffer to be released.
+	Files can be submitted while reading, e.g. when a completed include file references further files.
+*/
+class FileBatchReader
+{
+public:
+
+	using Buffer = std::shared_ptr<const std::vector<char>>;
+
+	struct Result
+	{
+		std::string filename;
+		Buffer		data;
+		bool		success{ false };
+	};
+
+	inline FileBatchReader(unsigned int numThreads, unsigned int maxBuffers = DefaultMaxBuffers);
+
+	inline void submit(const std::string &filename);
+	inline void submit(const std::vector<std::string> &filenames);
+
+	// blocks until the next read completed, returns false when no reads are pending anymore.
+	// Releases the buffer 'result' held before, which might be needed for the next read
+	inline bool next(Result &result);
+
+	// reads a whole file in one go, returns nullptr if the file can't be read
+	static inline Buffer readFile(const std::string &filename);
+
+	static const unsigned int DefaultMaxBuffers = 32;
+
+private:
+	// buffers in memory, shared with the buffers which may outlive the reader
+	struct Slots
+	{
+		std::mutex				mutex;
+		std::condition_variable condition;
+		unsigned int			used{ 0 };
+		unsigned int			max{ 1 };
+
+		inline void acquire();
+		inline void release();
+	};
+
+	std::shared_ptr<Slots>	slots;
+	std::mutex				mutex;
+	std::condition_variable condition;
+	std::deque<Result>		completed;
+	unsigned int			pending{ 0 };
+
+	ThreadPool				pool; // declared last, joined first
+};
+
+
+inline FileBatchReader::FileBatchReader(unsigned int numThreads, unsigned int maxBuffers) : slots(std::make_shared<Slots>()), pool(numThreads < 1 ? 1 : numThreads)
+{
+	slots->max = (maxBuffers < 1) ? 1 : maxBuffers;
+}
+
+inline void FileBatchReader::submit(const std::string & filename)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending++;
+	}
+
+	pool.enqueue([this, filename]()
+	{
+		slots->acquire();
+
+		Result result;
+		result.filename = filename;
+
+		// the slot is released with the last reference to the buffer
+		auto data  = readFile(filename);
+		auto slots = this->slots;
+		if (data != nullptr) result.data = Buffer(data.get(), [data, slots](const std::vector<char>*) mutable { data.reset(); slots->release(); });
+		else				 slots->release();
+		result.success	= (result.data != nullptr);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			completed.push_back(std::move(result));
+		}
+		condition.notify_one();
+	});
+}
+
+inline void FileBatchReader::submit(const std::vector<std::string>& filenames)
+{
+	for (const auto & filename : filenames) submit(filename);
+}
+
+inline bool FileBatchReader::next(Result & result)
+{
+	result = Result();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (pending == 0) return false;
+
+	condition.wait(lock, [this]() { return !completed.empty(); });
+
+	result = std::move(completed.front());
+	completed.pop_front();
+	pending--;
+	return true;
+}
+
+inline void FileBatchReader::Slots::acquire()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this]() { return used < max; });
+	used++;
+}
+
+inline void FileBatchReader::Slots::release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		used--;
+	}
+	condition.notify_one();
+}
+
+inline FileBatchReader::Buffer FileBatchReader::readFile(const std::string & filename)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file.good()) return nullptr;
+
+	auto size = file.tellg();
+	if (size < 0) return nullptr;
+	file.seekg(0, std::ios::beg);
+
+	auto buffer = std::make_shared<std::vector<char>>(static_cast<size_t>(size));
+	if (size > 0 && !file.read(buffer->data(), size)) return nullptr;
+
+	return buffer;
+}
@@ -4,9 +4,20 @@
 #include <iostream>
 #include <cstdlib>
 #include <regex>
+#include <cstdio>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #if _WIN32
 	#define WIN
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
 #elif __APPLE__
 	#define Apple
 #elif __linux__
@@ -15,6 +26,10 @@
 	#define LINUX // a bit of a stretch
 #endif
 
+#ifndef WIN
+	#include <unistd.h>
+#endif
+
 namespace FilePath
 {
 
@@ -24,6 +39,23 @@ namespace FilePath
 
 	inline std::string clipWhiteSpaces(std::string str);
 
+	// reads size and modification time (seconds since epoch) of a file, returns false if the file doesn't exist
+	inline bool getFileInfo(const std::string &file, uint64_t &size, int64_t &modificationTime);
+
+	// renames 'from' to 'to', replacing 'to' if existing. The replacement is atomic where the OS supports it
+	inline bool replaceFile(const std::string &from, const std::string &to);
+
+	// returns 'file' relative to 'path' if it is located in 'path', 'file' otherwise
+	inline std::string makeRelative(const std::string &file, const std::string &path);
+
+	// prepends 'path' to 'file' if 'file' is a relative path
+	inline std::string makeAbsolute(const std::string &file, const std::string &path);
+
+	// makes 'file' absolute relative to the current working directory
+	inline std::string makeAbsolute(const std::string &file);
+
+	inline std::string getCurrentDirectory();
+
 
 };
 
@@ -42,8 +74,8 @@ std::string FilePath::getPathOfFile(std::string file)
 		return file.substr(0, lastOcc);
 	}
 
-
-	return file;
+	// file without path, located in the working directory
+	return ".";
 }
 
 char FilePath::delim()
@@ -65,3 +97,55 @@ std::string FilePath::clipWhiteSpaces(std::string str)
 	 
 }
 
+bool FilePath::getFileInfo(const std::string & file, uint64_t & size, int64_t & modificationTime)
+{
+	struct stat fileStat;
+	if (stat(file.c_str(), &fileStat) != 0) return false;
+
+	size			 = static_cast<uint64_t>(fileStat.st_size);
+	modificationTime = static_cast<int64_t>(fileStat.st_mtime);
+	return true;
+}
+
+bool FilePath::replaceFile(const std::string & from, const std::string & to)
+{
+#ifdef WIN
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+std::string FilePath::makeRelative(const std::string & file, const std::string & path)
+{
+	auto prefix = path + delim();
+	if (file.compare(0, prefix.size(), prefix) == 0) return file.substr(prefix.size());
+	return file;
+}
+
+std::string FilePath::makeAbsolute(const std::string & file, const std::string & path)
+{
+	bool isAbsolute = (file.size() > 0) && ((file[0] == '/') || (file[0] == '\\'));
+#ifdef WIN
+	isAbsolute |= (file.size() > 1) && (file[1] == ':');
+#endif
+	if (isAbsolute || path.empty()) return file;
+	return path + delim() + file;
+}
+
+std::string FilePath::makeAbsolute(const std::string & file)
+{
+	return makeAbsolute(file, getCurrentDirectory());
+}
+
+std::string FilePath::getCurrentDirectory()
+{
+	char buffer[4096];
+#ifdef WIN
+	auto length = GetCurrentDirectoryA(sizeof(buffer), buffer);
+	if (length == 0 || length >= sizeof(buffer)) return std::string();
+#else
+	if (getcwd(buffer, sizeof(buffer)) == nullptr) return std::string();
+#endif
+	return std::string(buffer);
+}
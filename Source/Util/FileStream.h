@@ -0,0 +1,453 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <istream>
+#include <fstream>
+#include <streambuf>
+#include <vector>
+#include <iostream>
+
+#ifdef KLANG_USE_ZLIB
+	#include "zlib.h"
+#endif
+
+#ifdef KLANG_USE_ZSTD
+	#include "zstd.h"
+#endif
+
+/*
+	FileStream opens table text files for reading. Files ending with .gz or .zst are decompressed
+	on the fly while the parser reads from the stream, no temporary file is written.
+	Support for both formats is optional and depends on zlib / zstd being found by cmake.
+*/
+namespace FileStream
+{
+	enum class Compression
+	{
+		None,		// plain text file
+		GZip,		// .gz, requires KLANG_USE_ZLIB
+		Zstd		// .zst, requires KLANG_USE_ZSTD
+	};
+
+	inline Compression getCompression(const std::string &filename);
+	inline bool		   isSupported(Compression compression);
+
+	// removes a trailing .gz / .zst from the filename, if existing
+	inline std::string stripCompressionSuffix(const std::string &filename);
+
+	// wraps source into a decompressing stream
+	inline std::unique_ptr<std::istream> openDecompressing(std::unique_ptr<std::streambuf> source, Compression compression);
+
+	// returns filename if existing, otherwise a compressed version of it (filename.gz / filename.zst) if existing
+	inline std::string resolveExisting(const std::string &filename);
+
+	// opens the file for reading, returns nullptr if the file can't be opened
+	inline std::unique_ptr<std::istream> open(const std::string &filename);
+
+	// opens a file that has already been read into memory, the stream keeps the buffer alive
+	inline std::unique_ptr<std::istream> open(std::shared_ptr<const std::vector<char>> buffer, Compression compression);
+
+
+	// #################### MEMORY BUFFER ####################
+
+	/*
+		read-only stream buffer on top of a file that has already been read into memory
+	*/
+	class MemoryBuf : public std::streambuf
+	{
+	public:
+		MemoryBuf(std::shared_ptr<const std::vector<char>> buffer) : buffer(std::move(buffer))
+		{
+			auto begin = const_cast<char*>(this->buffer->data());
+			setg(begin, begin, begin + this->buffer->size());
+		}
+
+	private:
+		std::shared_ptr<const std::vector<char>> buffer;
+	};
+
+
+	// #################### DECOMPRESSION BUFFERS ####################
+
+	/*
+		Base of the decompressing stream buffers. Reads compressed chunks from the source buffer and
+		exposes decompressed chunks to the istream. Derived classes implement decompressChunk().
+	*/
+	class DecompressionBuf : public std::streambuf
+	{
+	public:
+		static const size_t ChunkSize = 1 << 16;
+
+		DecompressionBuf(std::unique_ptr<std::streambuf> source);
+		virtual ~DecompressionBuf() = default;
+
+	protected:
+
+		// decompresses the next chunk into outBuffer, returns number of produced bytes, 0 on end of stream / error.
+		// Sets failed on corrupt or truncated streams
+		virtual size_t decompressChunk() = 0;
+
+		// refills the input buffer, returns false when source is exhausted
+		bool readSource();
+
+		// throws if the stream failed, the istream reading it sets badbit then instead of reaching eof
+		virtual int_type underflow() override;
+
+	protected:
+		std::unique_ptr<std::streambuf> source;
+
+		std::vector<char> inBuffer;
+		std::vector<char> outBuffer;
+
+		size_t inPos{ 0 };
+		size_t inSize{ 0 };
+		bool   sourceExhausted{ false };
+		bool   finished{ false };	// the decoder reached the end of a gzip member / zstd frame and holds no output
+		bool   failed{ false };
+	};
+
+#ifdef KLANG_USE_ZLIB
+	class GZipBuf : public DecompressionBuf
+	{
+	public:
+		GZipBuf(std::unique_ptr<std::streambuf> source);
+		~GZipBuf();
+
+		bool isValid() const { return valid; }
+
+	protected:
+		virtual size_t decompressChunk() override;
+
+	private:
+		z_stream zs;
+		bool	 valid{ false };
+	};
+#endif
+
+#ifdef KLANG_USE_ZSTD
+	class ZstdBuf : public DecompressionBuf
+	{
+	public:
+		ZstdBuf(std::unique_ptr<std::streambuf> source);
+		~ZstdBuf();
+
+		bool isValid() const { return stream != nullptr; }
+
+	protected:
+		virtual size_t decompressChunk() override;
+
+	private:
+		ZSTD_DStream * stream{ nullptr };
+	};
+#endif
+
+	/*
+		istream that owns its stream buffer
+	*/
+	class OwningStream : public std::istream
+	{
+	public:
+		OwningStream(std::unique_ptr<std::streambuf> buf) : std::istream(buf.get()), buf(std::move(buf)) {}
+
+	private:
+		std::unique_ptr<std::streambuf> buf;
+	};
+};
+
+
+// #################### FREE FUNCTIONS ####################
+
+FileStream::Compression FileStream::getCompression(const std::string & filename)
+{
+	auto endsWith = [&](const std::string &suffix) -> bool
+	{
+		if (filename.size() < suffix.size()) return false;
+		return filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+	};
+
+	if (endsWith(".gz"))  return Compression::GZip;
+	if (endsWith(".zst")) return Compression::Zstd;
+	return Compression::None;
+}
+
+bool FileStream::isSupported(Compression compression)
+{
+	switch (compression)
+	{
+		case Compression::None: return true;
+#ifdef KLANG_USE_ZLIB
+		case Compression::GZip: return true;
+#endif
+#ifdef KLANG_USE_ZSTD
+		case Compression::Zstd: return true;
+#endif
+		default: return false;
+	}
+}
+
+std::string FileStream::stripCompressionSuffix(const std::string & filename)
+{
+	switch (getCompression(filename))
+	{
+		case Compression::GZip: return filename.substr(0, filename.size() - 3);
+		case Compression::Zstd: return filename.substr(0, filename.size() - 4);
+		default:				return filename;
+	}
+}
+
+std::string FileStream::resolveExisting(const std::string & filename)
+{
+	auto exists = [](const std::string &file) -> bool
+	{
+		std::ifstream f(file);
+		return f.good();
+	};
+
+	if (exists(filename)) return filename;
+	if (getCompression(filename) != Compression::None) return filename;
+
+	if (isSupported(Compression::Zstd) && exists(filename + ".zst")) return filename + ".zst";
+	if (isSupported(Compression::GZip) && exists(filename + ".gz"))  return filename + ".gz";
+	return filename;
+}
+
+std::unique_ptr<std::istream> FileStream::open(const std::string & filename)
+{
+	auto compression = getCompression(filename);
+
+	if (!isSupported(compression))
+	{
+		std::cout << "Compressed file " << filename << " can't be read, decompression support wasn't compiled in." << std::endl;
+		return nullptr;
+	}
+
+	if (compression == Compression::None)
+	{
+		std::unique_ptr<std::istream> stream(new std::ifstream(filename));
+		if (!stream->good()) return nullptr;
+		return stream;
+	}
+
+	std::unique_ptr<std::filebuf> source(new std::filebuf());
+	if (!source->open(filename, std::ios::in | std::ios::binary)) return nullptr;
+
+	return openDecompressing(std::move(source), compression);
+}
+
+std::unique_ptr<std::istream> FileStream::open(std::shared_ptr<const std::vector<char>> buffer, Compression compression)
+{
+	if (buffer == nullptr) return nullptr;
+
+	if (!isSupported(compression))
+	{
+		std::cout << "Compressed buffer can't be read, decompression support wasn't compiled in." << std::endl;
+		return nullptr;
+	}
+
+	std::unique_ptr<std::streambuf> source(new MemoryBuf(std::move(buffer)));
+
+	if (compression == Compression::None)
+	{
+		return std::unique_ptr<std::istream>(new OwningStream(std::move(source)));
+	}
+
+	return openDecompressing(std::move(source), compression);
+}
+
+std::unique_ptr<std::istream> FileStream::openDecompressing(std::unique_ptr<std::streambuf> source, Compression compression)
+{
+	std::unique_ptr<std::streambuf> buf;
+
+#ifdef KLANG_USE_ZLIB
+	if (compression == Compression::GZip)
+	{
+		auto gzBuf = new GZipBuf(std::move(source));
+		buf = std::unique_ptr<std::streambuf>(gzBuf);
+		if (!gzBuf->isValid()) return nullptr;
+	}
+#endif
+#ifdef KLANG_USE_ZSTD
+	if (compression == Compression::Zstd)
+	{
+		auto zstdBuf = new ZstdBuf(std::move(source));
+		buf = std::unique_ptr<std::streambuf>(zstdBuf);
+		if (!zstdBuf->isValid()) return nullptr;
+	}
+#endif
+
+	if (buf == nullptr) return nullptr;
+	return std::unique_ptr<std::istream>(new OwningStream(std::move(buf)));
+}
+
+
+// #################### DecompressionBuf ####################
+
+inline FileStream::DecompressionBuf::DecompressionBuf(std::unique_ptr<std::streambuf> source)
+	:
+	source(std::move(source)),
+	inBuffer(ChunkSize),
+	outBuffer(ChunkSize)
+{
+	setg(outBuffer.data(), outBuffer.data(), outBuffer.data());
+}
+
+inline bool FileStream::DecompressionBuf::readSource()
+{
+	if (sourceExhausted) return false;
+
+	auto numRead = source->sgetn(inBuffer.data(), inBuffer.size());
+	inPos  = 0;
+	inSize = (numRead > 0) ? numRead : 0;
+
+	if (inSize == 0) sourceExhausted = true;
+	return inSize > 0;
+}
+
+inline FileStream::DecompressionBuf::int_type FileStream::DecompressionBuf::underflow()
+{
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	size_t produced = decompressChunk();
+	if (produced == 0 && failed) throw std::ios_base::failure("Decompression failed");
+	if (produced == 0) return traits_type::eof();
+
+	setg(outBuffer.data(), outBuffer.data(), outBuffer.data() + produced);
+	return traits_type::to_int_type(*gptr());
+}
+
+
+// #################### GZipBuf ####################
+
+#ifdef KLANG_USE_ZLIB
+
+inline FileStream::GZipBuf::GZipBuf(std::unique_ptr<std::streambuf> source)
+	: DecompressionBuf(std::move(source))
+{
+	zs = z_stream();
+	zs.next_in  = Z_NULL;
+	zs.avail_in = 0;
+
+	// 16 + MAX_WBITS: expect a gzip header
+	valid = (inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK);
+}
+
+inline FileStream::GZipBuf::~GZipBuf()
+{
+	if (valid) inflateEnd(&zs);
+}
+
+inline size_t FileStream::GZipBuf::decompressChunk()
+{
+	if (!valid) return 0;
+
+	while (true)
+	{
+		// at the end of the source the decoder is called without input, it may still hold output
+		bool sourceEnd = (inPos >= inSize) && !readSource();
+		if (sourceEnd) inPos = inSize = 0;
+
+		zs.next_in   = reinterpret_cast<Bytef*>(inBuffer.data() + inPos);
+		zs.avail_in  = static_cast<uInt>(inSize - inPos);
+		zs.next_out  = reinterpret_cast<Bytef*>(outBuffer.data());
+		zs.avail_out = static_cast<uInt>(outBuffer.size());
+
+		int ret = inflate(&zs, Z_NO_FLUSH);
+		size_t consumed = (inSize - inPos) - zs.avail_in;
+		size_t produced = outBuffer.size() - zs.avail_out;
+		inPos = inSize - zs.avail_in;
+
+		if (ret == Z_STREAM_END)
+		{
+			// gzip files may consist of multiple concatenated members
+			inflateReset(&zs);
+			finished = true;
+		}
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			std::cout << "Corrupted gzip stream" << std::endl;
+			valid  = false;
+			failed = true;
+			return 0;
+		}
+		else if (consumed > 0 || produced > 0)
+		{
+			finished = false;
+		}
+
+		if (produced > 0) return produced;
+		if (!sourceEnd) continue;
+
+		if (!finished)
+		{
+			std::cout << "Truncated gzip stream" << std::endl;
+			valid  = false;
+			failed = true;
+		}
+		return 0;
+	}
+}
+
+#endif
+
+
+// #################### ZstdBuf ####################
+
+#ifdef KLANG_USE_ZSTD
+
+inline FileStream::ZstdBuf::ZstdBuf(std::unique_ptr<std::streambuf> source)
+	: DecompressionBuf(std::move(source))
+{
+	stream = ZSTD_createDStream();
+	if (stream) ZSTD_initDStream(stream);
+}
+
+inline FileStream::ZstdBuf::~ZstdBuf()
+{
+	if (stream) ZSTD_freeDStream(stream);
+}
+
+inline size_t FileStream::ZstdBuf::decompressChunk()
+{
+	if (!stream) return 0;
+
+	while (true)
+	{
+		// at the end of the source the decoder is called without input, it may still hold output
+		bool sourceEnd = (inPos >= inSize) && !readSource();
+		if (sourceEnd) inPos = inSize = 0;
+
+		ZSTD_inBuffer  in  = { inBuffer.data(), inSize, inPos };
+		ZSTD_outBuffer out = { outBuffer.data(), outBuffer.size(), 0 };
+
+		size_t ret = ZSTD_decompressStream(stream, &out, &in);
+		size_t consumed = in.pos - inPos;
+		inPos = in.pos;
+
+		if (ZSTD_isError(ret))
+		{
+			std::cout << "Corrupted zstd stream: " << ZSTD_getErrorName(ret) << std::endl;
+			ZSTD_freeDStream(stream);
+			stream = nullptr;
+			failed = true;
+			return 0;
+		}
+
+		// 0: the frame is decoded and flushed completely
+		if (ret == 0)						   finished = true;
+		else if (consumed > 0 || out.pos > 0) finished = false;
+
+		if (out.pos > 0) return out.pos;
+		if (!sourceEnd) continue;
+
+		if (!finished)
+		{
+			std::cout << "Truncated zstd stream" << std::endl;
+			ZSTD_freeDStream(stream);
+			stream = nullptr;
+			failed = true;
+		}
+		return 0;
+	}
+}
+
+#endif
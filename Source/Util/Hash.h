@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+	FNV-1a hash, used for checksums of cache files
+*/
+namespace Hash
+{
+	static const uint64_t FNVOffset = 14695981039346656037ULL;
+	static const uint64_t FNVPrime  = 1099511628211ULL;
+
+	// hashes 'size' bytes at 'data', pass the result of a previous call as 'hash' to continue hashing
+	inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = FNVOffset);
+};
+
+
+uint64_t Hash::fnv1a(const void * data, size_t size, uint64_t hash)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNVPrime;
+	}
+	return hash;
+}
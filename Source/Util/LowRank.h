@@ -0,0 +1,319 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+
+/*
+	LowRank approximates a matrix, e.g. the frames x bins amplitudes of a table, by the product of two small
+	matrices: activations (rows x rank) times templates (rank x columns). Memory goes from rows * columns to
+	rank * (rows + columns), the rank is the smallest one keeping the relative error (Frobenius norm) within a
+	tolerance.
+
+	The factors are the leading principal components, the eigenvectors of the Gram matrix of the smaller
+	dimension (Householder tridiagonalization followed by the implicit QL algorithm). That's the best
+	approximation of a given rank, products of the factors can be slightly negative where the matrix is
+	close to zero.
+*/
+namespace LowRank
+{
+	struct Factors
+	{
+		unsigned int	   rank{ 0 };
+		unsigned int	   rows{ 0 };
+		unsigned int	   columns{ 0 };
+		std::vector<float> activations;		// rows x rank
+		std::vector<float> templates;		// rank x columns
+		float			   error{ 0 };		// relative error of the approximation
+	};
+
+	// factorizes the 'rows' x 'columns' matrix at 'matrix' (rows are 'stride' floats apart). Returns false if the
+	// matrix is silent or the error stays above 'tolerance' with 'maxRank' components
+	inline bool factorize(const float *matrix, unsigned int rows, unsigned int columns, size_t stride, float tolerance, unsigned int maxRank, Factors &factors);
+
+	// eigenvalues of the symmetric n x n matrix 'a', largest first. 'a' is replaced by the eigenvectors, column k
+	// belongs to values[k]. Returns false if the iteration doesn't converge
+	inline bool symmetricEigen(std::vector<double> &a, unsigned int n, std::vector<double> &values);
+};
+
+
+// #################### FREE FUNCTIONS ####################
+
+bool LowRank::factorize(const float * matrix, unsigned int rows, unsigned int columns, size_t stride, float tolerance, unsigned int maxRank, Factors & factors)
+{
+	if (rows == 0 || columns == 0 || maxRank == 0) return false;
+
+	// Gram matrix of the smaller dimension, upper triangle first
+	bool		 byColumns = (columns <= rows);
+	unsigned int n		   = byColumns ? columns : rows;
+	std::vector<double> gram(size_t(n) * n, 0.0);
+
+	if (byColumns)
+	{
+		// row by row, silent frames of a bin are skipped
+		for (unsigned int r = 0; r < rows; r++)
+		{
+			auto row = matrix + size_t(r) * stride;
+			for (unsigned int i = 0; i < n; i++)
+			{
+				double value = row[i];
+				if (value == 0) continue;
+
+				auto out = gram.data() + size_t(i) * n;
+				for (unsigned int j = i; j < n; j++) out[j] += value * row[j];
+			}
+		}
+	}
+	else
+	{
+		for (unsigned int i = 0; i < n; i++)
+		{
+			auto rowI = matrix + size_t(i) * stride;
+			for (unsigned int j = i; j < n; j++)
+			{
+				auto rowJ = matrix + size_t(j) * stride;
+				double sum = 0;
+				for (unsigned int c = 0; c < columns; c++) sum += double(rowI[c]) * rowJ[c];
+				gram[size_t(i) * n + j] = sum;
+			}
+		}
+	}
+
+	double total = 0;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		total += gram[size_t(i) * n + i];
+		for (unsigned int j = 0; j < i; j++) gram[size_t(i) * n + j] = gram[size_t(j) * n + i];
+	}
+	if (total <= 0) return false;
+
+	std::vector<double> values;
+	if (!symmetricEigen(gram, n, values)) return false;
+
+	// the squared error is the energy of the components left out
+	double allowed	 = double(tolerance) * tolerance * total;
+	double remaining = total;
+	unsigned int rank = 0;
+	while (rank < std::min(n, maxRank) && (rank == 0 || remaining > allowed))
+	{
+		remaining -= std::max(0.0, values[rank]);
+		rank++;
+	}
+	if (remaining > allowed) return false;
+
+	factors.rank	= rank;
+	factors.rows	= rows;
+	factors.columns = columns;
+	factors.error	= static_cast<float>(std::sqrt(std::max(0.0, remaining) / total));
+	factors.activations.assign(size_t(rows) * rank, 0.f);
+	factors.templates.assign(size_t(rank) * columns, 0.f);
+
+	// the eigenvectors are one factor, projecting the matrix on them gives the other
+	if (byColumns)
+	{
+		for (unsigned int k = 0; k < rank; k++)
+		{
+			for (unsigned int c = 0; c < columns; c++) factors.templates[size_t(k) * columns + c] = static_cast<float>(gram[size_t(c) * n + k]);
+		}
+		for (unsigned int r = 0; r < rows; r++)
+		{
+			auto row = matrix + size_t(r) * stride;
+			for (unsigned int k = 0; k < rank; k++)
+			{
+				double sum = 0;
+				for (unsigned int c = 0; c < columns; c++) sum += row[c] * gram[size_t(c) * n + k];
+				factors.activations[size_t(r) * rank + k] = static_cast<float>(sum);
+			}
+		}
+	}
+	else
+	{
+		std::vector<double> templates(size_t(rank) * columns, 0.0);
+		for (unsigned int r = 0; r < rows; r++)
+		{
+			auto row = matrix + size_t(r) * stride;
+			for (unsigned int k = 0; k < rank; k++)
+			{
+				double weight = gram[size_t(r) * n + k];
+				factors.activations[size_t(r) * rank + k] = static_cast<float>(weight);
+
+				auto out = templates.data() + size_t(k) * columns;
+				for (unsigned int c = 0; c < columns; c++) out[c] += weight * row[c];
+			}
+		}
+		std::copy(templates.begin(), templates.end(), factors.templates.begin());
+	}
+	return true;
+}
+
+bool LowRank::symmetricEigen(std::vector<double> & a, unsigned int n, std::vector<double> & values)
+{
+	auto A = [&a, n](size_t i, size_t j) -> double & { return a[i * n + j]; };
+
+	std::vector<double> d(n, 0.0);
+	std::vector<double> e(n, 0.0);
+	int size = static_cast<int>(n);
+
+	// Householder reduction to tridiagonal form, d is the diagonal and e the subdiagonal. The transformations
+	// are accumulated in 'a'
+	for (int i = size - 1; i > 0; i--)
+	{
+		int	   l	 = i - 1;
+		double h	 = 0;
+		double scale = 0;
+
+		if (l > 0)
+		{
+			for (int k = 0; k <= l; k++) scale += std::abs(A(i, k));
+
+			if (scale == 0)
+			{
+				e[i] = A(i, l);
+			}
+			else
+			{
+				for (int k = 0; k <= l; k++)
+				{
+					A(i, k) /= scale;
+					h += A(i, k) * A(i, k);
+				}
+
+				double f = A(i, l);
+				double g = (f >= 0) ? -std::sqrt(h) : std::sqrt(h);
+				e[i] = scale * g;
+				h	-= f * g;
+				A(i, l) = f - g;
+
+				f = 0;
+				for (int j = 0; j <= l; j++)
+				{
+					A(j, i) = A(i, j) / h;
+					g = 0;
+					for (int k = 0; k <= j; k++)	 g += A(j, k) * A(i, k);
+					for (int k = j + 1; k <= l; k++) g += A(k, j) * A(i, k);
+					e[j] = g / h;
+					f	+= e[j] * A(i, j);
+				}
+
+				double hh = f / (h + h);
+				for (int j = 0; j <= l; j++)
+				{
+					f = A(i, j);
+					e[j] = g = e[j] - hh * f;
+					for (int k = 0; k <= j; k++) A(j, k) -= (f * e[k] + g * A(i, k));
+				}
+			}
+		}
+		else
+		{
+			e[i] = A(i, l);
+		}
+		d[i] = h;
+	}
+
+	// accumulation of the transformations. Row i holds its Householder vector in the columns before i, which
+	// is l = i - 1 of the 1-based original: the loops run over the indices 0 .. i - 1
+	d[0] = 0;
+	e[0] = 0;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (d[i] != 0)
+		{
+			auto rowI = a.data() + size_t(i) * n;
+			for (unsigned int j = 0; j < i; j++)
+			{
+				double g = 0;
+				for (unsigned int k = 0; k < i; k++) g += rowI[k] * A(k, j);
+				for (unsigned int k = 0; k < i; k++) A(k, j) -= g * A(k, i);
+			}
+		}
+		d[i] = A(i, i);
+		A(i, i) = 1;
+		for (unsigned int j = 0; j < i; j++) A(j, i) = A(i, j) = 0;
+	}
+
+	// implicit QL with shifts on the tridiagonal matrix, the rotations are applied to the eigenvectors
+	const int MaxIterations = 60;
+
+	for (int i = 1; i < size; i++) e[i - 1] = e[i];
+	if (size > 0) e[size - 1] = 0;
+
+	// subdiagonal elements negligible against the whole matrix split it. Tiny eigenvalues (noise of the amplitudes)
+	// are only found up to that precision, they would take many iterations otherwise
+	const double Epsilon = std::numeric_limits<double>::epsilon();
+	double norm = 0;
+	for (int i = 0; i < size; i++) norm = std::max(norm, std::abs(d[i]) + std::abs(e[i]));
+
+	for (int l = 0; l < size; l++)
+	{
+		int iterations = 0;
+		int m;
+		do
+		{
+			for (m = l; m < size - 1; m++)
+			{
+				double dd = std::abs(d[m]) + std::abs(d[m + 1]);
+				if (std::abs(e[m]) + dd == dd || std::abs(e[m]) <= Epsilon * norm) break;
+			}
+			if (m == l) break;
+			if (iterations++ == MaxIterations) return false;
+
+			double g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+			double r = std::hypot(g, 1.0);
+			g = d[m] - d[l] + e[l] / (g + ((g >= 0) ? r : -r));
+
+			double s = 1;
+			double c = 1;
+			double p = 0;
+			int i;
+			for (i = m - 1; i >= l; i--)
+			{
+				double f = s * e[i];
+				double b = c * e[i];
+				e[i + 1] = r = std::hypot(f, g);
+				if (r == 0)
+				{
+					d[i + 1] -= p;
+					e[m] = 0;
+					break;
+				}
+				s = f / r;
+				c = g / r;
+				g = d[i + 1] - p;
+				r = (d[i] - g) * s + 2.0 * c * b;
+				p = s * r;
+				d[i + 1] = g + p;
+				g = c * r - b;
+
+				for (int k = 0; k < size; k++)
+				{
+					f = A(k, i + 1);
+					A(k, i + 1) = s * A(k, i) + c * f;
+					A(k, i)		= c * A(k, i) - s * f;
+				}
+			}
+			if (r == 0 && i >= l) continue;
+
+			d[l] -= p;
+			e[l]  = g;
+			e[m]  = 0;
+		} while (m != l);
+	}
+
+	// largest eigenvalue first
+	std::vector<unsigned int> order(n);
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&d](unsigned int lhs, unsigned int rhs) { return d[lhs] > d[rhs]; });
+
+	std::vector<double> vectors(size_t(n) * n);
+	values.resize(n);
+	for (unsigned int k = 0; k < n; k++)
+	{
+		values[k] = d[order[k]];
+		for (unsigned int i = 0; i < n; i++) vectors[size_t(i) * n + k] = a[size_t(i) * n + order[k]];
+	}
+	a = std::move(vectors);
+	return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#if _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+/*
+	Read-only memory mapping of a whole file. The mapping is shared, multiple processes mapping the 
+	same file share the pages in the page cache.
+*/
+class MappedFile
+{
+public:
+	inline MappedFile(const std::string &filename);
+	inline ~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	inline bool			isValid() const { return mapping != nullptr; }
+	inline const char * data()	  const { return static_cast<const char*>(mapping); }
+	inline size_t		size()	  const { return length; }
+
+private:
+	void *	mapping{ nullptr };
+	size_t  length{ 0 };
+
+#if _WIN32
+	HANDLE  file{ INVALID_HANDLE_VALUE };
+	HANDLE  fileMapping{ NULL };
+#endif
+};
+
+
+#if _WIN32
+
+inline MappedFile::MappedFile(const std::string & filename)
+{
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+	fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (fileMapping == NULL) return;
+
+	mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapping != nullptr) length = static_cast<size_t>(fileSize.QuadPart);
+}
+
+inline MappedFile::~MappedFile()
+{
+	if (mapping != nullptr)				UnmapViewOfFile(mapping);
+	if (fileMapping != NULL)			CloseHandle(fileMapping);
+	if (file != INVALID_HANDLE_VALUE)	CloseHandle(file);
+}
+
+#else
+
+inline MappedFile::MappedFile(const std::string & filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		void * ptr = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr != MAP_FAILED)
+		{
+			mapping = ptr;
+			length  = static_cast<size_t>(fileStat.st_size);
+		}
+	}
+
+	// the mapping stays valid after closing the descriptor
+	close(fd);
+}
+
+inline MappedFile::~MappedFile()
+{
+	if (mapping != nullptr) munmap(mapping, length);
+}
+
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+/*
+	ModalFit models the envelope of a percussive bin as an attack followed by a sum of exponential decays (modes):
+
+		frame n < attackFrames		attack[n], stored as is
+		frame n >= attackFrames		sum of amplitude[m] * decay[m] ^ (n - attackFrames)
+		frame n >= endFrame			silent, the envelope ends with silence
+
+	The attack ends at the peak. The decays are the nonlinear part of the problem, for given decays the amplitudes
+	are a linear least squares problem (variable projection). Every mode count starts from the decays of the one
+	before plus a line fitted to the log amplitude of what they leave over, then each decay is searched on its own
+	(golden section over the log time constant) while the others stay fixed. Modes are added until the relative
+	error (RMS of the difference to the whole envelope) is within the tolerance.
+
+	Amplitudes are never negative, so the modes don't need clamping when they are rendered.
+*/
+namespace ModalFit
+{
+	const unsigned int MinTailFrames = 8;		// shorter decays aren't worth fitting
+	const double	   MinDecay		 = 1e-3;	// per frame, -60 dB
+	const unsigned int SearchRounds	 = 2;		// over all decays
+	const unsigned int SearchSteps	 = 16;		// golden section steps per decay and round
+
+	struct Fit
+	{
+		unsigned int		attackFrames{ 0 };
+		unsigned int		endFrame{ 0 };		// after the last frame that isn't silent
+		std::vector<float>	amplitudes;
+		std::vector<float>	decays;			// per frame factor, (0, 1]
+		float				error{ 0 };		// relative error of the whole envelope
+	};
+
+	// fits 'length' frames with up to 'maxModes' modes. Returns false if the envelope is silent, the decay too short
+	// or the error stays above 'tolerance' (relative, linear). 'fit' holds the best fit found in any case
+	inline bool fit(const float *samples, unsigned int length, unsigned int maxModes, float tolerance, Fit &fit);
+
+
+	// #################### HELPER ####################
+
+	// decay of a single exponential fitted to the positive frames of 'values', false if there are less than two
+	inline bool fitDecay(const std::vector<double> &values, double &decay);
+
+	// least squares amplitudes of the decays for 'values', returns the squared error. Infinite if the system is
+	// singular or an amplitude is negative
+	inline double project(const std::vector<double> &values, double energy, const std::vector<double> &decays, std::vector<double> &amplitudes);
+};
+
+
+// #################### FREE FUNCTIONS ####################
+
+bool ModalFit::fit(const float * samples, unsigned int length, unsigned int maxModes, float tolerance, Fit & fit)
+{
+	// the attack ends at the peak, everything from there on up to the final silence is fitted
+	unsigned int peakFrame = 0;
+	unsigned int endFrame  = 0;
+	double		 energy	   = 0;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		energy += double(samples[i]) * samples[i];
+		if (std::abs(samples[i]) > std::abs(samples[peakFrame])) peakFrame = i;
+		if (samples[i] != 0) endFrame = i + 1;
+	}
+
+	fit.attackFrames = peakFrame;
+	fit.endFrame	 = endFrame;
+	fit.amplitudes.clear();
+	fit.decays.clear();
+	fit.error = 1;
+
+	unsigned int numTail = endFrame - std::min(peakFrame, endFrame);
+	if (energy <= 0 || numTail < MinTailFrames) return false;
+
+	std::vector<double> tail(samples + peakFrame, samples + endFrame);
+	double tailEnergy = 0;
+	for (double value : tail) tailEnergy += value * value;
+
+	std::vector<double> decays, amplitudes, residual(tail);
+	double allowed = double(tolerance) * tolerance * energy;
+	double best	   = tailEnergy;
+
+	// the decays are searched as x = log(-log(decay)), time constants from 1e6 frames down to MinDecay
+	const double MinX = std::log(1e-6);
+	const double MaxX = std::log(-std::log(MinDecay));
+	const double Golden = 0.5 * (std::sqrt(5.0) - 1);
+
+	for (unsigned int m = 0; m < maxModes; m++)
+	{
+		double decay;
+		if (!fitDecay(residual, decay)) decay = decays.empty() ? 0.99 : decays.back() * decays.back();
+		decays.push_back(std::min(decay, 1 - 1e-6));
+
+		for (unsigned int round = 0; round < SearchRounds; round++)
+		{
+			for (size_t i = 0; i < decays.size(); i++)
+			{
+				auto trial	= decays;
+				auto errorAt = [&](double x)
+				{
+					trial[i] = std::exp(-std::exp(x));
+					return project(tail, tailEnergy, trial, amplitudes);
+				};
+
+				double lo = MinX, hi = MaxX;
+				double x1 = hi - Golden * (hi - lo), x2 = lo + Golden * (hi - lo);
+				double e1 = errorAt(x1), e2 = errorAt(x2);
+				for (unsigned int step = 0; step < SearchSteps; step++)
+				{
+					if (e1 < e2)
+					{
+						hi = x2; x2 = x1; e2 = e1;
+						x1 = hi - Golden * (hi - lo);
+						e1 = errorAt(x1);
+					}
+					else
+					{
+						lo = x1; x1 = x2; e1 = e2;
+						x2 = lo + Golden * (hi - lo);
+						e2 = errorAt(x2);
+					}
+				}
+
+				// keep the decay unless the search found a better one
+				double current = project(tail, tailEnergy, decays, amplitudes);
+				double x	   = (e1 < e2) ? x1 : x2;
+				if (std::min(e1, e2) < current) decays[i] = std::exp(-std::exp(x));
+			}
+		}
+
+		double squared = project(tail, tailEnergy, decays, amplitudes);
+		if (!(squared < best))
+		{
+			// the mode doesn't help, more won't either
+			decays.pop_back();
+			break;
+		}
+		best = squared;
+
+		fit.amplitudes.assign(amplitudes.begin(), amplitudes.end());
+		fit.decays.assign(decays.begin(), decays.end());
+		fit.error = static_cast<float>(std::sqrt(std::max(0.0, squared) / energy));
+		if (squared <= allowed) return true;
+
+		// what is left over for the next mode
+		std::vector<double> powers(decays.size(), 1.0);
+		for (unsigned int k = 0; k < numTail; k++)
+		{
+			double value = 0;
+			for (size_t i = 0; i < decays.size(); i++)
+			{
+				value	  += amplitudes[i] * powers[i];
+				powers[i] *= decays[i];
+			}
+			residual[k] = tail[k] - value;
+		}
+	}
+	return false;
+}
+
+
+// #################### HELPER ####################
+
+bool ModalFit::fitDecay(const std::vector<double> & values, double & decay)
+{
+	// frames more than 80 dB below the largest one are noise of the residual
+	double peak = 0;
+	for (double value : values) peak = std::max(peak, value);
+	double floor = peak * 1e-4;
+
+	// weighted linear regression of the log amplitude over the frame
+	double sumW = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+	unsigned int count = 0;
+	for (size_t k = 0; k < values.size(); k++)
+	{
+		if (values[k] <= floor) continue;
+
+		double w = values[k] * values[k];
+		double x = double(k);
+		double y = std::log(values[k]);
+		sumW  += w;
+		sumX  += w * x;
+		sumY  += w * y;
+		sumXX += w * x * x;
+		sumXY += w * x * y;
+		count++;
+	}
+	if (count < 2) return false;
+
+	double denominator = sumW * sumXX - sumX * sumX;
+	if (denominator <= 0) return false;
+
+	double slope = (sumW * sumXY - sumX * sumY) / denominator;
+	decay = std::min(1.0, std::max(MinDecay, std::exp(slope)));
+	return true;
+}
+
+double ModalFit::project(const std::vector<double> & values, double energy, const std::vector<double> & decays, std::vector<double> & amplitudes)
+{
+	const double Invalid = std::numeric_limits<double>::infinity();
+
+	// normal equations, the products of two modes are geometric series
+	size_t n = decays.size();
+	double length = double(values.size());
+	std::vector<double> system(n * (n + 1), 0.0);
+	std::vector<double> correlations(n, 0.0);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		for (size_t j = 0; j < n; j++)
+		{
+			double ratio = decays[i] * decays[j];
+			system[i * (n + 1) + j] = (ratio < 1) ? (1 - std::pow(ratio, length)) / (1 - ratio) : length;
+		}
+
+		double sum = 0, power = 1;
+		for (double value : values)
+		{
+			sum	  += value * power;
+			power *= decays[i];
+		}
+		system[i * (n + 1) + n] = correlations[i] = sum;
+	}
+
+	// Gauss-Jordan elimination with partial pivoting
+	double scale = std::abs(system[0]);
+	for (size_t c = 0; c < n; c++)
+	{
+		size_t pivot = c;
+		for (size_t r = c + 1; r < n; r++)
+		{
+			if (std::abs(system[r * (n + 1) + c]) > std::abs(system[pivot * (n + 1) + c])) pivot = r;
+		}
+		if (std::abs(system[pivot * (n + 1) + c]) <= 1e-12 * scale) return Invalid;
+
+		for (size_t k = 0; k <= n; k++) std::swap(system[c * (n + 1) + k], system[pivot * (n + 1) + k]);
+		for (size_t r = 0; r < n; r++)
+		{
+			if (r == c) continue;
+			double factor = system[r * (n + 1) + c] / system[c * (n + 1) + c];
+			for (size_t k = c; k <= n; k++) system[r * (n + 1) + k] -= factor * system[c * (n + 1) + k];
+		}
+	}
+
+	// at the least squares solution the squared error is the energy minus the projected part
+	amplitudes.resize(n);
+	double projected = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		amplitudes[i] = system[i * (n + 1) + n] / system[i * (n + 1) + i];
+		if (amplitudes[i] < 0) return Invalid;
+		projected += amplitudes[i] * correlations[i];
+	}
+	return std::max(0.0, energy - projected);
+}
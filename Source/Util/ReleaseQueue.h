@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <memory>
+
+/*
+	ReleaseQueue takes references to shared objects (e.g. the tables of a note that stopped) from a thread that
+	shouldn't free memory and drops them on the thread calling releaseAll(). If the queued reference was the last
+	one, the object is destroyed there. Both lists keep their capacity, pushing only allocates until the queue has
+	grown to the references released between two calls of releaseAll().
+	One thread calls releaseAll(), any thread may push.
+*/
+class ReleaseQueue
+{
+public:
+	ReleaseQueue() = default;
+	inline ~ReleaseQueue();
+
+	ReleaseQueue(const ReleaseQueue &) = delete;
+	ReleaseQueue & operator=(const ReleaseQueue &) = delete;
+
+	// takes over 'object', nullptr is ignored
+	inline void push(std::shared_ptr<const void> object);
+
+	// drops the references pushed so far, returns their number
+	inline size_t releaseAll();
+
+private:
+	std::vector<std::shared_ptr<const void>> pending;
+	std::vector<std::shared_ptr<const void>> releasing;	// swapped with pending, cleared outside the lock
+	std::mutex								 mutex;
+};
+
+
+inline ReleaseQueue::~ReleaseQueue()
+{
+	releaseAll();
+}
+
+inline void ReleaseQueue::push(std::shared_ptr<const void> object)
+{
+	if (object == nullptr) return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.push_back(std::move(object));
+}
+
+inline size_t ReleaseQueue::releaseAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::swap(pending, releasing);
+	}
+
+	// pushing isn't blocked while the objects are destroyed
+	auto count = releasing.size();
+	releasing.clear();
+	return count;
+}
@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#if _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+/*
+	ResidentMemory brings memory into RAM before it is used, so the first read on a time critical thread (the audio
+	callback) doesn't page fault. Pages of a mapped file are read from disk on their first access, and the system
+	may drop them again at any time:
+		Prefault	every page is read once, the system is advised to read mapped files ahead (MADV_WILLNEED).
+					Pages can still be evicted under memory pressure
+		Lock		the pages are locked into RAM (mlock / VirtualLock), which faults them in as well. Locked memory
+					is limited per process (ulimit -l), pages that can't be locked are prefaulted instead
+
+	The ranges are merged and extended to whole pages for locking and advising, a page covered by several ranges
+	counts once per apply(). Prefaulting only reads bytes within the ranges, the rest of a page may not be
+	allocated (it is to the memory checkers). Locked pages are unlocked by remove() when their owner (e.g. a table
+	that is dropped) is about to be freed, all of them when the ResidentMemory is destroyed.
+*/
+class ResidentMemory
+{
+public:
+	enum class Mode
+	{
+		None,
+		Prefault,
+		Lock
+	};
+
+	struct Stats
+	{
+		uint64_t bytes{ 0 };		// pages made resident
+		uint64_t lockedBytes{ 0 };	// part of bytes locked into RAM
+		uint64_t failedBytes{ 0 };	// part of bytes that should have been locked, prefaulted only
+
+		Stats & operator+=(const Stats & other)
+		{
+			bytes		+= other.bytes;
+			lockedBytes += other.lockedBytes;
+			failedBytes += other.failedBytes;
+			return *this;
+		}
+	};
+
+	ResidentMemory() = default;
+	inline ~ResidentMemory();
+
+	ResidentMemory(const ResidentMemory &) = delete;
+	ResidentMemory & operator=(const ResidentMemory &) = delete;
+
+	// memory [data, data + size) made resident by the next apply()
+	inline void add(const void * data, size_t size);
+
+	// makes the memory added since the last call resident, returns the pages of this call. The pages locked
+	// belong to 'owner', nullptr if they stay locked
+	inline Stats apply(Mode mode, const void * owner = nullptr);
+
+	// unlocks the pages locked for 'owner' by apply(), pages locked for another owner as well stay locked.
+	// Returns the bytes unlocked
+	inline uint64_t remove(const void * owner);
+
+	// "none", "touch" or "lock", returns false for anything else
+	static inline bool parseMode(const std::string & name, Mode & mode);
+
+	static inline size_t getPageSize();
+
+	static const size_t LockChunkSize = 1024 * 1024;	// a multiple of the page size
+
+private:
+	typedef std::pair<uintptr_t, uintptr_t> Range;	// [begin, end)
+
+	// page aligned
+	static inline void advise(const Range & range);
+	static inline void touch(const Range & range, const Range & exact);	// the pages of 'range' within 'exact' (not aligned)
+	static inline bool lock(const Range & range);
+	static inline void unlock(const Range & range);
+
+	struct Chunk
+	{
+		Range		 range;	// page aligned
+		const void * owner;
+	};
+
+	std::vector<Range> pending;	// as added
+	std::vector<Chunk> locked;
+	std::mutex		   mutex;
+};
+
+
+inline ResidentMemory::~ResidentMemory()
+{
+	for (auto & chunk : locked) unlock(chunk.range);
+}
+
+inline void ResidentMemory::add(const void * data, size_t size)
+{
+	if (data == nullptr || size == 0) return;
+
+	uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.emplace_back(begin, begin + size);
+}
+
+inline ResidentMemory::Stats ResidentMemory::apply(Mode mode, const void * owner)
+{
+	std::lock_guard<std::mutex> guard(mutex);
+
+	Stats stats;
+	if (mode == Mode::None)
+	{
+		pending.clear();
+		return stats;
+	}
+
+	// overlapping and adjacent ranges are merged, the gaps between them aren't touched
+	std::vector<Range> ranges;
+	std::sort(pending.begin(), pending.end());
+	for (auto & range : pending)
+	{
+		if (!ranges.empty() && range.first <= ranges.back().second) ranges.back().second = std::max(ranges.back().second, range.second);
+		else														ranges.push_back(range);
+	}
+	pending.clear();
+
+	// a page holding part of a range is mapped as a whole. A page shared with the previous range belongs to that one
+	uintptr_t page = getPageSize();
+	std::vector<Range> pages;
+	for (auto & range : ranges)
+	{
+		uintptr_t begin = range.first / page * page;
+		uintptr_t end	= (range.second + page - 1) / page * page;
+		if (!pages.empty()) begin = std::max(begin, pages.back().second);
+		pages.emplace_back(begin, end);
+	}
+
+	// the read ahead of all ranges is started before the first page is waited for
+	for (auto & range : pages) if (range.first < range.second) advise(range);
+
+	// locked in chunks up to the limit, the chunks after the first that fails are prefaulted
+	bool limitReached = (mode != Mode::Lock);
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		auto &range = pages[r];
+		stats.bytes += range.second - range.first;
+
+		for (auto begin = range.first; begin < range.second; begin += LockChunkSize)
+		{
+			Range chunk(begin, std::min<uintptr_t>(begin + LockChunkSize, range.second));
+			auto  bytes = chunk.second - chunk.first;
+
+			if (!limitReached && lock(chunk))
+			{
+				locked.push_back(Chunk{ chunk, owner });
+				stats.lockedBytes += bytes;
+				continue;
+			}
+			if (mode == Mode::Lock)
+			{
+				limitReached	  = true;
+				stats.failedBytes += bytes;
+			}
+			touch(chunk, ranges[r]);
+		}
+	}
+	return stats;
+}
+
+inline uint64_t ResidentMemory::remove(const void * owner)
+{
+	if (owner == nullptr) return 0;
+
+	std::lock_guard<std::mutex> guard(mutex);
+
+	uint64_t bytes = 0;
+	std::vector<Range> unlocked;
+	for (size_t c = 0; c < locked.size(); )
+	{
+		if (locked[c].owner != owner)
+		{
+			c++;
+			continue;
+		}
+
+		unlock(locked[c].range);
+		bytes += locked[c].range.second - locked[c].range.first;
+		unlocked.push_back(locked[c].range);
+
+		locked[c] = locked.back();
+		locked.pop_back();
+	}
+
+	// locks don't nest, pages locked by other owners as well (shared envelopes, a page at the border) are locked again
+	for (auto & range : unlocked)
+	{
+		for (auto & chunk : locked)
+		{
+			Range overlap(std::max(chunk.range.first, range.first), std::min(chunk.range.second, range.second));
+			if (overlap.first < overlap.second) lock(overlap);
+		}
+	}
+	return bytes;
+}
+
+inline bool ResidentMemory::parseMode(const std::string & name, Mode & mode)
+{
+	if		(name == "none")	mode = Mode::None;
+	else if (name == "touch")	mode = Mode::Prefault;
+	else if (name == "lock")	mode = Mode::Lock;
+	else return false;
+	return true;
+}
+
+inline void ResidentMemory::touch(const Range & range, const Range & exact)
+{
+	auto begin = std::max(range.first, exact.first);
+	auto end   = std::min(range.second, exact.second);
+	if (begin >= end) return;
+
+	// a volatile read isn't optimized away. Stepping from an unaligned begin can skip the page of the last byte
+	auto page = getPageSize();
+	for (auto address = begin; address < end; address += page)
+	{
+		(void)*reinterpret_cast<volatile const char*>(address);
+	}
+	(void)*reinterpret_cast<volatile const char*>(end - 1);
+}
+
+#if _WIN32
+
+inline size_t ResidentMemory::getPageSize()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+}
+
+inline void ResidentMemory::advise(const Range & range)
+{
+	// there's no read ahead for a range of a mapping before Windows 8, the pages are read by touch()
+}
+
+inline bool ResidentMemory::lock(const Range & range)
+{
+	// the working set of the process limits the locked pages
+	return VirtualLock(reinterpret_cast<void*>(range.first), range.second - range.first) != 0;
+}
+
+inline void ResidentMemory::unlock(const Range & range)
+{
+	VirtualUnlock(reinterpret_cast<void*>(range.first), range.second - range.first);
+}
+
+#else
+
+inline size_t ResidentMemory::getPageSize()
+{
+	static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return pageSize;
+}
+
+inline void ResidentMemory::advise(const Range & range)
+{
+#ifdef MADV_WILLNEED
+	madvise(reinterpret_cast<void*>(range.first), range.second - range.first, MADV_WILLNEED);
+#endif
+}
+
+inline bool ResidentMemory::lock(const Range & range)
+{
+	return mlock(reinterpret_cast<const void*>(range.first), range.second - range.first) == 0;
+}
+
+inline void ResidentMemory::unlock(const Range & range)
+{
+	// fails harmlessly if the memory was unmapped meanwhile
+	munlock(reinterpret_cast<const void*>(range.first), range.second - range.first);
+}
+
+#endif
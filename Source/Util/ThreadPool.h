@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+/*
+	Minimal fixed size thread pool. Tasks are executed in submission order by the worker threads.
+	A pool with zero threads executes every task directly in enqueue(), which keeps single threaded
+	code paths identical to the multi threaded ones.
+	The destructor finishes all queued tasks before joining the workers.
+*/
+class ThreadPool
+{
+public:
+	inline ThreadPool(unsigned int numThreads);
+	inline ~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	template<class F>
+	inline std::future<typename std::result_of<F()>::type> enqueue(F func);
+
+	inline unsigned int size() const;
+
+	// number of hardware threads, at least 1
+	static inline unsigned int defaultSize();
+
+private:
+	inline void workerLoop();
+
+private:
+	std::vector<std::thread>			workers;
+	std::deque<std::function<void()>>	tasks;
+
+	std::mutex							mutex;
+	std::condition_variable				condition;
+	bool								stopping{ false };
+};
+
+
+inline ThreadPool::ThreadPool(unsigned int numThreads)
+{
+	for (unsigned int i = 0; i < numThreads; i++)
+	{
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (auto & worker : workers) worker.join();
+}
+
+template<class F>
+inline std::future<typename std::result_of<F()>::type> ThreadPool::enqueue(F func)
+{
+	using ReturnType = typename std::result_of<F()>::type;
+
+	auto task = std::make_shared<std::packaged_task<ReturnType()>>(std::move(func));
+	auto future = task->get_future();
+
+	if (workers.size() == 0)
+	{
+		(*task)();
+		return future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back([task]() { (*task)(); });
+	}
+	condition.notify_one();
+	return future;
+}
+
+inline unsigned int ThreadPool::size() const
+{
+	return workers.size();
+}
+
+inline unsigned int ThreadPool::defaultSize()
+{
+	auto num = std::thread::hardware_concurrency();
+	return (num > 0) ? num : 1;
+}
+
+inline void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			if (tasks.empty()) return; // stopping and no work left
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,89 @@
+#include "VelocityLayers.h"
+#include <algorithm>
+
+void VelocityLayers::addLayer(unsigned int velocity, TableManager * tables)
+{
+	velocity = std::max(1u, std::min(velocity, NumVelocities - 1));
+
+	auto it = std::lower_bound(layers.begin(), layers.end(), velocity, [](const Layer & layer, unsigned int velocity) { return layer.velocity < velocity; });
+	if (it != layers.end() && it->velocity == velocity) it->tables = tables;
+	else layers.insert(it, Layer{ velocity, tables });
+
+	updateLookup();
+}
+
+uint64_t VelocityLayers::shareStorage()
+{
+	for (auto &layer : layers) layer.tables->shareEnvelopes(pool);
+	return pool.getSharedBytes();
+}
+
+TableBlend VelocityLayers::getBlend(unsigned int midiNote, unsigned int velocity, TableBlend && storage)
+{
+	if (layers.empty()) return TableBlend::recycle(std::move(storage));
+
+	auto &entry = lookup[std::min(velocity, NumVelocities - 1)];
+	auto &lower = layers[entry.lower];
+	auto &upper = layers[entry.upper];
+
+	bool lowerHas = (entry.weight < 1) && lower.tables->hasTable(midiNote);
+	bool upperHas = (entry.weight > 0) && upper.tables->hasTable(midiNote);
+	if (!upperHas) return lower.tables->getBlend(midiNote, std::move(storage));
+	if (!lowerHas) return upper.tables->getBlend(midiNote, std::move(storage));
+
+	// layers blending two notes themselves (see TableManager::setBlendPlayback()) can't be mixed with each other
+	if (!lower.tables->playsBlend(midiNote) && !upper.tables->playsBlend(midiNote))
+	{
+		auto blend = TableBlend::crossfade(lower.tables->getTable(midiNote), upper.tables->getTable(midiNote), entry.weight, std::move(storage));
+		if (!blend.empty()) return blend;
+		storage = std::move(blend);
+	}
+
+	auto &nearer = (entry.weight > 0.5f) ? upper : lower;
+	return nearer.tables->getBlend(midiNote, std::move(storage));
+}
+
+TableBlend::Limits VelocityLayers::getPlaybackLimits()
+{
+	TableBlend::Limits limits;
+	for (auto &layer : layers)
+	{
+		auto layerLimits = layer.tables->getPlaybackLimits();
+		limits.numBins	 = std::max(limits.numBins, layerLimits.numBins);
+		limits.frameRate = std::max(limits.frameRate, layerLimits.frameRate);
+	}
+	return limits;
+}
+
+bool VelocityLayers::hasTable(unsigned int midiNote)
+{
+	for (auto &layer : layers)
+	{
+		if (layer.tables->hasTable(midiNote)) return true;
+	}
+	return false;
+}
+
+void VelocityLayers::updateLookup()
+{
+	// below the softest and above the loudest layer the nearest one plays alone
+	unsigned int upper = 0;
+	for (unsigned int v = 0; v < NumVelocities; v++)
+	{
+		while (upper < layers.size() && layers[upper].velocity < v) upper++;
+
+		auto &entry = lookup[v];
+		if (upper == 0 || upper == layers.size())
+		{
+			entry.lower	 = entry.upper = static_cast<uint8_t>(std::min<size_t>(upper, layers.size() - 1));
+			entry.weight = 0;
+			continue;
+		}
+
+		auto &a = layers[upper - 1];
+		auto &b = layers[upper];
+		entry.lower	 = static_cast<uint8_t>(upper - 1);
+		entry.upper	 = static_cast<uint8_t>(upper);
+		entry.weight = float(v - a.velocity) / float(b.velocity - a.velocity);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "TableManager.h"
+#include "TableBlend.h"
+
+/*
+	VelocityLayers holds the tables of a bank sampled at several velocities, each layer is a TableManager of its own.
+	A note is played from the two layers around its velocity, mixed while playing (see TableBlend::crossfade()).
+	The layers of every velocity are looked up in advance, finding them doesn't depend on the number of layers.
+
+	The layers aren't owned and have to outlive this object.
+*/
+class VelocityLayers
+{
+public:
+	static const unsigned int NumVelocities	  = 128;
+	static const unsigned int DefaultVelocity = 64;
+
+	// adds the tables sampled at 'velocity' (1..127), replaces a layer of the same velocity. Not while playing
+	void addLayer(unsigned int velocity, TableManager * tables);
+	unsigned int getNumLayers() const { return static_cast<unsigned int>(layers.size()); }
+
+	// lets the layers share identical envelopes (see TableManager::shareEnvelopes()), e.g. release frames or bins
+	// that don't change with the velocity. Returns the bytes that are shared instead of stored once per layer
+	uint64_t shareStorage();
+
+	// what the player plays for midiNote at 'velocity'. Between two layers their tables are crossfaded, a note
+	// only one of them has or whose tables can't be crossfaded is played from the nearer layer. The blend is built in
+	// 'storage' (see TableBlend::recycle()), only the blend that is returned is looked up. Called on a note on by the
+	// MIDI or control thread (see Processor), never by the audio thread: it may prepare a table (lazy preparation)
+	TableBlend getBlend(unsigned int midiNote, unsigned int velocity, TableBlend && storage = TableBlend());
+
+	// the largest tables of all layers (see TableManager::getPlaybackLimits())
+	TableBlend::Limits getPlaybackLimits();
+
+	// true if any layer has a table for midiNote (see TableManager::hasTable())
+	bool hasTable(unsigned int midiNote);
+
+private:
+	struct Layer
+	{
+		unsigned int   velocity;
+		TableManager * tables;
+	};
+
+	// layers of a velocity, 'weight' is the share of the upper one
+	struct Lookup
+	{
+		uint8_t lower{ 0 };
+		uint8_t upper{ 0 };
+		float	weight{ 0 };
+	};
+
+	void updateLookup();
+
+	std::vector<Layer>					 layers;	// ascending velocity
+	std::array<Lookup, NumVelocities>	 lookup;
+	EnvelopePool						 pool;		// keeps the shared envelopes alive
+};
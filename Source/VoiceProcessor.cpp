@@ -1,8 +1,10 @@
 #include "VoiceProcessor.h"
 
-VoiceProcessor::VoiceProcessor(unsigned int voiceID, const TableManager * const tableManager)
+VoiceProcessor::VoiceProcessor(unsigned int voiceID, VelocityLayers * const layers, EnvelopeStream * const stream, ReleaseQueue * const releaseQueue)
 	:
-	tableManager(tableManager),
+	layers(layers),
+	stream(stream),
+	releaseQueue(releaseQueue),
 	AVoiceHandle(voiceID)
 {
 
@@ -10,8 +12,29 @@ VoiceProcessor::VoiceProcessor(unsigned int voiceID, const TableManager * const
 
 void VoiceProcessor::noteOn(uint32_t timeStamp, unsigned int ch, unsigned int note, unsigned int vel, bool wasStolen)
 {
-	std::lock_guard<std::mutex> lock(asyncEventMutex);
-	asyncEvent = AsyncEvent::NoteOn;
+	// called by the MIDI thread or the control thread of auto mode (see Processor::playAuto()), never by the audio
+	// thread: the table is looked up here, preparing it (lazy preparation) must not happen on the audio thread
+	auto blend = layers->getBlend(note, vel, std::move(spare));
+	if (stream != nullptr) blend.stream = stream->open(blend);
+
+	{
+		std::lock_guard<std::mutex> lock(asyncEventMutex);
+		asyncEvent = AsyncEvent::NoteOn;
+		std::swap(nextBlend, blend);
+	}
+
+	// 'blend' now holds what the player played before (see TablePlayer::setBlend()) or a note on that was never
+	// processed. Tables dropped by the manager (see TableManager::setMemoryBudget()) are destroyed with their last
+	// reference, which is handed to the release queue instead of dropped on the thread playing the note. The
+	// storage of the blend is kept for the next note on
+	if (releaseQueue != nullptr)
+	{
+		releaseQueue->push(std::move(blend.tables[0]));
+		releaseQueue->push(std::move(blend.tables[1]));
+		releaseQueue->push(std::move(blend.matrix));
+		releaseQueue->push(std::move(blend.stream));
+	}
+	spare = TableBlend::recycle(std::move(blend));
 }
 
 void VoiceProcessor::noteOff(uint32_t timeStamp)
@@ -1,8 +1,9 @@
 #pragma once
 
 #include "VoiceManager.h"
-#include "TableManager.h"
+#include "VelocityLayers.h"
 #include "TablePlayer.h"
+#include "Util/ReleaseQueue.h"
 
 #include <atomic>
 #include <mutex>
@@ -10,7 +11,9 @@
 class VoiceProcessor  : public VoiceManager::AVoiceHandle
 {
 public:
-	VoiceProcessor(unsigned int voiceID, const TableManager * const tableManager);
+	// 'stream' plays streamed tables (see EnvelopeStream), nullptr if the tables aren't streamed. The tables of
+	// blends played before are pushed to 'releaseQueue', nullptr releases them in noteOn()
+	VoiceProcessor(unsigned int voiceID, VelocityLayers * const layers, EnvelopeStream * const stream = nullptr, ReleaseQueue * const releaseQueue = nullptr);
 
 public:
 
@@ -20,7 +23,8 @@ public:
 
 	inline void process(const AudioIO::CallbackConfig & cfg, AudioIO::CallbackData * data);
 
-	inline void prepare(const AudioIO::CallbackConfig &cfg);
+	// 'limits' are the largest tables the voice plays (see VelocityLayers::getPlaybackLimits())
+	inline void prepare(const AudioIO::CallbackConfig &cfg, TableBlend::Limits limits = TableBlend::Limits());
 	
 private:
 
@@ -35,9 +39,13 @@ private:
 
 
 	TablePlayer player;
-	const TableManager * const tableManager;
+	VelocityLayers * const layers;
+	EnvelopeStream * const stream;
+	ReleaseQueue * const releaseQueue;
 
 	AsyncEvent asyncEvent{ AsyncEvent::NoEvent };
+	TableBlend nextBlend;	// table (or blend of tables) of the last note on, after the note on the blend played before
+	TableBlend spare;		// storage of a blend played before, the next note on builds its blend in it
 	std::mutex asyncEventMutex;
 
 };
@@ -52,7 +60,7 @@ inline void VoiceProcessor::process(const AudioIO::CallbackConfig & cfg, AudioIO
 			{
 				case AsyncEvent::NoteOn:
 				{
-					player.setTable(tableManager->getTable(this->getCurrentNote()));
+					player.setBlend(std::move(nextBlend));
 					player.noteOn();
 				} break;
 				case AsyncEvent::NoteOff:
@@ -67,7 +75,7 @@ inline void VoiceProcessor::process(const AudioIO::CallbackConfig & cfg, AudioIO
 	player.process(cfg, data);
 }
 
-inline void VoiceProcessor::prepare(const AudioIO::CallbackConfig & cfg)
+inline void VoiceProcessor::prepare(const AudioIO::CallbackConfig & cfg, TableBlend::Limits limits)
 {
-	player.prepare(cfg);
+	player.prepare(cfg, limits);
 }